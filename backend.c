@@ -0,0 +1,250 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <aio.h>
+
+#include <curses.h>
+#include <sndfile.h>
+#include <jack/jack.h>
+
+#include "config.h"
+#include "meterec.h"
+#include "log.h"
+#include "dsp.h"
+#include "process.h"
+#include "wavmap.h"
+#include "wavout.h"
+#include "backend.h"
+#include "clock.h"
+
+static void backend_next(struct timespec *ts, unsigned int period, unsigned int sample_rate) {
+
+	ts->tv_nsec += (long)((unsigned long long)period * 1000000000 / sample_rate);
+
+	while (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		ts->tv_sec++;
+	}
+}
+
+static void *backend_thread(void *d) {
+
+	struct backend_s *backend;
+	struct meterec_s *meterec;
+	struct process_io_s io;
+	struct timespec next, now;
+	unsigned long long start, usec;
+	unsigned int port, channels, nframes, i;
+	float *in, *out, *buf;
+	sf_count_t got;
+
+	backend = (struct backend_s *)d;
+	meterec = backend->meterec;
+
+	log_thread(meterec, LOG_PROCESS);
+
+	io.in = (float **) malloc(2 * meterec->n_ports * sizeof(float *));
+	io.out = io.in + meterec->n_ports;
+
+	/* in ports, out ports, monitor, then one interleaved period */
+	in = backend->mem;
+	out = in + meterec->n_ports * backend->period;
+	buf = out + meterec->n_ports * backend->period + backend->period;
+
+	for (port = 0; port < meterec->n_ports; port++) {
+		io.in[port] = in + port * backend->period;
+		io.out[port] = out + port * backend->period;
+	}
+	io.mon = out + meterec->n_ports * backend->period;
+	io.transport_state = JackTransportRolling;
+	io.transport_frame = 0;
+
+	channels = backend->in ? backend->in->channels : 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (backend->running) {
+
+		nframes = backend->period;
+
+		if (backend->frames && backend->frames - backend->done < nframes)
+			nframes = backend->frames - backend->done;
+
+		if (!nframes)
+			break;
+
+		if (backend->in) {
+
+			got = wavmap_read_float(backend->in, buf, (sf_count_t)nframes * channels) / channels;
+
+			if (!got)
+				break;
+
+			/* silence after end of input and on ports without a channel */
+			dsp.zero(in, meterec->n_ports * backend->period);
+
+			for (port = 0; port < meterec->n_ports && port < channels; port++)
+				dsp.deinterleave(io.in[port], buf + port, channels, got);
+
+			nframes = got;
+		}
+
+		start = now_usec();
+
+		process_data(meterec, nframes, &io);
+
+		usec = now_usec() - start;
+		backend->process_usec += usec;
+		if (usec > backend->process_max)
+			backend->process_max = usec;
+
+		if (backend->out) {
+			for (i = 0; i < nframes; i++)
+				for (port = 0; port < meterec->n_ports; port++)
+					buf[i * meterec->n_ports + port] = io.out[port][i];
+
+			wavout_writef_float(backend->out, buf, nframes);
+		}
+
+		backend->done += nframes;
+		io.transport_frame += nframes;
+
+		if (backend->period_done)
+			backend->period_done(backend, usec);
+
+		if (backend->realtime) {
+
+			backend_next(&next, backend->period, backend->sample_rate);
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+				backend->late++;
+			else
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+	}
+
+	free(io.in);
+
+	backend->running = 0;
+
+	return (void*)0;
+}
+
+int backend_start(struct meterec_s *meterec, struct backend_s *backend) {
+
+	unsigned int channels;
+
+	backend->meterec = meterec;
+	backend->running = 0;
+	backend->done = 0;
+	backend->late = 0;
+	backend->process_usec = 0;
+	backend->process_max = 0;
+	backend->in = NULL;
+	backend->out = NULL;
+
+	if (!backend->period || !backend->sample_rate || !meterec->n_ports)
+		return -1;
+
+	if (backend->type == BACKEND_FILE) {
+
+		backend->in = wavmap_open(backend->in_file, 0);
+
+		if (!backend->in) {
+			fprintf(stderr, "Cannot read '%s', only uncompressed WAV or W64 files are supported.\n", backend->in_file);
+			return -1;
+		}
+
+		backend->out = wavout_open(backend->out_file, SF_FORMAT_W64 | SF_FORMAT_PCM_32, meterec->n_ports, backend->sample_rate, WAVOUT_SYNC);
+
+		if (!backend->out) {
+			fprintf(stderr, "Cannot write '%s'.\n", backend->out_file);
+			wavmap_close(backend->in);
+			backend->in = NULL;
+			return -1;
+		}
+	}
+
+	/* interleaved period is as wide as the widest of input file and out ports */
+	channels = meterec->n_ports;
+	if (backend->in && backend->in->channels > channels)
+		channels = backend->in->channels;
+
+	backend->mem = calloc((2 * meterec->n_ports + 1 + channels) * backend->period, sizeof(float));
+
+	if (!backend->mem) {
+		fprintf(stderr, "Cannot allocate backend buffers.\n");
+		backend_wait(backend);
+		return -1;
+	}
+
+	/* the engine sees the backend as it would see jackd, disk threads may be reading the rate already */
+	if (meterec->jack.sample_rate != backend->sample_rate)
+		meterec->jack.sample_rate = backend->sample_rate;
+	meterec->jack_buffsize = backend->period;
+	meterec->jack_transport = 0;
+
+	backend->running = 1;
+
+	if (pthread_create(&backend->thread, NULL, backend_thread, (void *)backend)) {
+		backend->running = 0;
+		free(backend->mem);
+		backend->mem = NULL;
+		backend_wait(backend);
+		return -1;
+	}
+
+	return 0;
+}
+
+void backend_wait(struct backend_s *backend) {
+
+	if (backend->mem) {
+		pthread_join(backend->thread, NULL);
+		free(backend->mem);
+		backend->mem = NULL;
+	}
+
+	if (backend->out) {
+		wavout_close(backend->out);
+		backend->out = NULL;
+	}
+
+	wavmap_close(backend->in);
+	backend->in = NULL;
+}
+
+void backend_stop(struct backend_s *backend) {
+
+	backend->running = 0;
+
+	backend_wait(backend);
+}
@@ -0,0 +1,71 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+/* offline backend types */
+#define BACKEND_NULL 0 /* silence on in ports, out ports dropped */
+#define BACKEND_FILE 1 /* in ports read from a file, out ports written to a file */
+
+/*
+note :
+- an offline backend calls the same process path as jack, from its own thread,
+  with the period and sample rate it is given, so the engine runs without jackd.
+- realtime paces periods on the clock like a sound card would, otherwise periods
+  run back to back, as fast as the machine goes.
+- the file backend reads in ports from an uncompressed WAV/W64 file, channel n
+  feeding port n, writes out ports to a 32 bits PCM W64 file, and stops at the
+  end of the input file.
+- frames limits the run length, 0 runs until backend_stop().
+- period_done, if set, is called from the backend thread after each period with
+  the time spent in the process path, arg is left to the caller.
+*/
+struct backend_s
+{
+	unsigned int type;
+	unsigned int period;
+	unsigned int sample_rate;
+	unsigned int realtime;
+	unsigned long long frames;
+
+	const char *in_file;
+	const char *out_file;
+
+	void (*period_done)(struct backend_s *backend, unsigned long long usec);
+	void *arg;
+
+	/* filled by the backend */
+	unsigned int running;
+	unsigned long long done;         /* frames processed */
+	unsigned long long late;         /* periods started after their deadline */
+	unsigned long long process_usec; /* time spent in the process path */
+	unsigned long long process_max;  /* longest period in the process path */
+
+	pthread_t thread;
+	struct meterec_s *meterec;
+	struct wavmap_s *in;
+	struct wavout_s *out;
+	float *mem;
+};
+
+int  backend_start(struct meterec_s *meterec, struct backend_s *backend);
+void backend_wait (struct backend_s *backend);
+void backend_stop (struct backend_s *backend);
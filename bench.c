@@ -0,0 +1,587 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+** Benchmark of the whole engine without jackd: a synthetic session of N ports
+** spread over M takes is generated, then an offline backend drives the process
+** path while the reader and writer threads stream the takes. One phase plays
+** back with seeks, a second one records all ports while playing back.
+** Reports process time percentiles, reader and writer throughput, seek to
+** audio latency and disk buffer headroom, as text or as one JSON object.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <getopt.h>
+#include <aio.h>
+
+#include <curses.h>
+#include <sndfile.h>
+#include <jack/jack.h>
+
+#include "config.h"
+#include "meterec.h"
+#include "log.h"
+#include "disk.h"
+#include "queue.h"
+#include "dsp.h"
+#include "wavmap.h"
+#include "wavout.h"
+#include "engine.h"
+#include "backend.h"
+#include "clock.h"
+
+#define SESSION "bench"
+#define CHUNK 4096
+#define WAIT_USEC 1000000 /* give up waiting for a disk thread after this */
+
+#define PHASE_PLAY 0
+#define PHASE_RECORD 1
+#define PHASE_DONE 2
+
+struct bench_s
+{
+	unsigned int ports;
+	unsigned int takes;
+	unsigned int bits;
+	unsigned int rate;
+	unsigned int period;
+	unsigned int seconds;
+	unsigned int seeks;
+	unsigned int realtime;
+	unsigned int preload;
+	unsigned int json;
+	const char *ext;
+	int format;
+
+	/* filled while running, from the backend thread */
+	unsigned int phase;
+	unsigned long long periods;      /* periods per phase */
+	unsigned long long n_usec;
+	unsigned int *usec;              /* process time of each period */
+	unsigned long long phase_start[2];
+	unsigned long long phase_usec[2];
+	unsigned long long phase_frames[2];
+
+	unsigned int read_min;           /* disk buffer headroom, frames */
+	unsigned int write_min;
+	unsigned int underruns;          /* periods the reader was not ahead of process */
+	unsigned int overflows;          /* periods the writer was not behind process */
+
+	unsigned int n_seek;
+	unsigned int seek_target;
+	unsigned long long seek_start;
+	unsigned int *seek_usec;
+
+	unsigned long long prime_usec;
+	pthread_t reader;
+	pthread_t writer;
+	struct meterec_s *meterec;
+};
+
+static struct bench_s *bench;
+
+/* disk threads need it, meterec.c is not linked in */
+void exit_on_error(char * reason) {
+
+	printf("Error: %s\n", reason);
+	exit(1);
+}
+
+/******************************************************************************
+** SESSION
+*/
+
+static char *take_name(unsigned int take) {
+
+	char *name;
+
+	name = (char *) malloc( strlen(SESSION) + strlen("_0000.") + strlen(bench->ext) + 1 );
+	sprintf(name, "%s_%04d.%s", SESSION, take, bench->ext);
+
+	return name;
+}
+
+/* take t holds the tracks of ports p where p % takes == t - 1 */
+static int make_session(struct meterec_s *meterec) {
+
+	struct wavout_s *out;
+	struct take_s *take;
+	unsigned int t, port, track, i;
+	unsigned long long frame, frames;
+	float *buf;
+	int n;
+
+	frames = (unsigned long long)bench->seconds * bench->rate;
+	buf = malloc((size_t)CHUNK * bench->ports * sizeof(float));
+
+	for (t = 1; t <= bench->takes; t++) {
+
+		take = &meterec->takes[t];
+		take->take_file = take_name(t);
+		take->layout = TAKE_INTERLEAVED;
+
+		for (port = t - 1; port < bench->ports; port += bench->takes) {
+			take_set_track(meterec, t, take->ntrack, port);
+			take->ntrack++;
+		}
+
+		out = wavout_open(take->take_file, bench->format, take->ntrack, bench->rate, WAVOUT_SYNC);
+		if (!out) {
+			fprintf(stderr, "Cannot write '%s'.\n", take->take_file);
+			free(buf);
+			return -1;
+		}
+
+		for (frame = 0; frame < frames; frame += n) {
+
+			n = (frames - frame < CHUNK) ? frames - frame : CHUNK;
+
+			for (i = 0; i < n; i++)
+				for (track = 0; track < take->ntrack; track++)
+					buf[i * take->ntrack + track] = ((frame + i) * (take->track_port_map[track] + 1) % 997) / 498.5f - 1.0f;
+
+			wavout_writef_float(out, buf, n);
+		}
+
+		if (wavout_close(out)) {
+			fprintf(stderr, "Cannot write '%s'.\n", take->take_file);
+			free(buf);
+			return -1;
+		}
+	}
+
+	meterec->n_takes = bench->takes;
+
+	free(buf);
+
+	return 0;
+}
+
+static void clean_session(const char *dir) {
+
+	DIR *d;
+	struct dirent *entry;
+
+	d = opendir(".");
+
+	if (d) {
+		while ((entry = readdir(d)))
+			if (entry->d_name[0] != '.')
+				unlink(entry->d_name);
+		closedir(d);
+	}
+
+	if (chdir("..") == 0)
+		rmdir(dir);
+}
+
+/******************************************************************************
+** PERIOD
+*/
+
+static unsigned int read_headroom(struct meterec_s *meterec) {
+
+	return meterec->dbuf_size - ((meterec->read_disk_buffer_process_pos - CURSOR_GET(meterec->read_disk_buffer_thread_pos)) & (meterec->dbuf_size - 1));
+}
+
+static unsigned int write_headroom(struct meterec_s *meterec) {
+
+	return meterec->dbuf_size - ((meterec->write_disk_buffer_process_pos - CURSOR_GET(meterec->write_disk_buffer_thread_pos)) & (meterec->dbuf_size - 1));
+}
+
+static void start_phase(struct meterec_s *meterec, unsigned int phase) {
+
+	unsigned int port;
+
+	bench->phase = phase;
+
+	if (phase == PHASE_RECORD) {
+
+		for (port = 0; port < meterec->n_ports; port++)
+			meterec->ports[port].record = REC;
+
+		compute_tracks_to_record(meterec);
+		meterec->record_cmd = START;
+		pthread_create(&bench->writer, NULL, writer_thread, (void *)meterec);
+	}
+
+	if (phase < PHASE_DONE)
+		bench->phase_start[phase] = now_usec();
+}
+
+static void end_phase(struct meterec_s *meterec) {
+
+	unsigned int phase = bench->phase;
+
+	bench->phase_usec[phase] = now_usec() - bench->phase_start[phase];
+
+	if (phase == PHASE_RECORD) {
+		__atomic_store_n(&meterec->record_cmd, STOP, __ATOMIC_RELEASE);
+		thread_wake(&meterec->writer_wake);
+	}
+
+	start_phase(meterec, phase + 1);
+}
+
+/* runs in the backend thread, after each period */
+static void period_done(struct backend_s *backend, unsigned long long usec) {
+
+	struct meterec_s *meterec = backend->meterec;
+	unsigned long long start;
+	unsigned int room, n;
+
+	bench->usec[bench->n_usec++] = usec;
+	bench->phase_frames[bench->phase] += backend->period;
+
+	/* seek latency: until the process played from the new position */
+	if (bench->seek_start && !event_pending(meterec, SEEK)) {
+		bench->seek_usec[bench->n_seek++] = now_usec() - bench->seek_start;
+		bench->seek_start = 0;
+	}
+
+	if (bench->phase == PHASE_PLAY && !bench->seek_start && bench->n_seek < bench->seeks) {
+
+		/* spread over the phase, a seek due while one is pending waits for it */
+		n = bench->periods / (bench->seeks + 1);
+		if (bench->n_usec >= (unsigned long long)(bench->n_seek + 1) * n) {
+			bench->seek_target = rand() % (bench->seconds * bench->rate);
+			bench->seek_start = now_usec();
+
+			pthread_mutex_lock(&meterec->event_mutex);
+			add_event(meterec, DISK, SEEK, MAX_FRAME, bench->seek_target, MAX_UINT);
+			pthread_mutex_unlock(&meterec->event_mutex);
+		}
+	}
+
+	room = read_headroom(meterec);
+	if (room < bench->read_min)
+		bench->read_min = room;
+	if (room <= backend->period)
+		bench->underruns++;
+
+	if (bench->phase == PHASE_RECORD) {
+		room = write_headroom(meterec);
+		if (room < bench->write_min)
+			bench->write_min = room;
+		if (room <= backend->period)
+			bench->overflows++;
+	}
+
+	/* back to back periods go as fast as the disk threads keep up */
+	if (!bench->realtime) {
+
+		start = now_usec();
+
+		while (read_headroom(meterec) <= 2 * backend->period && now_usec() - start < WAIT_USEC)
+			usleep(100);
+
+		if (bench->phase == PHASE_RECORD && meterec->record_sts == ONGOING)
+			while (write_headroom(meterec) <= 2 * backend->period && now_usec() - start < WAIT_USEC)
+				usleep(100);
+	}
+
+	if (bench->n_usec == (bench->phase + 1) * bench->periods) {
+		end_phase(meterec);
+		if (bench->phase == PHASE_DONE)
+			backend->running = 0;
+	}
+}
+
+/******************************************************************************
+** REPORT
+*/
+
+static int cmp_uint(const void *a, const void *b) {
+
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+static unsigned int percentile(unsigned int *v, unsigned long long n, unsigned int pct) {
+
+	if (!n)
+		return 0;
+
+	return v[(n - 1) * pct / 100];
+}
+
+static double mb_s(unsigned long long frames, unsigned int channels, unsigned long long usec) {
+
+	if (!usec)
+		return 0.0;
+
+	return (double)frames * channels * (bench->bits / 8) / usec;
+}
+
+/* mean process cost of one port in one period */
+static double ns_per_port(unsigned int *v, unsigned long long n) {
+
+	unsigned long long i, sum = 0;
+
+	if (!n)
+		return 0.0;
+
+	for (i = 0; i < n; i++)
+		sum += v[i];
+
+	return 1000.0 * sum / n / bench->ports;
+}
+
+static void report(struct backend_s *backend) {
+
+	struct meterec_s *meterec = bench->meterec;
+	unsigned int *play, *rec, n_play, n_rec, period_usec;
+	double prime, reader, writer, load, play_port, rec_port;
+
+	n_play = bench->periods;
+	n_rec = bench->n_usec - n_play;
+	play = bench->usec;
+	rec = bench->usec + n_play;
+
+	qsort(play, n_play, sizeof(unsigned int), cmp_uint);
+	qsort(rec, n_rec, sizeof(unsigned int), cmp_uint);
+	qsort(bench->seek_usec, bench->n_seek, sizeof(unsigned int), cmp_uint);
+
+	period_usec = (unsigned long long)bench->period * 1000000 / bench->rate;
+	load = 100.0 * percentile(play, n_play, 99) / period_usec;
+
+	play_port = ns_per_port(play, n_play);
+	rec_port = ns_per_port(rec, n_rec);
+
+	prime = mb_s(meterec->dbuf_size, bench->ports, bench->prime_usec);
+	reader = mb_s(bench->phase_frames[PHASE_PLAY], bench->ports, bench->phase_usec[PHASE_PLAY]);
+	writer = mb_s(bench->phase_frames[PHASE_RECORD], bench->ports, bench->phase_usec[PHASE_RECORD]);
+
+	if (bench->json) {
+		printf("{\"ports\": %u, \"takes\": %u, \"format\": \"%s\", \"bits\": %u, \"rate\": %u, \"period\": %u, \"seconds\": %u, \"realtime\": %u, \"preload\": %u, \"dbuf_frames\": %u,\n",
+			bench->ports, bench->takes, bench->ext, bench->bits, bench->rate, bench->period, bench->seconds, bench->realtime, bench->preload, meterec->dbuf_size);
+		printf(" \"play_usec_p50\": %u, \"play_usec_p90\": %u, \"play_usec_p99\": %u, \"play_usec_max\": %u, \"play_load_p99\": %.2f,\n",
+			percentile(play, n_play, 50), percentile(play, n_play, 90), percentile(play, n_play, 99), percentile(play, n_play, 100), load);
+		printf(" \"record_usec_p50\": %u, \"record_usec_p90\": %u, \"record_usec_p99\": %u, \"record_usec_max\": %u,\n",
+			percentile(rec, n_rec, 50), percentile(rec, n_rec, 90), percentile(rec, n_rec, 99), percentile(rec, n_rec, 100));
+		printf(" \"play_ns_per_port\": %.1f, \"record_ns_per_port\": %.1f,\n", play_port, rec_port);
+		printf(" \"prime_mb_s\": %.1f, \"reader_mb_s\": %.1f, \"writer_mb_s\": %.1f,\n", prime, reader, writer);
+		printf(" \"seeks\": %u, \"seek_usec_p50\": %u, \"seek_usec_max\": %u,\n",
+			bench->n_seek, percentile(bench->seek_usec, bench->n_seek, 50), percentile(bench->seek_usec, bench->n_seek, 100));
+		printf(" \"read_headroom_min\": %u, \"write_headroom_min\": %u, \"underruns\": %u, \"overflows\": %u, \"late\": %llu}\n",
+			bench->read_min, bench->write_min, bench->underruns, bench->overflows, backend->late);
+		return;
+	}
+
+	printf("session  %d ports over %d takes, %s %d bits at %dHz, period %d, %ds per phase, %s%s\n",
+		bench->ports, bench->takes, bench->ext, bench->bits, bench->rate, bench->period, bench->seconds,
+		bench->realtime ? "realtime" : "back to back", bench->preload ? ", preloaded" : "");
+	printf("prime    %d frames disk buffer filled in %llums, %.1f MB/s\n", meterec->dbuf_size, bench->prime_usec / 1000, prime);
+	printf("play     process p50 %u p90 %u p99 %u max %uusec (p99 %.1f%% of period), reader %.1f MB/s\n",
+		percentile(play, n_play, 50), percentile(play, n_play, 90), percentile(play, n_play, 99), percentile(play, n_play, 100), load, reader);
+	printf("record   process p50 %u p90 %u p99 %u max %uusec, writer %.1f MB/s\n",
+		percentile(rec, n_rec, 50), percentile(rec, n_rec, 90), percentile(rec, n_rec, 99), percentile(rec, n_rec, 100), writer);
+	printf("per port play %.1fns record %.1fns per period on average\n", play_port, rec_port);
+	printf("seek     %d seek(s), latency p50 %uusec max %uusec\n",
+		bench->n_seek, percentile(bench->seek_usec, bench->n_seek, 50), percentile(bench->seek_usec, bench->n_seek, 100));
+	printf("headroom read min %d frames, write min %d frames, %d underrun(s), %d overflow(s), %llu late period(s)\n",
+		bench->read_min, bench->write_min, bench->underruns, bench->overflows, backend->late);
+}
+
+/******************************************************************************
+** CORE
+*/
+
+static int usage(const char *progname) {
+
+	fprintf(stderr, "%s [-p ports] [-t takes] [-f wav|w64] [-b 16|24|32] [-r rate] [-n period] [-d seconds] [-s seeks] [-x] [-m] [-j] [-l log]\n", progname);
+	fprintf(stderr, "       -x      pace periods in real time instead of back to back\n");
+	fprintf(stderr, "       -m      decode takes in memory before playing them\n");
+	fprintf(stderr, "       -j      one JSON object on stdout\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct meterec_s *meterec;
+	struct backend_s backend;
+	struct bench_s b;
+	char dir[] = "meterec-bench.XXXXXX";
+	const char *log = "/dev/null";
+	unsigned long long start;
+	int opt, ret = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.ports = 16;
+	b.takes = 4;
+	b.bits = 24;
+	b.rate = 48000;
+	b.period = 256;
+	b.seconds = 10;
+	b.seeks = 8;
+	b.ext = "w64";
+
+	while ((opt = getopt(argc, argv, "p:t:f:b:r:n:d:s:xmjl:h")) != -1) {
+		switch (opt) {
+			case 'p': b.ports = atoi(optarg); break;
+			case 't': b.takes = atoi(optarg); break;
+			case 'f': b.ext = optarg; break;
+			case 'b': b.bits = atoi(optarg); break;
+			case 'r': b.rate = atoi(optarg); break;
+			case 'n': b.period = atoi(optarg); break;
+			case 'd': b.seconds = atoi(optarg); break;
+			case 's': b.seeks = atoi(optarg); break;
+			case 'x': b.realtime = 1; break;
+			case 'm': b.preload = 1; break;
+			case 'j': b.json = 1; break;
+			case 'l': log = optarg; break;
+			case 'h':
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (strcmp(b.ext, "wav") == 0)
+		b.format = SF_FORMAT_WAV;
+	else if (strcmp(b.ext, "w64") == 0)
+		b.format = SF_FORMAT_W64;
+	else
+		usage(argv[0]);
+
+	switch (b.bits) {
+		case 16: b.format |= SF_FORMAT_PCM_16; break;
+		case 24: b.format |= SF_FORMAT_PCM_24; break;
+		case 32: b.format |= SF_FORMAT_PCM_32; break;
+		default: usage(argv[0]);
+	}
+
+	if (!b.ports || !b.takes || b.takes > b.ports || b.takes + 3 > MAX_TAKES) {
+		fprintf(stderr, "Need at least 1 port, and 1 to %d takes but no more takes than ports.\n", MAX_TAKES - 3);
+		exit(1);
+	}
+
+	if (!b.rate || !b.seconds || b.period < 16 || b.period > ZBUF_SIZE) {
+		fprintf(stderr, "Invalid rate, duration or period.\n");
+		exit(1);
+	}
+
+	b.periods = (unsigned long long)b.seconds * b.rate / b.period;
+	b.usec = calloc(2 * b.periods, sizeof(unsigned int));
+	b.seek_usec = calloc(b.seeks + 1, sizeof(unsigned int));
+	b.read_min = b.write_min = MAX_UINT;
+	bench = &b;
+
+	srand(1);
+	dsp_init(DSP_AUTO);
+
+	meterec = calloc(1, sizeof(struct meterec_s));
+	b.meterec = meterec;
+
+	init_ports(meterec);
+	init_takes(meterec);
+	pre_option_init(meterec);
+
+	meterec->fd_log = fopen(log, "w");
+	if (!meterec->fd_log) {
+		fprintf(stderr, "Cannot open log file '%s'.\n", log);
+		exit(1);
+	}
+
+	log_start(meterec);
+
+	free(meterec->session);
+	meterec->session = strdup(SESSION);
+	meterec->output_ext = strdup(b.ext);
+	meterec->output_fmt = b.format;
+	meterec->preload = b.preload;
+	alloc_ports(meterec, b.ports);
+	meterec->n_ports = b.ports;
+	meterec->jack.sample_rate = b.rate;
+
+	/* everything happens in a scratch directory, removed at the end */
+	if (!mkdtemp(dir) || chdir(dir)) {
+		fprintf(stderr, "Cannot create scratch directory.\n");
+		exit(1);
+	}
+
+	if (make_session(meterec)) {
+		clean_session(dir);
+		exit(1);
+	}
+
+	disk_alloc_buffers(meterec, meterec->n_ports);
+
+	/* reader thread primes the whole disk buffer before it reports ONGOING */
+	start = now_usec();
+	meterec->disk_cmd = START;
+	pthread_create(&b.reader, NULL, reader_thread, (void *)meterec);
+
+	while (__atomic_load_n(&meterec->disk_sts, __ATOMIC_ACQUIRE) != ONGOING)
+		usleep(100);
+
+	b.prime_usec = now_usec() - start;
+
+	memset(&backend, 0, sizeof(backend));
+	backend.type = BACKEND_NULL;
+	backend.period = b.period;
+	backend.sample_rate = b.rate;
+	backend.realtime = b.realtime;
+	backend.period_done = period_done;
+	backend.arg = &b;
+
+	meterec->playback_cmd = START;
+	start_phase(meterec, PHASE_PLAY);
+
+	if (backend_start(meterec, &backend)) {
+		fprintf(stderr, "Cannot start backend.\n");
+		ret = 1;
+	}
+	else {
+		backend_wait(&backend);
+		pthread_join(b.writer, NULL);
+		report(&backend);
+	}
+
+	__atomic_store_n(&meterec->disk_cmd, STOP, __ATOMIC_RELEASE);
+	thread_wake(&meterec->reader_wake);
+	pthread_join(b.reader, NULL);
+
+	free_ports(meterec);
+	free_takes(meterec);
+	log_stop(meterec);
+	fclose(meterec->fd_log);
+
+	clean_session(dir);
+
+	free(b.usec);
+	free(b.seek_usec);
+	free(meterec->session);
+	free(meterec->output_ext);
+	free(meterec);
+
+	return ret;
+}
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <semaphore.h>
 
 #include <curses.h>
 #include <sndfile.h>
@@ -32,6 +33,8 @@
 #include "position.h"
 #include "meterec.h"
 #include "ports.h"
+#include "disk.h"
+#include "engine.h"
 
 
 /*
@@ -101,9 +104,13 @@ void load_setup(struct meterec_s *meterec) {
 
 	while ( fread(buf, sizeof(char), 1, fd_conf) ) {
 
-		if (*buf == 'L' || *buf == 'l') {
+		/* ports are only known as they are read */
+		if (port + 1 >= meterec->max_ports)
+			alloc_ports(meterec, meterec->max_ports ? meterec->max_ports * 2 : 16);
+
+		if ((*buf == 'L' || *buf == 'l') && take < MAX_TAKES - 3) {
 			fprintf(meterec->fd_log,"Playback LOCK on Port %d take %d\n", port+1,take);
-			meterec->takes[take].port_has_lock[port] = 1 ;
+			take_set_lock(meterec, take, port, 1);
 		}
 
 
@@ -111,10 +118,6 @@ void load_setup(struct meterec_s *meterec) {
 
 		if (*buf == '|') {
 
-			/* allocate memory for this port */
-			meterec->ports[port].read_disk_buffer = calloc(DBUF_SIZE, sizeof(float));
-			meterec->ports[port].write_disk_buffer = calloc(DBUF_SIZE, sizeof(float));
-
 			/* create input ports */
 			create_input_port(meterec, port);
 			create_output_port(meterec, port);
@@ -169,6 +172,9 @@ void load_setup(struct meterec_s *meterec) {
 
 	fclose(fd_conf);
 
+	/* allocate disk buffers before jack process can see the ports */
+	disk_alloc_buffers(meterec, port);
+
 	meterec->n_ports = port ;
 
 }
@@ -191,12 +197,11 @@ void load_session(struct meterec_s *meterec) {
 	while ( fread(buf, sizeof(char), 1, fd_conf) ) {
 
 		/* content for a given port/take pair */
-		if (*buf == 'X') {
+		if (*buf == 'X' && take < MAX_TAKES - 3 && port < meterec->n_ports) {
 
 			track = meterec->takes[take].ntrack ;
 
-			meterec->takes[take].track_port_map[track] = port ;
-			meterec->takes[take].port_has_track[port] = 1 ;
+			take_set_track(meterec, take, track, port);
 			meterec->takes[take].ntrack++;
 
 			meterec->ports[port].playback_take = take ;
@@ -259,10 +264,10 @@ void save_conf(struct meterec_s *meterec) {
 
 		fprintf(fd_conf, "  { takes=\"");
 		for (take=1; take<meterec->n_takes+1; take++)
-			if ( meterec->takes[take].port_has_lock[port] )
-				fprintf(fd_conf, meterec->takes[take].port_has_track[port]?"L":"l" );
+			if ( take_has_lock(meterec, take, port) )
+				fprintf(fd_conf, take_has_track(meterec, take, port)?"L":"l" );
 			else
-				fprintf(fd_conf, meterec->takes[take].port_has_track[port]?"X":"-" );
+				fprintf(fd_conf, take_has_track(meterec, take, port)?"X":"-" );
 
 		fprintf(fd_conf, "\"; ");
 
@@ -298,7 +303,7 @@ void save_conf(struct meterec_s *meterec) {
 	fprintf(fd_conf, "takes=\n(\n");
 	for (take=1; take<meterec->n_takes+1; take++) {
 		fprintf(fd_conf, "  {");
-		fprintf(fd_conf, " offset=%-10d;",meterec->takes[take].offset);
+		fprintf(fd_conf, " offset=%-10llu;",meterec->takes[take].offset);
 		fprintf(fd_conf, " name=\"%s\";",meterec->takes[take].name?meterec->takes[take].name:"");
 		fprintf(fd_conf, " }");
 		if (take < meterec->n_takes)
@@ -310,7 +315,7 @@ void save_conf(struct meterec_s *meterec) {
 	fprintf(fd_conf, "indexes=\n{\n");
 	for (index=0; index<MAX_INDEX; index++) {
 		time.frm = meterec->seek_index[index] ;
-		if ( time.frm != (unsigned int)(-1) ) {
+		if ( time.frm != MAX_FRAME ) {
 			time_hms(&time);
 			time_sprint(&time, time_str);
 			fprintf(fd_conf,"  f%d=\"%s\";\n", index+1, time_str);
@@ -324,6 +329,35 @@ void save_conf(struct meterec_s *meterec) {
 		fprintf(fd_conf, "};\n\n");
 	}
 
+	if (meterec->dbuf_ms || meterec->take_expect_s || meterec->checkpoint_s ||
+		meterec->loop_cache_s != LOOP_CACHE_SEC || meterec->loop_fade_ms || meterec->cue_ms != CUE_CACHE_MS ||
+		meterec->preload || meterec->preload_mb != PRELOAD_MB) {
+		fprintf(fd_conf, "disk=\n{\n");
+		if (meterec->dbuf_ms)
+			fprintf(fd_conf, "  buffer_ms=%d;\n", meterec->dbuf_ms);
+		if (meterec->take_expect_s)
+			fprintf(fd_conf, "  expected_take_s=%d;\n", meterec->take_expect_s);
+		if (meterec->checkpoint_s)
+			fprintf(fd_conf, "  checkpoint_s=%d;\n", meterec->checkpoint_s);
+		if (meterec->loop_cache_s != LOOP_CACHE_SEC)
+			fprintf(fd_conf, "  loop_cache_s=%d;\n", meterec->loop_cache_s);
+		if (meterec->loop_fade_ms)
+			fprintf(fd_conf, "  loop_fade_ms=%d;\n", meterec->loop_fade_ms);
+		if (meterec->cue_ms != CUE_CACHE_MS)
+			fprintf(fd_conf, "  cue_ms=%d;\n", meterec->cue_ms);
+		if (meterec->preload)
+			fprintf(fd_conf, "  preload=%d;\n", meterec->preload);
+		if (meterec->preload_mb != PRELOAD_MB)
+			fprintf(fd_conf, "  preload_mb=%d;\n", meterec->preload_mb);
+		fprintf(fd_conf, "};\n\n");
+	}
+
+	if (meterec->stats.file_s) {
+		fprintf(fd_conf, "stats=\n{\n");
+		fprintf(fd_conf, "  file_s=%d;\n", meterec->stats.file_s);
+		fprintf(fd_conf, "};\n\n");
+	}
+
 	fprintf(fd_conf, "version=1;\n\n");
 
 	fclose(fd_conf);
@@ -365,19 +399,19 @@ unsigned int parse_takes(struct meterec_s *meterec, unsigned int port, const cha
 
 	unsigned int take = 1, track;
 
-	while ( *takes ) {
+	/* keep room for the take beeing recorded and the next one */
+	while ( *takes && take < MAX_TAKES - 3 ) {
 		switch (*takes) {
 			case '-' :
 				break;
 			case 'l' :
-				meterec->takes[take].port_has_lock[port] = 1 ;
+				take_set_lock(meterec, take, port, 1);
 				break;
 			case 'L' :
-				meterec->takes[take].port_has_lock[port] = 1 ;
+				take_set_lock(meterec, take, port, 1);
 			case 'X' :
 				track = meterec->takes[take].ntrack ;
-				meterec->takes[take].track_port_map[track] = port ;
-				meterec->takes[take].port_has_track[port] = 1 ;
+				take_set_track(meterec, take, track, port);
 				meterec->takes[take].ntrack++;
 				meterec->ports[port].playback_take = take ;
 			default :
@@ -395,11 +429,12 @@ void load_conf(struct meterec_s *meterec) {
 
 	unsigned int port=0, con=0, index=0, take=0;
 	config_t cfg, *cf;
-	const config_setting_t *take_list, *take_group, *port_list, *port_group, *connection_list, *index_group, *jack_group ;
+	const config_setting_t *take_list, *take_group, *port_list, *port_group, *connection_list, *index_group, *jack_group, *disk_group, *stats_group ;
 	unsigned int take_list_len, port_list_len, connection_list_len;
 	const char *takes, *record, *name, *port_name, *time;
 	int mute=OFF, thru=OFF;
-	int sample_rate, take_offset;
+	long long take_offset;
+	int sample_rate, buffer_ms, take_expect_s, checkpoint_s, loop_cache_s, loop_fade_ms, cue_ms, preload, preload_mb, file_s;
 	char fn[4];
 
 	fprintf(meterec->fd_log,"Loading '%s'\n", meterec->conf_file);
@@ -434,6 +469,44 @@ void load_conf(struct meterec_s *meterec) {
 		if (config_setting_lookup_int(jack_group, "sample_rate", &sample_rate))
 			meterec->jack.sample_rate = (unsigned int)sample_rate;
 
+	disk_group = config_lookup(cf, "disk");
+
+	if (disk_group) {
+		if (config_setting_lookup_int(disk_group, "buffer_ms", &buffer_ms)) {
+			if (buffer_ms > 0 && buffer_ms <= DBUF_MS_MAX)
+				meterec->dbuf_ms = (unsigned int)buffer_ms;
+			else
+				fprintf(meterec->fd_log, "Ignoring buffer_ms=%d, disk buffer length must be 1 to %d ms.\n", buffer_ms, DBUF_MS_MAX);
+		}
+
+		if (config_setting_lookup_int(disk_group, "expected_take_s", &take_expect_s))
+			meterec->take_expect_s = (unsigned int)take_expect_s;
+
+		if (config_setting_lookup_int(disk_group, "checkpoint_s", &checkpoint_s))
+			meterec->checkpoint_s = (unsigned int)checkpoint_s;
+
+		if (config_setting_lookup_int(disk_group, "loop_cache_s", &loop_cache_s))
+			meterec->loop_cache_s = (unsigned int)loop_cache_s;
+
+		if (config_setting_lookup_int(disk_group, "loop_fade_ms", &loop_fade_ms))
+			meterec->loop_fade_ms = (unsigned int)loop_fade_ms;
+
+		if (config_setting_lookup_int(disk_group, "cue_ms", &cue_ms))
+			meterec->cue_ms = (unsigned int)cue_ms;
+
+		if (config_setting_lookup_int(disk_group, "preload", &preload))
+			meterec->preload = (unsigned int)preload;
+
+		if (config_setting_lookup_int(disk_group, "preload_mb", &preload_mb))
+			meterec->preload_mb = (unsigned int)preload_mb;
+	}
+
+	stats_group = config_lookup(cf, "stats");
+
+	if (stats_group)
+		if (config_setting_lookup_int(stats_group, "file_s", &file_s))
+			meterec->stats.file_s = (unsigned int)file_s;
+
 	take_list = config_lookup(cf, "takes");
 	if (take_list) {
 		take_list_len = config_setting_length(take_list);
@@ -448,8 +521,9 @@ void load_conf(struct meterec_s *meterec) {
 					strcpy(meterec->takes[take+1].name, name);
 				}
 
-				if (config_setting_lookup_int(take_group, "offset", &take_offset)) {
-					meterec->takes[take+1].offset = (unsigned int)take_offset;
+				/* offsets past 2^31 are read back as 64 bits integers */
+				if (config_setting_lookup_int64(take_group, "offset", &take_offset)) {
+					meterec->takes[take+1].offset = (unsigned long long)take_offset;
 				}
 			}
 
@@ -460,15 +534,14 @@ void load_conf(struct meterec_s *meterec) {
 	if (port_list) {
 		port_list_len = config_setting_length(port_list);
 
+		/* as many ports as the session has, takes port maps are sized after it */
+		alloc_ports(meterec, port_list_len);
+
 		for (port=0; port<port_list_len; port++) {
 			port_group = config_setting_get_elem(port_list, port);
 
 			if (port_group) {
 
-				/* allocate memory for this port */
-				meterec->ports[port].read_disk_buffer = calloc(DBUF_SIZE, sizeof(float));
-				meterec->ports[port].write_disk_buffer = calloc(DBUF_SIZE, sizeof(float));
-
 				/* create input ports */
 				create_input_port(meterec, port);
 				create_output_port(meterec, port);
@@ -497,15 +570,10 @@ void load_conf(struct meterec_s *meterec) {
 					for (con=0; con<connection_list_len; con++) {
 						port_name = config_setting_get_string_elem(connection_list, con);
 
-						if (port_name) {
-							meterec->ports[port].connections[con] = (char *) malloc( strlen(port_name) + 1 );
-							strcpy(meterec->ports[port].connections[con], port_name);
-
-							/* store connection info */
+						/* store connection info */
+						if (port_name)
 							register_port(meterec, (char *)port_name, port);
-						}
 					}
-					meterec->ports[port].n_cons = con;
 				}
 			}
 		}
@@ -514,6 +582,9 @@ void load_conf(struct meterec_s *meterec) {
 
 	config_destroy(cf);
 
+	/* allocate disk buffers before jack process can see the ports */
+	disk_alloc_buffers(meterec, port);
+
 	meterec->n_ports = port ;
 	meterec->n_takes -= 1;
 
@@ -20,9 +20,14 @@
 
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <aio.h>
 
 #include <curses.h>
 #include <sndfile.h>
@@ -31,442 +36,1773 @@
 #include "position.h"
 #include "config.h"
 #include "meterec.h"
+#include "log.h"
 #include "disk.h"
 #include "conf.h"
 #include "queue.h"
+#include "dsp.h"
+#include "wavmap.h"
+#include "wavout.h"
+#include "engine.h"
+#include "stats.h"
 
-#define RD_BUFF_LEN ((meterec->read_disk_buffer_process_pos - meterec->read_disk_buffer_thread_pos) & (DBUF_SIZE-1))
+#define RD_BUFF_LEN ((CURSOR_GET(meterec->read_disk_buffer_process_pos) - meterec->read_disk_buffer_thread_pos) & (meterec->dbuf_size-1))
+#define WR_BUFF_LEN ((CURSOR_GET(meterec->write_disk_buffer_process_pos) - meterec->write_disk_buffer_thread_pos) & (meterec->dbuf_size-1))
+
+/* take 'buffer zero' holds samples of the latest window, not stale ones */
+#define TAKE_IN_WINDOW(take) (meterec->takes[take].window == meterec->disk.window)
 
 
 /******************************************************************************
 ** THREADs
 */
 
-void write_disk_close_fd(struct meterec_s *meterec, SNDFILE *out) {
+char *take_track_file(const char *take_file, unsigned int track) {
+
+	char *file, *dot, digits[4];
+
+	/* take file is the name of the first track file, 'session_0001_001.ext' */
+	file = (char *) malloc( strlen(take_file) + 1 );
+	strcpy(file, take_file);
+
+	dot = strrchr(file, '.');
+
+	if (dot && dot - file >= 3) {
+		snprintf(digits, sizeof(digits), "%03d", track + 1);
+		memcpy(dot - 3, digits, 3);
+	}
+
+	return file;
+}
+
+static void recover_file(struct meterec_s *meterec, const char *file) {
+
+	unsigned long long frames;
+
+	if (wavout_recover(file, &frames) == 1)
+		log_error(meterec, "Take file '%s' was not closed properly, recovered %llu frames.\n", file, frames);
+}
+
+void recover_take(struct meterec_s *meterec, unsigned int take) {
+
+	unsigned int track;
+	char *track_file;
+
+	if (meterec->takes[take].layout != TAKE_TRACKS) {
+		recover_file(meterec, meterec->takes[take].take_file);
+		return;
+	}
+
+	/* tracks files of a take go on as long as they exist */
+	for (track = 0; track < MAX_TRACKS; track++) {
+
+		track_file = take_track_file(meterec->takes[take].take_file, track);
+
+		if (access(track_file, F_OK)) {
+			free(track_file);
+			break;
+		}
+
+		recover_file(meterec, track_file);
+		free(track_file);
+	}
+}
+
+void write_disk_close_fd(struct meterec_s *meterec, SNDFILE **out, struct wavout_s **wout, unsigned int n_out) {
+
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < n_out; i++) {
+
+		if (wout[i]) {
+			if (wout[i]->stalls)
+				log_info(meterec, "Writer thread: waited %d times for disk, at most %lluusec.\n", wout[i]->stalls, wout[i]->stall_max);
+
+			error = wavout_close(wout[i]);
+			wout[i] = NULL;
+
+			if (error)
+				log_error(meterec, "Writer thread: error %d while writing take.\n", error);
+
+			continue;
+		}
+
+		sf_write_sync(out[i]);
+		sf_close(out[i]);
+	}
+
+	meterec->n_takes ++;
+
+}
+
+SNDFILE* write_disk_open_file(struct meterec_s *meterec, char *take_file, unsigned int channels, struct wavout_s **wout) {
+
+	SF_INFO info;
+	SNDFILE *out;
+
+	/* uncompressed takes are written asynchronously, without libsndfile */
+	*wout = wavout_open(take_file, meterec->output_fmt, channels, meterec->jack.sample_rate, WAVOUT_ASYNC);
+
+	if (*wout) {
+		wavout_setup(*wout,
+			(unsigned long long)meterec->take_expect_s * meterec->jack.sample_rate,
+			(unsigned long long)(meterec->checkpoint_s ? meterec->checkpoint_s : WAVOUT_CHECKPOINT_SEC) * meterec->jack.sample_rate);
+
+		log_info(meterec, "Writer thread: Opened %d track(s) file '%s' for %s writing.\n", channels, take_file, (*wout)->direct?"direct":"buffered");
+		return (SNDFILE*)NULL;
+	}
+
+	info.format = meterec->output_fmt;
+	info.channels = channels;
+	info.samplerate = meterec->jack.sample_rate;
+
+	if (!sf_format_check(&info)) {
+		log_error(meterec, "Writer thread: Cannot open take file '%s' for writing (%d, %d, %d)\n",take_file,info.format, info.channels, info.samplerate);
+		meterec->record_sts = OFF;
+		exit_on_error("Writer thread: Output file format error\n" );
+		return (SNDFILE*)NULL;
+	}
+
+	out = sf_open(take_file, SFM_WRITE, &info);
+
+	if (!out) {
+		log_error(meterec, "Writer thread: Cannot open '%s' file for writing",take_file);
+		return (SNDFILE*)NULL;
+	}
+
+	log_info(meterec, "Writer thread: Opened %d track(s) file '%s' for writing.\n", channels, take_file);
+
+	return out;
+}
+
+/* name of the first file of a take to record, and how its tracks are laid out */
+static char *write_disk_take_file(struct meterec_s *meterec, unsigned int take_idx, unsigned int n_tracks, unsigned int *layout) {
+
+	char *file;
+
+	if (meterec->output_layout == TAKE_INTERLEAVED || n_tracks == 1) {
+		*layout = TAKE_INTERLEAVED;
+		return take_default_file(meterec, take_idx);
+	}
+
+	/* one mono file per track, take file is the first track file */
+	*layout = TAKE_TRACKS;
+
+	file = (char *) malloc( strlen(meterec->session) + strlen("_000000_000.") + strlen(meterec->output_ext) + 1 );
+	sprintf(file, "%s_%04d_001.%s", meterec->session, take_idx, meterec->output_ext);
+
+	return file;
+}
+
+static unsigned int write_disk_open_files(struct meterec_s *meterec, const char *take_file, unsigned int layout, unsigned int n_tracks, SNDFILE **out, struct wavout_s **wout) {
+
+	unsigned int track;
+	char *track_file;
+
+	if (layout == TAKE_INTERLEAVED) {
+
+		out[0] = write_disk_open_file(meterec, (char *)take_file, n_tracks, &wout[0]);
+
+		return (out[0] || wout[0]) ? 1 : 0;
+	}
+
+	for (track = 0; track < n_tracks; track++) {
+
+		track_file = take_track_file(take_file, track);
+		out[track] = write_disk_open_file(meterec, track_file, 1, &wout[track]);
+		free(track_file);
+
+		if (!out[track] && !wout[track]) {
+			while (track--)
+				if (wout[track])
+					wavout_close(wout[track]);
+				else
+					sf_close(out[track]);
+			return 0;
+		}
+	}
+
+	return n_tracks;
+}
+
+unsigned int write_disk_open_fd(struct meterec_s *meterec, unsigned int take_idx, unsigned int n_tracks, SNDFILE **out, struct wavout_s **wout) {
+
+	unsigned int layout;
+	char *file;
+
+	/* takes yet to record only get a name when first opened */
+	file = write_disk_take_file(meterec, take_idx, n_tracks, &layout);
+	take_set_file(meterec, take_idx, file, layout);
+
+	return write_disk_open_files(meterec, file, layout, n_tracks, out, wout);
+}
+
+/*
+note :
+- the next take file(s) are opened by a helper thread while the current take
+  is recorded, so that a rollover only swaps handles in the writer thread.
+- the spare is opened for the tracks recorded now, it is not used (and opened
+  again synchronously) if the tracks to record changed by rollover time.
+- the spare is written under a hidden name (SPARE_PREFIX) and renamed at
+  rollover, so a crash never leaves an empty take behind; startup removes
+  stale spares. The take itself is only named by the writer thread.
+*/
+struct spare_s
+{
+	pthread_t thread;
+	unsigned int started;
+
+	unsigned int take;
+	unsigned int layout;
+	char *file;
+	char *part;
+	unsigned int n_tracks;
+	unsigned int n_out;
+	unsigned int max_out;
+	SNDFILE **out;
+	struct wavout_s **wout;
+
+	struct meterec_s *meterec;
+};
+
+static struct spare_s spare;
+
+static void *spare_thread(void *d) {
+
+	struct spare_s *spare;
+
+	spare = (struct spare_s *)d;
+
+	log_thread(spare->meterec, LOG_SPARE);
+
+	spare->n_out = write_disk_open_files(spare->meterec, spare->part, spare->layout, spare->n_tracks, spare->out, spare->wout);
+
+	return (void*)0;
+}
+
+static void spare_open(struct meterec_s *meterec, unsigned int take, unsigned int n_tracks) {
+
+	spare.meterec = meterec;
+	spare.take = take;
+	spare.n_tracks = n_tracks;
+	spare.n_out = 0;
+
+	if (take >= MAX_TAKES) {
+		spare.take = 0;
+		return;
+	}
+
+	/* previous spare thread is joined, its files are taken or closed */
+	if (spare.max_out < n_tracks) {
+		free(spare.out);
+		free(spare.wout);
+		spare.out = (SNDFILE **) calloc(n_tracks, sizeof(SNDFILE *));
+		spare.wout = (struct wavout_s **) calloc(n_tracks, sizeof(struct wavout_s *));
+		spare.max_out = n_tracks;
+	}
+
+	spare.file = write_disk_take_file(meterec, take, n_tracks, &spare.layout);
+	spare.part = (char *) malloc( strlen(SPARE_PREFIX) + strlen(spare.file) + 1 );
+	sprintf(spare.part, "%s%s", SPARE_PREFIX, spare.file);
+
+	spare.started = !pthread_create(&spare.thread, NULL, spare_thread, (void *)&spare);
+}
+
+static void spare_join(void) {
+
+	if (!spare.started)
+		return;
+
+	pthread_join(spare.thread, NULL);
+	spare.started = 0;
+}
+
+static void spare_release(void) {
+
+	free(spare.file);
+	free(spare.part);
+	spare.file = NULL;
+	spare.part = NULL;
+
+	spare.n_out = 0;
+	spare.take = 0;
+}
+
+static void spare_discard(struct meterec_s *meterec) {
+
+	unsigned int i;
+	char *track_file;
+
+	spare_join();
+
+	if (!spare.take || spare.take >= MAX_TAKES)
+		return;
+
+	for (i = 0; i < spare.n_out; i++) {
+
+		if (spare.wout[i]) {
+			wavout_close(spare.wout[i]);
+			spare.wout[i] = NULL;
+		}
+		else
+			sf_close(spare.out[i]);
+
+		if (spare.layout == TAKE_TRACKS) {
+			track_file = take_track_file(spare.part, i);
+			unlink(track_file);
+			free(track_file);
+		}
+		else
+			unlink(spare.part);
+	}
+
+	spare_release();
+}
+
+/* give the spare file(s) their take name, files stay open for writing */
+static unsigned int spare_rename(struct meterec_s *meterec) {
+
+	unsigned int i, ok = 1;
+	char *part, *file;
+
+	for (i = 0; i < spare.n_out; i++) {
+
+		if (spare.layout == TAKE_TRACKS) {
+			part = take_track_file(spare.part, i);
+			file = take_track_file(spare.file, i);
+		}
+		else {
+			part = strdup(spare.part);
+			file = strdup(spare.file);
+		}
+
+		if (rename(part, file)) {
+			log_error(meterec, "Writer thread: Cannot rename '%s' to '%s'.\n", part, file);
+			ok = 0;
+		}
+
+		free(part);
+		free(file);
+	}
+
+	return ok;
+}
+
+static unsigned int spare_get(struct meterec_s *meterec, SNDFILE **out, struct wavout_s **wout) {
+
+	unsigned int i, n_out;
+
+	spare_join();
+
+	if (spare.take == meterec->n_takes + 1 && spare.n_out && spare.n_tracks == meterec->n_tracks && spare_rename(meterec)) {
+
+		for (i = 0; i < spare.n_out; i++) {
+			out[i] = spare.out[i];
+			wout[i] = spare.wout[i];
+			spare.wout[i] = NULL;
+		}
+
+		n_out = spare.n_out;
+
+		take_set_file(meterec, spare.take, spare.file, spare.layout);
+		spare.file = NULL;
+
+		spare_release();
+
+		return n_out;
+	}
+
+	spare_discard(meterec);
+
+	log_info(meterec, "Writer thread: next take file not ready, opening it now.\n");
+
+	return write_disk_open_fd(meterec, meterec->n_takes + 1, meterec->n_tracks, out, wout);
+}
+
+void write_disk_buffer(SNDFILE **out, struct wavout_s **wout, unsigned int n_out, float *buf, unsigned int nframes) {
+
+	unsigned int i;
+	float *track_buf;
+
+	if (!nframes)
+		return;
+
+	for (i = 0; i < n_out; i++) {
+
+		/* one interleaved file, or planar buffer with one file per track */
+		track_buf = buf + i * ZBUF_SIZE;
+
+		if (wout[i])
+			wavout_writef_float(wout[i], track_buf, nframes);
+		else
+			sf_writef_float(out[i], track_buf, nframes);
+	}
+}
+
+static void writer_free(SNDFILE **out, struct wavout_s **wout, float **rec, float *buf) {
+
+	free(out);
+	free(wout);
+	free(rec);
+	free(buf);
+}
+
+static void writer_tracks(struct meterec_s *meterec, float **rec) {
+
+	struct take_s *take;
+	unsigned int track;
+
+	/* disk buffers of the ports recorded, in take track order */
+	take = &meterec->takes[meterec->n_takes + 1];
+
+	for (track = 0; track < meterec->n_tracks; track++)
+		rec[track] = meterec->ports[take->track_port_map[track]].write_disk_buffer;
+}
+
+void *writer_thread(void *d) {
+	unsigned int i, n, zbuff_pos, track, thread_delay, woken=0, n_out, frame_stride, track_stride, limit, rollover;
+	SNDFILE **out;
+	struct wavout_s **wout;
+	float *buf, **rec;
+	struct meterec_s *meterec ;
+
+	meterec = (struct meterec_s *)d ;
+
+	log_thread(meterec, LOG_WRITER);
+
+	__atomic_store_n(&meterec->record_sts, STARTING, __ATOMIC_RELEASE);
+
+	log_info(meterec, "Writer thread: Started.\n");
+
+	thread_delay = set_thread_delay(meterec);
+
+	/* sized for every port of the session beeing recorded */
+	out = (SNDFILE **) calloc(meterec->n_ports, sizeof(SNDFILE *));
+	wout = (struct wavout_s **) calloc(meterec->n_ports, sizeof(struct wavout_s *));
+	rec = (float **) calloc(meterec->n_ports, sizeof(float *));
+	buf = (float *) malloc(ZBUF_SIZE * meterec->n_ports * sizeof(float));
+
+	/* Open the output file(s) */
+	n_out = write_disk_open_fd(meterec, meterec->n_takes + 1, meterec->n_tracks, out, wout);
+
+	if (!n_out) {
+		writer_free(out, wout, rec, buf);
+		meterec->record_sts = OFF;
+		return (void*)1;
+	}
+
+	writer_tracks(meterec, rec);
+
+	/* get the take after this one ready */
+	spare_open(meterec, meterec->n_takes + 2, meterec->n_tracks);
+
+	/* 'buffer zero' is interleaved for one file, planar for one file per track */
+	frame_stride = (n_out == 1) ? meterec->n_tracks : 1;
+	track_stride = (n_out == 1) ? 1 : ZBUF_SIZE;
+
+	/* Start writing the RT ringbuffer to disk */
+	__atomic_store_n(&meterec->record_sts, ONGOING, __ATOMIC_RELEASE);
+	zbuff_pos = 0;
+	while (meterec->record_sts) {
+
+		/* do not drain past the first sample of the next take */
+		rollover = __atomic_load_n(&meterec->rollover.pending, __ATOMIC_ACQUIRE);
+		limit = rollover ? meterec->rollover.buffer_pos : CURSOR_GET(meterec->write_disk_buffer_process_pos);
+
+		i = meterec->write_disk_buffer_thread_pos;
+
+		n = (limit - i) & (meterec->dbuf_size - 1);
+		if (n > ZBUF_SIZE - zbuff_pos)
+			n = ZBUF_SIZE - zbuff_pos;
+
+		/* one strided copy per track recorded, not a pass over all ports per frame */
+		for (track = 0; track < meterec->n_tracks; track++)
+			dsp_ring_interleave(buf + zbuff_pos * frame_stride + track * track_stride, frame_stride,
+				rec[track], i, meterec->dbuf_size, n);
+
+		i = (i + n) & (meterec->dbuf_size - 1);
+		zbuff_pos += n;
+
+		if (zbuff_pos == ZBUF_SIZE) {
+			write_disk_buffer(out, wout, n_out, buf, zbuff_pos);
+			zbuff_pos = 0;
+		}
+
+		CURSOR_SET(meterec->write_disk_buffer_thread_pos, i);
+
+		if (woken) {
+			if (thread_wake_done(&meterec->writer_wake))
+				log_info(meterec, "Writer thread: new maximum wake to drain latency %lluusec.\n", meterec->writer_wake.latency_max);
+			hist_add(&meterec->stats.writer_wake, meterec->writer_wake.latency);
+			woken = 0;
+		}
+
+		if (rollover && i == limit) {
+
+			/* finished take ends exactly at the rollover sample */
+			write_disk_buffer(out, wout, n_out, buf, zbuff_pos);
+			zbuff_pos = 0;
+
+			write_disk_close_fd(meterec, out, wout, n_out);
+
+			compute_tracks_to_record(meterec);
+			meterec->takes[meterec->n_takes+1].offset = meterec->rollover.playhead;
+
+			n_out = spare_get(meterec, out, wout);
+
+			if (!n_out) {
+				writer_free(out, wout, rec, buf);
+				meterec->record_sts = OFF;
+				return (void*)1;
+			}
+
+			writer_tracks(meterec, rec);
+
+			frame_stride = (n_out == 1) ? meterec->n_tracks : 1;
+			track_stride = (n_out == 1) ? 1 : ZBUF_SIZE;
+
+			__atomic_store_n(&meterec->rollover.pending, 0, __ATOMIC_RELEASE);
+
+			log_info(meterec, "Writer thread: take %d started at frame %llu.\n", meterec->n_takes + 1, meterec->rollover.playhead);
+
+			if (meterec->config_sts)
+				__atomic_store_n(&meterec->config_save, 1, __ATOMIC_RELEASE);
+
+			spare_open(meterec, meterec->n_takes + 2, meterec->n_tracks);
+
+			continue;
+		}
+
+		/* run until empty buffer after a stop requets */
+		if (meterec->record_sts == STOPING)
+			if ( meterec->write_disk_buffer_thread_pos == CURSOR_GET(meterec->write_disk_buffer_process_pos) ) {
+				write_disk_buffer(out, wout, n_out, buf, zbuff_pos);
+				break;
+			}
+
+		if (__atomic_load_n(&meterec->record_cmd, __ATOMIC_ACQUIRE) == STOP)
+			meterec->record_sts = STOPING ;
+
+		/* sleep until jack process has enough data for us (or timeout) */
+		if (meterec->record_sts != STOPING)
+			if (WR_BUFF_LEN < DBUF_WAKE)
+				woken = thread_wait(&meterec->writer_wake, thread_delay);
+
+	}
+
+	write_disk_close_fd(meterec, out, wout, n_out);
+
+	spare_discard(meterec);
+
+	__atomic_store_n(&meterec->rollover.pending, 0, __ATOMIC_RELEASE);
+
+	if (meterec->config_sts)
+		save_conf(meterec);
+
+	log_info(meterec, "Writer thread: wake to drain latency %lluusec (max %lluusec).\n",
+		meterec->writer_wake.latency, meterec->writer_wake.latency_max);
+
+	log_info(meterec, "Writer thread: done.\n");
+
+	writer_free(out, wout, rec, buf);
+
+	meterec->record_sts = OFF;
+
+	return (void*)0;
+}
+
+void read_disk_unmap(struct meterec_s *meterec, struct wavmap_s **map) {
+
+	if (*map && (*map)->ram)
+		meterec->preload_bytes -= (*map)->len;
+
+	wavmap_close(*map);
+	*map = NULL;
+}
+
+static void read_disk_preload_cancel(struct meterec_s *meterec, unsigned int take, unsigned int track);
+
+void read_disk_close_track(struct meterec_s *meterec, unsigned int take, unsigned int track) {
+
+	read_disk_preload_cancel(meterec, take, track);
+
+	if (meterec->takes[take].track_fd[track]) {
+		sf_close(meterec->takes[take].track_fd[track]);
+		meterec->takes[take].track_fd[track] = NULL;
+	}
+
+	read_disk_unmap(meterec, &meterec->takes[take].track_map[track]);
+}
+
+void read_disk_close_take(struct meterec_s *meterec, unsigned int take) {
+
+	unsigned int track;
+
+	read_disk_preload_cancel(meterec, take, MAX_UINT);
+
+	if (meterec->takes[take].take_fd)
+		sf_close(meterec->takes[take].take_fd);
+
+	read_disk_unmap(meterec, &meterec->takes[take].take_map);
+
+	for (track=0; track<meterec->takes[take].ntrack; track++)
+		read_disk_close_track(meterec, take, track);
+
+	free(meterec->takes[take].buf);
+	meterec->takes[take].buf = NULL;
+	meterec->takes[take].take_fd = NULL;
+	meterec->takes[take].playing = 0;
+}
+
+void read_disk_close_fd(struct meterec_s *meterec) {
+
+	unsigned int take;
+
+	/* close all fd's */
+	for (take=1; take<meterec->n_takes+1; take++)
+		if (meterec->takes[take].buf)
+			read_disk_close_take(meterec, take);
+}
+
+unsigned int take_port_track(struct meterec_s *meterec, unsigned int take, unsigned int port) {
+
+	unsigned int track;
+
+	for (track=0; track<meterec->takes[take].ntrack; track++)
+		if (meterec->takes[take].track_port_map[track] == port)
+			break;
+
+	return track;
+}
+
+void read_disk_plan(struct meterec_s *meterec) {
+
+	unsigned int take, track, port, span;
+	unsigned long long start, end;
+	struct plan_s *plan;
+
+	meterec->n_plan = 0;
+
+	/* list (take, track, port) copies needed to demux takes 'buffer zero' */
+	for (port=0; port<meterec->n_ports; port++) {
+
+		take = meterec->ports[port].playback_take;
+
+		if (!take || meterec->takes[take].buf == NULL)
+			continue;
+
+		track = take_port_track(meterec, take, port);
+
+		if (track == meterec->takes[take].ntrack)
+			continue;
+
+		plan = &meterec->plan[meterec->n_plan];
+
+		plan->take = take;
+		plan->track = track;
+		plan->port = port;
+
+		if (meterec->takes[take].layout == TAKE_TRACKS) {
+			plan->buf = meterec->takes[take].buf + track * ZBUF_SIZE;
+			plan->stride = 1;
+		}
+		else {
+			plan->buf = meterec->takes[take].buf + track;
+			plan->stride = meterec->takes[take].ntrack;
+		}
+
+		meterec->n_plan++;
+	}
+
+	/* timeline index of takes played back, sorted by start */
+	meterec->n_span = 0;
+
+	for (take=1; take<meterec->n_takes+1; take++) {
+
+		if (!meterec->takes[take].playing || meterec->takes[take].buf == NULL)
+			continue;
+
+		start = meterec->takes[take].offset;
+		end = start + meterec->takes[take].info.frames;
+
+		for (span=meterec->n_span; span>0 && meterec->span[span-1].start > start; span--)
+			meterec->span[span] = meterec->span[span-1];
+
+		meterec->span[span].take = take;
+		meterec->span[span].start = start;
+		meterec->span[span].end = end;
+		meterec->n_span++;
+	}
+
+	log_info(meterec, "Reader thread: Playback plan has %d port(s), %d take(s) on the timeline\n", meterec->n_plan, meterec->n_span);
+}
+
+static void read_disk_silence(struct meterec_s *meterec, unsigned int port, unsigned int pos, unsigned int n) {
+
+	struct port_s *p = &meterec->ports[port];
+
+	/* ring holds nothing but 0's already */
+	if (p->zero_len == meterec->dbuf_size)
+		return;
+
+	dsp_ring_zero(p->read_disk_buffer, pos, meterec->dbuf_size, n);
+
+	if (p->zero_len && pos == ((p->zero_pos + p->zero_len) & (meterec->dbuf_size - 1)))
+		p->zero_len += n;
+	else {
+		p->zero_pos = pos;
+		p->zero_len = n;
+	}
+
+	/* jack process may skip reading it from now on */
+	if (p->zero_len >= meterec->dbuf_size) {
+		p->zero_len = meterec->dbuf_size;
+		__atomic_store_n(&p->silent, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void read_disk_sound(struct meterec_s *meterec, unsigned int port) {
+
+	/* jack process has to read the ring again before samples are written in it */
+	meterec->ports[port].zero_len = 0;
+
+	if (meterec->ports[port].silent)
+		__atomic_store_n(&meterec->ports[port].silent, 0, __ATOMIC_RELEASE);
+}
+
+sf_count_t read_disk_float(SNDFILE *fd, struct wavmap_s *map, float *buf, sf_count_t nsamples) {
+
+	if (map)
+		return wavmap_read_float(map, buf, nsamples);
+
+	return sf_read_float(fd, buf, nsamples);
+}
+
+void read_disk_preload_room(struct meterec_s *meterec, size_t len) {
+
+	unsigned int take, lru;
+
+	/* make room by closing the least recently played takes */
+	while (meterec->preload_bytes + len > (size_t)meterec->preload_mb << 20) {
+
+		lru = 0;
+
+		for (take=1; take<meterec->n_takes+1; take++)
+			if (meterec->takes[take].buf && !meterec->takes[take].playing)
+				if (!lru || meterec->takes[take].used < meterec->takes[lru].used)
+					lru = take;
+
+		if (!lru)
+			break;
+
+		log_info(meterec, "Reader thread: Closing take %d, least recently played, to preload\n", lru);
+		read_disk_close_take(meterec, lru);
+	}
+}
+
+static unsigned int read_disk_preload_fits(struct meterec_s *meterec, char *file, size_t len) {
+
+	read_disk_preload_room(meterec, len);
+
+	/* too big for the budget, stream it from disk */
+	if (meterec->preload_bytes + len > (size_t)meterec->preload_mb << 20) {
+		log_info(meterec, "Reader thread: '%s' does not fit in %dMB preload budget, streaming it\n", file, meterec->preload_mb);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* decode the whole take at once, only before playback starts */
+void read_disk_preload(struct meterec_s *meterec, char *file, SF_INFO *info, SNDFILE **fd, struct wavmap_s **map) {
+
+	struct wavmap_s *ram;
+	sf_count_t items, got;
+
+	items = info->frames * info->channels;
+
+	if (!read_disk_preload_fits(meterec, file, items * sizeof(float)))
+		return;
+
+	ram = wavmap_alloc(info->channels, info->frames);
+	if (!ram)
+		return;
+
+	got = read_disk_float(*fd, *map, (float *)ram->base, items);
+
+	/* keep what could be decoded */
+	ram->frames = got / info->channels;
+
+	if (*map)
+		wavmap_close(*map);
+	else
+		sf_close(*fd);
+
+	*fd = NULL;
+	*map = ram;
+
+	meterec->preload_bytes += ram->len;
+}
+
+/* take keeps being streamed while a handle of its own decodes it in memory */
+static void read_disk_preload_queue(struct meterec_s *meterec, char *file, SF_INFO *info, unsigned int take, unsigned int track, unsigned int mapped) {
+
+	struct preload_s *job, **last;
+	SF_INFO job_info;
+
+	if (!read_disk_preload_fits(meterec, file, (size_t)info->frames * info->channels * sizeof(float)))
+		return;
+
+	job = (struct preload_s *) calloc(1, sizeof(struct preload_s));
+
+	job->take = take;
+	job->track = track;
+	job->file = strdup(file);
+
+	if (mapped)
+		job->map = wavmap_open(file, meterec->dbuf_size);
+	else {
+		memset(&job_info, 0, sizeof(job_info));
+		job->fd = sf_open(file, SFM_READ, &job_info);
+	}
+
+	job->ram = wavmap_alloc(info->channels, info->frames);
+
+	if ((!job->fd && !job->map) || !job->ram) {
+		log_error(meterec, "Reader thread: Cannot decode '%s' in memory, streaming it\n", file);
+		if (job->ram)
+			wavmap_close(job->ram);
+		if (job->map)
+			wavmap_close(job->map);
+		if (job->fd)
+			sf_close(job->fd);
+		free(job->file);
+		free(job);
+		return;
+	}
+
+	meterec->preload_bytes += job->ram->len;
+
+	for (last = &meterec->preload_job; *last; last = &(*last)->next) ;
+	*last = job;
+
+	log_info(meterec, "Reader thread: Decoding '%s' in memory while streaming it\n", file);
+}
+
+static void read_disk_preload_end(struct meterec_s *meterec, struct preload_s **link) {
+
+	struct preload_s *job;
+
+	job = *link;
+	*link = job->next;
+
+	if (job->map)
+		wavmap_close(job->map);
+	if (job->fd)
+		sf_close(job->fd);
+
+	free(job->file);
+	free(job);
+}
+
+/* take (track) is closed, drop what was decoded of it */
+static void read_disk_preload_cancel(struct meterec_s *meterec, unsigned int take, unsigned int track) {
+
+	struct preload_s **link;
+
+	link = &meterec->preload_job;
+
+	while (*link) {
+
+		if ((*link)->take == take && (*link)->track == track) {
+			meterec->preload_bytes -= (*link)->ram->len;
+			wavmap_close((*link)->ram);
+			read_disk_preload_end(meterec, link);
+		}
+		else
+			link = &(*link)->next;
+	}
+}
+
+/* decode a few 'buffer zero' of the oldest take queued, returns 1 if takes were read */
+unsigned int read_disk_preload_update(struct meterec_s *meterec) {
+
+	struct preload_s *job;
+	struct take_s *take;
+	SNDFILE **fd;
+	struct wavmap_s **map, *ram;
+	sf_count_t n, got, pos;
+
+	job = meterec->preload_job;
+
+	if (!job)
+		return 0;
+
+	/* disk buffer comes first */
+	if (RD_BUFF_LEN > meterec->dbuf_size / 2)
+		return 0;
+
+	ram = job->ram;
+
+	n = ram->frames - job->done;
+	if (n > PRELOAD_STEP * ZBUF_SIZE)
+		n = PRELOAD_STEP * ZBUF_SIZE;
+
+	got = read_disk_float(job->fd, job->map, (float *)ram->base + job->done * ram->channels, n * ram->channels);
+	if (got < 0)
+		got = 0;
+
+	job->done += got / ram->channels;
+
+	if (got == n * ram->channels && job->done < ram->frames)
+		return 1;
+
+	/* keep what could be decoded, and swap it for the streamed file where it was read */
+	ram->frames = job->done;
+
+	take = &meterec->takes[job->take];
+
+	if (job->track == MAX_UINT) {
+		fd = &take->take_fd;
+		map = &take->take_map;
+	}
+	else {
+		fd = &take->track_fd[job->track];
+		map = &take->track_map[job->track];
+	}
+
+	if (*map) {
+		pos = (*map)->pos;
+		wavmap_close(*map);
+	}
+	else {
+		pos = sf_seek(*fd, 0, SEEK_CUR);
+		sf_close(*fd);
+	}
+
+	if (pos < 0 || pos > ram->frames)
+		pos = ram->frames;
+
+	wavmap_seek(ram, pos, SEEK_SET);
+
+	*fd = NULL;
+	*map = ram;
+
+	log_info(meterec, "Reader thread: Decoded '%s' in memory (%zu bytes)\n", job->file, ram->len);
+
+	read_disk_preload_end(meterec, &meterec->preload_job);
+
+	return 1;
+}
+
+SNDFILE* read_disk_open_file(struct meterec_s *meterec, char *file, SF_INFO *info, struct wavmap_s **map, unsigned int take, unsigned int track) {
+
+	SNDFILE *fd;
+	int type, subtype;
+
+	fd = sf_open(file, SFM_READ, info);
+
+	/* check file is (was) opened properly */
+	if (fd == NULL) {
+		meterec->disk_sts = OFF;
+		log_error(meterec, "Reader thread: Cannot open file '%s' for reading\n", file);
+		exit_on_error("Reader thread: Cannot open file for reading");
+	}
+
+	type = info->format & SF_FORMAT_TYPEMASK;
+	subtype = info->format & SF_FORMAT_SUBMASK;
+
+	/* map uncompressed takes, keep libsndfile for everything else */
+	if ((type == SF_FORMAT_WAV || type == SF_FORMAT_W64) &&
+		(subtype == SF_FORMAT_PCM_16 || subtype == SF_FORMAT_PCM_24 || subtype == SF_FORMAT_PCM_32 || subtype == SF_FORMAT_FLOAT)) {
+
+		*map = wavmap_open(file, meterec->dbuf_size);
+
+		/* do not trust our parser if it does not agree with libsndfile */
+		if (*map && ((*map)->frames != info->frames || (*map)->channels != (unsigned int)info->channels)) {
+			wavmap_close(*map);
+			*map = NULL;
+		}
+
+		if (*map) {
+			sf_close(fd);
+			fd = NULL;
+		}
+	}
+
+	/* only takes opened before playback starts are decoded at once */
+	if (meterec->preload || meterec->preload_opt) {
+		if (meterec->disk_sts == ONGOING)
+			read_disk_preload_queue(meterec, file, info, take, track, *map != NULL);
+		else
+			read_disk_preload(meterec, file, info, &fd, map);
+	}
+
+	if (*map && (*map)->ram)
+		log_info(meterec, "Reader thread: Decoded '%s' in memory (%zu bytes)\n", file, (*map)->len);
+	else if (*map)
+		log_info(meterec, "Reader thread: Mapped '%s' for reading\n", file);
+	else
+		log_info(meterec, "Reader thread: Opened '%s' for reading\n", file);
+
+	return fd;
+}
+
+void read_disk_open_fd(struct meterec_s *meterec) {
+
+	unsigned int take, track, port;
+	SF_INFO info;
+	char *track_file;
+
+	/* open all files needed for this session */
+	for (port=0; port<meterec->n_ports; port++) {
+
+		take = meterec->ports[port].playback_take;
+
+		/* do not open a file for a port that wants to playback take 0 */
+		if (!take ) {
+
+			log_info(meterec, "Reader thread: Port %d does not have a take associated\n", port+1);
+
+			/* rather fill buffer with 0's */
+			read_disk_silence(meterec, port, 0, meterec->dbuf_size);
+
+			continue;
+		}
+
+		log_info(meterec, "Reader thread: Port %d has take %d associated\n", port+1, take );
+
+		/* only open the track played back if take has one file per track */
+		if (meterec->takes[take].layout == TAKE_TRACKS) {
+
+			track = take_port_track(meterec, take, port);
+
+			if (track < meterec->takes[take].ntrack &&
+				meterec->takes[take].track_fd[track] == NULL && meterec->takes[take].track_map[track] == NULL) {
+				track_file = take_track_file(meterec->takes[take].take_file, track);
+				meterec->takes[take].track_fd[track] = read_disk_open_file(meterec, track_file, &info, &meterec->takes[take].track_map[track], take, track);
+				free(track_file);
+				take_set_info(meterec, take, &info);
+			}
+		}
+		else if (meterec->takes[take].take_fd == NULL && meterec->takes[take].take_map == NULL) {
+			meterec->takes[take].take_fd = read_disk_open_file(meterec, meterec->takes[take].take_file, &info, &meterec->takes[take].take_map, take, MAX_UINT);
+			take_set_info(meterec, take, &info);
+		}
+
+		/* only setup a take that is not defined yet  */
+		if (meterec->takes[take].buf == NULL) {
+
+			/* allocate buffer space for this take */
+			log_info(meterec, "Reader thread: Allocating local buffer space %d*%d for take %d\n",
+				meterec->takes[take].ntrack,
+				ZBUF_SIZE,
+				take);
+
+			meterec->takes[take].buf = calloc(ZBUF_SIZE*meterec->takes[take].ntrack, sizeof(float));
+
+		}
+		else {
+			log_info(meterec, "Reader thread: File and buffer already setup.\n");
+		}
+
+	}
+
+	read_disk_plan(meterec);
+
+}
+
+static size_t read_disk_take_cost(struct meterec_s *meterec, unsigned int take, unsigned int *files) {
+
+	unsigned int track;
+	size_t bytes;
+
+	bytes = ZBUF_SIZE * meterec->takes[take].ntrack * sizeof(float);
+
+	if (meterec->takes[take].take_fd)
+		(*files)++;
+
+	if (meterec->takes[take].take_map) {
+		(*files)++;
+		bytes += meterec->takes[take].take_map->len;
+	}
+
+	for (track=0; track<meterec->takes[take].ntrack; track++) {
+
+		if (meterec->takes[take].track_fd[track])
+			(*files)++;
+
+		if (meterec->takes[take].track_map[track]) {
+			(*files)++;
+			bytes += meterec->takes[take].track_map[track]->len;
+		}
+	}
+
+	return bytes;
+}
+
+void read_disk_evict(struct meterec_s *meterec) {
+
+	unsigned int take, lru, files;
+	size_t bytes, limit;
+
+	/* preloaded takes have their own budget */
+	limit = (size_t)CACHE_MAX_MB << 20;
+	if ((meterec->preload || meterec->preload_opt) && meterec->preload_mb > CACHE_MAX_MB)
+		limit = (size_t)meterec->preload_mb << 20;
+
+	while (1) {
+
+		files = 0;
+		bytes = 0;
+		lru = 0;
+
+		for (take=1; take<meterec->n_takes+1; take++) {
+
+			if (meterec->takes[take].buf == NULL)
+				continue;
+
+			bytes += read_disk_take_cost(meterec, take, &files);
+
+			if (!meterec->takes[take].playing)
+				if (!lru || meterec->takes[take].used < meterec->takes[lru].used)
+					lru = take;
+		}
+
+		if (!lru || (files <= CACHE_MAX_FILES && bytes <= limit))
+			break;
+
+		log_info(meterec, "Reader thread: Closing take %d, least recently played\n", lru);
+		read_disk_close_take(meterec, lru);
+	}
+}
+
+void read_disk_update_fd(struct meterec_s *meterec) {
+
+	static unsigned long long clock = 0;
+	unsigned int take, track, port, used, kept=0, cached=0, closed_tracks=0;
+
+	/* keep takes not needed anymore open, they may be played back again soon */
+	for (take=1; take<meterec->n_takes+1; take++) {
+
+		if (meterec->takes[take].buf == NULL)
+			continue;
+
+		/* what the new playback selection needs */
+		used = 0;
+		for (port=0; port<meterec->n_ports; port++)
+			if (meterec->ports[port].playback_take == take)
+				used = 1;
+
+		if (!used) {
+			if (meterec->takes[take].playing) {
+				meterec->takes[take].playing = 0;
+				meterec->takes[take].used = ++clock;
+			}
+			cached++;
+			continue;
+		}
+
+		kept++;
+
+		if (meterec->takes[take].layout == TAKE_TRACKS)
+			for (track=0; track<meterec->takes[take].ntrack; track++)
+				if (meterec->ports[meterec->takes[take].track_port_map[track]].playback_take != take &&
+					(meterec->takes[take].track_fd[track] || meterec->takes[take].track_map[track])) {
+					read_disk_close_track(meterec, take, track);
+					closed_tracks++;
+				}
+	}
+
+	log_info(meterec, "Reader thread: Kept %d take(s) open, %d take(s) cached, closed %d track(s)\n", kept, cached, closed_tracks);
+
+	/* takes about to play are not closed to make room for others */
+	for (port=0; port<meterec->n_ports; port++) {
+		take = meterec->ports[port].playback_take;
+		if (take && take < meterec->n_takes+1)
+			meterec->takes[take].playing = 1;
+	}
+
+	/* only opens what is missing */
+	read_disk_open_fd(meterec);
+
+	read_disk_evict(meterec);
+}
+
+void fill_zero_buffer(struct meterec_s *meterec, unsigned int take, SNDFILE *fd, struct wavmap_s *map, float *buf, unsigned int channels) {
+
+	unsigned int fill=0, nsamples;
+	long long pre_fill;
+
+	nsamples = ZBUF_SIZE * channels;
+
+	/* prefill buffer if reading before offset */
+	pre_fill = ((long long)meterec->takes[take].offset - (long long)meterec->disk.playhead) * channels;
+
+	#ifdef DEBUG_BUFF
+	log_debug(meterec, "fill_buffer: playhead %10llu | nsamples %10d | pre_fill %10lld | ",
+		meterec->disk.playhead,
+		nsamples,
+		pre_fill);
+	#endif
+
+	if (pre_fill < 0) {
+		/* The playhead if located further than the offset point.
+		no prefill due to offset to be perfomed only normal buffer fill */
+
+		fill = read_disk_float(fd, map, buf, nsamples );
+
+		#ifdef DEBUG_BUFF
+		log_debug(meterec, "fill0 %10d | ", fill );
+		#endif
+	}
+	else if (pre_fill > nsamples) {
+		/* the playhaed is located before the offset point, far enough so
+		that a full buffer load will not make the playhead reach the
+		offeset point. prefill everything with 0's */
+
+		for ( fill = 0; fill < nsamples; fill++)
+			buf[fill] = 0.0f;
+
+		#ifdef DEBUG_BUFF
+		log_debug(meterec, "fill1 %10d | ", fill );
+		#endif
+
+	} else {
+		/* the playhead is close enough to the offset to need both prefill
+		and normal data fill (read from disk). we need to make sure this
+		only fills a buffer-full of data */
+
+		for ( fill = 0; fill < pre_fill; fill++)
+			buf[fill] = 0.0f;
+
+		#ifdef DEBUG_BUFF
+		log_debug(meterec, "fill2 %10d | ", fill );
+		#endif
+
+		nsamples = nsamples - fill;
+		fill += read_disk_float(fd, map, buf + fill, nsamples );
+
+		#ifdef DEBUG_BUFF
+		log_debug(meterec, "fill3 %10d | nsamples1 %10d | ", fill, nsamples );
+		#endif
+	}
+
+	/* complete buffer with 0's if reached end of file */
+	for ( ; fill < nsamples; fill++)
+		buf[fill] = 0.0f;
+
+	#ifdef DEBUG_BUFF
+	log_debug(meterec, "fill4 %10d |\n", fill );
+	#endif
+}
 
-	sf_write_sync(out);
-	sf_close(out);
+void fill_zero_buffers(struct meterec_s *meterec) {
 
-	meterec->n_takes ++;
+	unsigned int take, track, ntrack, span;
+	unsigned long long start, end;
+
+	/* only takes meeting this window are read, others are left as they are */
+	meterec->disk.window++;
+	start = meterec->disk.playhead;
+	end = start + ZBUF_SIZE;
+
+	/* load the local buffer */
+	for (span=0; span<meterec->n_span && meterec->span[span].start < end; span++) {
+
+		if (meterec->span[span].end <= start)
+			continue;
 
+		take = meterec->span[span].take;
+		meterec->takes[take].window = meterec->disk.window;
+
+		ntrack = meterec->takes[take].ntrack;
+
+		if (meterec->takes[take].layout == TAKE_TRACKS) {
+			/* only tracks played back are opened, others are left untouched */
+			for (track=0; track<ntrack; track++)
+				if (meterec->takes[take].track_fd[track] || meterec->takes[take].track_map[track])
+					fill_zero_buffer(meterec, take, meterec->takes[take].track_fd[track], meterec->takes[take].track_map[track], meterec->takes[take].buf + track * ZBUF_SIZE, 1);
+		}
+		else {
+			fill_zero_buffer(meterec, take, meterec->takes[take].take_fd, meterec->takes[take].take_map, meterec->takes[take].buf, ntrack);
+		}
+	}
 }
 
-SNDFILE* write_disk_open_fd(struct meterec_s *meterec) {
+unsigned int fill_buffer(struct meterec_s *meterec, unsigned int *zbuff_pos ) {
 
-	SF_INFO info;
-	SNDFILE *out;
-	char *take_file ;
+	/* real read from disk thru libsndfile to fill 'buffer zero' then copy from
+	   'buffer zero' to 'disk buffer' that is the connection with jack process */
 
-	info.format = meterec->output_fmt;
-	info.channels = meterec->n_tracks;
-	info.samplerate = meterec->jack.sample_rate;
+	unsigned int rdbuff_pos, process_pos, plan, port, nframes;
 
-	take_file = meterec->takes[meterec->n_takes + 1].take_file;
+	process_pos = CURSOR_GET(meterec->read_disk_buffer_process_pos);
 
-	if (!sf_format_check(&info)) {
-		fprintf(meterec->fd_log, "Writer thread: Cannot open take file '%s' for writing (%d, %d, %d)\n",take_file,info.format, info.channels, info.samplerate);
-		meterec->record_sts = OFF;
-		exit_on_error("Writer thread: Output file format error\n" );
-		return (SNDFILE*)NULL;
+	/* Leave right away if the process does not need any data (disk buffer full) */
+	if (meterec->read_disk_buffer_thread_pos == process_pos)
+		return meterec->read_disk_buffer_thread_pos;
+
+	/* lets fill local buffer only if previously emptied */
+	if (*zbuff_pos == 0) {
+
+	#ifdef DEBUG_BUFF
+	log_debug(meterec, "fill_buffer: Filling zero buffer -------------------------------\n");
+	#endif
+		fill_zero_buffers(meterec);
 	}
 
-	out = sf_open(take_file, SFM_WRITE, &info);
+	/* copy as much of the zero buffer as process made room for */
+	nframes = (process_pos - meterec->read_disk_buffer_thread_pos) & (meterec->dbuf_size - 1);
+	if (nframes > ZBUF_SIZE - *zbuff_pos)
+		nframes = ZBUF_SIZE - *zbuff_pos;
 
-	if (!out) {
-		fprintf(meterec->fd_log,"Writer thread: Cannot open '%s' file for writing",take_file);
-		meterec->record_sts = OFF;
-		return (SNDFILE*)NULL;
+	/* demux each played back track of the zero buffer to its port buffer */
+	for (plan=0; plan<meterec->n_plan; plan++) {
+
+		port = meterec->plan[plan].port;
+
+		if (!TAKE_IN_WINDOW(meterec->plan[plan].take)) {
+			read_disk_silence(meterec, port, meterec->read_disk_buffer_thread_pos, nframes);
+			continue;
+		}
+
+		read_disk_sound(meterec, port);
+
+		dsp_ring_deinterleave(meterec->ports[port].read_disk_buffer,
+			meterec->read_disk_buffer_thread_pos, meterec->dbuf_size,
+			meterec->plan[plan].buf + *zbuff_pos * meterec->plan[plan].stride,
+			meterec->plan[plan].stride, nframes);
 	}
 
-	fprintf(meterec->fd_log,"Writer thread: Opened %d track(s) file '%s' for writing.\n", meterec->n_tracks, take_file);
+	rdbuff_pos = (meterec->read_disk_buffer_thread_pos + nframes) & (meterec->dbuf_size - 1);
+	*zbuff_pos += nframes;
+	meterec->disk.playhead += nframes;
+
+	if (*zbuff_pos == ZBUF_SIZE)
+		*zbuff_pos = 0;
+
+	#ifdef DEBUG_BUFF
+	log_debug(meterec, "fill_buffer: zbuff_pos %4X/%4X | rdbuff_pos %5X/%5X | thread_pos %5X/%5X | process_pos %5X/%5X\n",
+		*zbuff_pos, ZBUF_SIZE,
+		rdbuff_pos, meterec->dbuf_size,
+		meterec->read_disk_buffer_thread_pos, meterec->dbuf_size,
+		process_pos, meterec->dbuf_size);
+	#endif
+
+	return rdbuff_pos;
 
-	return out;
 }
 
-void *writer_thread(void *d) {
-	unsigned int i, port, zbuff_pos, track, thread_delay;
-	SNDFILE *out;
-	float buf[ZBUF_SIZE * MAX_PORTS];
-	struct meterec_s *meterec ;
+sf_count_t read_disk_seek_fd(SNDFILE *fd, struct wavmap_s *map, sf_count_t frames, int whence) {
 
-	meterec = (struct meterec_s *)d ;
+	/* a mapped take only moves its read position */
+	if (map)
+		return wavmap_seek(map, frames, whence);
 
-	meterec->record_sts = STARTING ;
+	return sf_seek(fd, frames, whence);
+}
 
-	fprintf(meterec->fd_log, "Writer thread: Started.\n");
+void seek_fd(struct meterec_s *meterec, unsigned int take, SNDFILE *fd, struct wavmap_s *map, unsigned long long seek) {
 
-	thread_delay = set_thread_delay(meterec);
+	sf_count_t reached;
+	long long abs_seek;
 
-	/* Open the output file */
-	out = write_disk_open_fd(meterec);
+	abs_seek = (long long)seek - (long long)meterec->takes[take].offset;
 
-	if (!out)
-		return (void*)1;
+	#ifdef DEBUG_SEEK
+	log_debug(meterec, "read_disk_seek: seek take %d at rel position %llu 0x%llX (%.3f).\n", take, seek, seek, (double)seek/meterec->jack.sample_rate);
+	log_debug(meterec, "read_disk_seek: seek take %d at abs position %lld 0x%llX (%.3f).\n", take, abs_seek, (unsigned long long)abs_seek, (double)abs_seek/meterec->jack.sample_rate);
+	#endif
 
-	/* Start writing the RT ringbuffer to disk */
-	meterec->record_sts = ONGOING ;
-	zbuff_pos = 0;
-	while (meterec->record_sts) {
+	if (abs_seek > (long long)meterec->takes[take].info.frames) {
 
-		for (i  = meterec->write_disk_buffer_thread_pos;
-			i != meterec->write_disk_buffer_process_pos && zbuff_pos < ZBUF_SIZE;
-			i  = (i + 1) & (DBUF_SIZE - 1), zbuff_pos++ ) {
+		reached = read_disk_seek_fd(fd, map, 0, SEEK_END);
+	}
+	else if (abs_seek < 0) {
 
-			track = 0;
-			for (port = 0; port < meterec->n_ports; port++) {
-				if (meterec->ports[port].record) {
-					buf[zbuff_pos * meterec->n_tracks + track] = meterec->ports[port].write_disk_buffer[i];
-					track++;
-				}
-			}
-		}
+		reached = read_disk_seek_fd(fd, map, 0, SEEK_SET);
+	}
+	else {
 
-		if (zbuff_pos == ZBUF_SIZE) {
-			sf_writef_float(out, buf, zbuff_pos);
-			zbuff_pos = 0;
-		}
+		reached = read_disk_seek_fd(fd, map, abs_seek, SEEK_SET);
+	}
 
-		meterec->write_disk_buffer_thread_pos = i;
+	if (reached == -1) {
+		#ifdef DEBUG_SEEK
+		log_debug(meterec, "read_disk_seek: failed (abs_seek=%lld reached=%lld)\n", abs_seek, (long long)reached);
+		#endif
 
-		if (meterec->record_cmd == RESTART ) {
+		/* do not take corrective action for now, we may learn out of produced artifacts */
+	}
+}
 
-			write_disk_close_fd(meterec, out);
+void read_disk_seek(struct meterec_s *meterec, unsigned long long seek) {
 
-			if (meterec->config_sts)
-				save_conf(meterec);
+	unsigned int take, track;
 
-			compute_tracks_to_record(meterec);
+	for(take=1; take<meterec->n_takes+1; take++) {
 
-			out = write_disk_open_fd(meterec);
+		/* check if take is used */
+		if (!meterec->takes[take].playing)
+			continue;
 
-			/*this should be protected with a mutex or so...*/
-			meterec->record_cmd = START;
+		if (meterec->takes[take].take_fd || meterec->takes[take].take_map)
+			seek_fd(meterec, take, meterec->takes[take].take_fd, meterec->takes[take].take_map, seek);
 
-		}
+		for (track=0; track<meterec->takes[take].ntrack; track++)
+			if (meterec->takes[take].track_fd[track] || meterec->takes[take].track_map[track])
+				seek_fd(meterec, take, meterec->takes[take].track_fd[track], meterec->takes[take].track_map[track], seek);
+	}
+}
 
-		/* run until empty buffer after a stop requets */
-		if (meterec->record_sts == STOPING)
-			if ( meterec->write_disk_buffer_thread_pos == meterec->write_disk_buffer_process_pos ) {
-				sf_writef_float(out, buf, zbuff_pos);
-				break;
-			}
 
-		if (meterec->record_cmd == STOP)
-			meterec->record_sts = STOPING ;
+/******************************************************************************
+** LOOP CACHE
+*/
 
-		usleep(thread_delay);
+/* decode frames done to done+n of the window at start, one plane of frames per played port,
+   takes are left where the disk buffer goes on from */
+void read_disk_decode(struct meterec_s *meterec, unsigned long long start, unsigned int frames, unsigned int done, unsigned int n, float *mem) {
 
-	}
+	unsigned int plan, end, chunk;
+	unsigned long long playhead;
 
-	write_disk_close_fd(meterec, out);
+	playhead = meterec->disk.playhead;
 
-	if (meterec->config_sts)
-		save_conf(meterec);
+	/* decode thru takes 'buffer zero' like fill_buffer does */
+	meterec->disk.playhead = start + done;
+	read_disk_seek(meterec, meterec->disk.playhead);
 
-	fprintf(meterec->fd_log,"Writer thread: done.\n");
+	for (end = done + n; done < end; done += chunk) {
 
-	meterec->record_sts = OFF;
+		fill_zero_buffers(meterec);
 
-	return (void*)0;
+		chunk = end - done;
+		if (chunk > ZBUF_SIZE)
+			chunk = ZBUF_SIZE;
+
+		for (plan=0; plan<meterec->n_plan; plan++)
+			if (TAKE_IN_WINDOW(meterec->plan[plan].take))
+				dsp.deinterleave(mem + plan * frames + done, meterec->plan[plan].buf, meterec->plan[plan].stride, chunk);
+			else
+				dsp.zero(mem + plan * frames + done, chunk);
+
+		meterec->disk.playhead += ZBUF_SIZE;
+	}
+
+	meterec->disk.playhead = playhead;
+	read_disk_seek(meterec, playhead);
 }
 
-void read_disk_close_fd(struct meterec_s *meterec) {
+/* stop jack process from using the cache, returns 1 once it is done with it */
+static unsigned int loop_cache_retire(struct meterec_s *meterec) {
 
-	unsigned int take;
+	struct loop_cache_s *cache;
 
-	/* close all fd's */
-	for (take=1; take<meterec->n_takes+1; take++)
-		if (meterec->takes[take].take_fd) {
-			sf_close(meterec->takes[take].take_fd);
-			free(meterec->takes[take].buf);
-			meterec->takes[take].buf = NULL;
-			meterec->takes[take].take_fd = NULL;
-		}
+	cache = &meterec->loop_cache;
+
+	__atomic_store_n(&cache->ready, 0, __ATOMIC_SEQ_CST);
+
+	return !__atomic_load_n(&cache->active, __ATOMIC_SEQ_CST);
 }
 
-void read_disk_open_fd(struct meterec_s *meterec) {
+/* cache must be retired */
+void loop_cache_free(struct meterec_s *meterec) {
 
-	unsigned int take, port, i;
-	struct time_s tlenght;
+	struct loop_cache_s *cache;
+	unsigned int port;
 
-	/* open all files needed for this session */
-	for (port=0; port<meterec->n_ports; port++) {
+	cache = &meterec->loop_cache;
 
-		take = meterec->ports[port].playback_take;
+	free(cache->mem);
+	cache->mem = NULL;
+	cache->len = 0;
+	cache->frames = 0;
+	cache->done = 0;
 
-		/* do not open a file for a port that wants to playback take 0 */
-		if (!take ) {
+	cache->low = MAX_FRAME;
+	cache->high = MAX_FRAME;
 
-			fprintf(meterec->fd_log,"Reader thread: Port %d does not have a take associated\n", port+1);
+	for (port=0; port<meterec->max_ports; port++)
+		cache->data[port] = NULL;
+}
 
-			/* rather fill buffer with 0's */
-			for (i=0; i<DBUF_SIZE; i++)
-				meterec->ports[port].read_disk_buffer[i] = 0.0f ;
+unsigned int loop_cache_wanted(struct meterec_s *meterec) {
 
-			continue;
-		}
+	if (!meterec->loop.enable || !meterec->loop_cache_s)
+		return 0;
 
-		fprintf(meterec->fd_log,"Reader thread: Port %d has take %d associated\n", port+1, take );
+	if (meterec->loop.low == MAX_FRAME || meterec->loop.high == MAX_FRAME || meterec->loop.high <= meterec->loop.low)
+		return 0;
 
-		/* only open a take file that is not defined yet  */
-		if (meterec->takes[take].take_fd == NULL) {
+	return (meterec->loop.high - meterec->loop.low) <= meterec->loop_cache_s * meterec->jack.sample_rate;
+}
 
-			meterec->takes[take].take_fd = sf_open(
-				meterec->takes[take].take_file,
-				SFM_READ,
-				&meterec->takes[take].info);
+void loop_cache_start(struct meterec_s *meterec) {
 
-			/* check file is (was) opened properly */
-			if (meterec->takes[take].take_fd == NULL) {
-				meterec->disk_sts = OFF;
-				fprintf(meterec->fd_log,"Reader thread: Cannot open file '%s' for reading\n", meterec->takes[take].take_file);
-				exit_on_error("Reader thread: Cannot open file for reading");
-			}
+	struct loop_cache_s *cache;
+	unsigned int len, fade;
 
-			fprintf(meterec->fd_log,"Reader thread: Opened '%s' for reading\n", meterec->takes[take].take_file);
+	cache = &meterec->loop_cache;
 
-			/* save take lenght information */
-			time_init_frm(&tlenght,
-				meterec->takes[take].info.samplerate,
-				meterec->takes[take].info.frames + meterec->takes[take].offset);
-			time_sprint(&tlenght, meterec->takes[take].lenght);
+	loop_cache_free(meterec);
 
-			/* allocate buffer space for this take */
-			fprintf(meterec->fd_log,"Reader thread: Allocating local buffer space %d*%d for take %d\n",
-				meterec->takes[take].ntrack,
-				ZBUF_SIZE,
-				take);
+	/* remember what was tried, even if there is nothing to cache */
+	cache->low = meterec->loop.low;
+	cache->high = meterec->loop.high;
+	cache->stale = 0;
 
-			meterec->takes[take].buf = calloc(ZBUF_SIZE*meterec->takes[take].ntrack, sizeof(float));
+	if (!meterec->n_plan)
+		return;
 
-		}
-		else {
-			fprintf(meterec->fd_log,"Reader thread: File and buffer already setup.\n");
-		}
+	len = cache->high - cache->low;
 
-	}
+	/* keep what leads to the loop start to crossfade the loop end with */
+	fade = meterec->loop_fade_ms * meterec->jack.sample_rate / 1000;
+	if (fade > len)
+		fade = len;
+	if (fade > cache->low)
+		fade = cache->low;
 
-	/* seek so offset is taken into account */
-	read_disk_seek(meterec, 0);
+	cache->fade = fade;
+	cache->start = cache->low - fade;
+	cache->frames = len + fade;
+	cache->done = 0;
+
+	cache->len = (size_t)cache->frames * meterec->n_plan * sizeof(float);
+	cache->mem = (float *) malloc(cache->len);
 
+	if (!cache->mem) {
+		log_error(meterec, "Reader thread: Cannot allocate %zu bytes to cache loop\n", cache->len);
+		cache->len = 0;
+		cache->frames = 0;
+	}
 }
 
-unsigned int fill_buffer(struct meterec_s *meterec, unsigned int *zbuff_pos ) {
+void loop_cache_finish(struct meterec_s *meterec) {
 
-	/* real read from disk thru libsndfile to fill 'buffer zero' then copy from
-	   'buffer zero' to 'disk buffer' that is the connection with jack process */
+	struct loop_cache_s *cache;
+	unsigned int plan, port, len, fade;
+	float *data;
 
-	unsigned int rdbuff_pos, port, take, track, ntrack=0, fill=0, nsamples;
-	int pre_fill;
+	cache = &meterec->loop_cache;
 
-	/* Leave right away if the process does not need any data (disk buffer full) */
-	if (meterec->read_disk_buffer_thread_pos == meterec->read_disk_buffer_process_pos)
-		return meterec->read_disk_buffer_thread_pos;
+	len = cache->high - cache->low;
+	fade = cache->fade;
 
-	/* lets fill local buffer only if previously emptied */
-	if (*zbuff_pos == 0) {
+	for (plan=0; plan<meterec->n_plan; plan++) {
 
-	#ifdef DEBUG_BUFF
-	fprintf(meterec->fd_log, "fill_buffer: Filling zero buffer -------------------------------\n");
-	#endif
-		/* load the local buffer */
-		for(take=1; take<meterec->n_takes+1; take++) {
+		port = meterec->plan[plan].port;
+		data = cache->mem + plan * cache->frames + fade;
 
-			/* check if take is used */
-			if (meterec->takes[take].take_fd == NULL)
-				continue;
+		/* fade loop end into what precedes loop start, so wrapping is seamless */
+		if (fade)
+			dsp_crossfade(data + len - fade, data - fade, fade);
+
+		cache->data[port] = data;
+	}
 
-			/* get the number of tracks in this take */
-			ntrack = meterec->takes[take].ntrack;
+	__atomic_store_n(&cache->ready, 1, __ATOMIC_SEQ_CST);
 
-			nsamples = ZBUF_SIZE * ntrack;
+	log_info(meterec, "Reader thread: Cached loop %llu-%llu for %d port(s) in RAM (%zu bytes, %d frames crossfade)\n",
+		cache->low, cache->high, meterec->n_plan, cache->len, fade);
+}
 
-			/* prefill buffer if reading before offset */
-			pre_fill = (meterec->takes[take].offset - meterec->disk.playhead) * ntrack;
+/* a few 'buffer zero' of the loop per pass so the disk buffer is kept filled, returns 1 if takes were read */
+unsigned int loop_cache_update(struct meterec_s *meterec) {
 
-			#ifdef DEBUG_BUFF
-			fprintf(meterec->fd_log, "fill_buffer: playhead %10d | nsamples %10d | pre_fill %10d | ",
-				meterec->disk.playhead,
-				nsamples,
-				pre_fill);
-			#endif
+	struct loop_cache_s *cache;
+	unsigned int n;
 
-			if (pre_fill < 0) {
-				/* The playhead if located further than the offset point.
-				no prefill due to offset to be perfomed only normal buffer fill */
+	cache = &meterec->loop_cache;
 
-				fill = sf_read_float(meterec->takes[take].take_fd, meterec->takes[take].buf, nsamples );
+	if (!loop_cache_wanted(meterec)) {
+		if (cache->mem && loop_cache_retire(meterec))
+			loop_cache_free(meterec);
+		return 0;
+	}
 
-				#ifdef DEBUG_BUFF
-				fprintf(meterec->fd_log, "fill0 %10d | ", fill );
-				#endif
-			}
-			else if (pre_fill > nsamples) {
-				/* the playhaed is located before the offset point, far enough so
-				that a full buffer load will not make the playhead reach the
-				offeset point. prefill everything with 0's */
+	if (cache->stale || cache->low != meterec->loop.low || cache->high != meterec->loop.high) {
 
-				for ( fill = 0; fill < nsamples; fill++)
-					meterec->takes[take].buf[fill] = 0.0f;
+		/* jack process may still play the previous loop, try again next pass */
+		if (!loop_cache_retire(meterec))
+			return 0;
 
-				#ifdef DEBUG_BUFF
-				fprintf(meterec->fd_log, "fill1 %10d | ", fill );
-				#endif
+		loop_cache_start(meterec);
+	}
 
-			} else {
-				/* the playhead is close enough to the offset to need both prefill
-				and normal data fill (read from disk). we need to make sure this
-				only fills a buffer-full of data */
+	if (!cache->mem || cache->done == cache->frames)
+		return 0;
 
-				for ( fill = 0; fill < pre_fill; fill++)
-					meterec->takes[take].buf[fill] = 0.0f;
+	/* disk buffer comes first */
+	if (RD_BUFF_LEN > meterec->dbuf_size / 2)
+		return 0;
 
-				#ifdef DEBUG_BUFF
-				fprintf(meterec->fd_log, "fill2 %10d | ", fill );
-				#endif
+	n = cache->frames - cache->done;
+	if (n > LOOP_CACHE_STEP * ZBUF_SIZE)
+		n = LOOP_CACHE_STEP * ZBUF_SIZE;
 
-				nsamples = nsamples - fill;
-				fill += sf_read_float(meterec->takes[take].take_fd, meterec->takes[take].buf + fill, nsamples );
+	read_disk_decode(meterec, cache->start, cache->frames, cache->done, n, cache->mem);
 
-				#ifdef DEBUG_BUFF
-				fprintf(meterec->fd_log, "fill3 %10d | nsamples1 %10d | ", fill, nsamples );
-				#endif
-			}
+	cache->done += n;
 
-			/* complete buffer with 0's if reached end of file */
-			for ( ; fill < nsamples; fill++)
-				meterec->takes[take].buf[fill] = 0.0f;
+	if (cache->done == cache->frames)
+		loop_cache_finish(meterec);
 
-			#ifdef DEBUG_BUFF
-			fprintf(meterec->fd_log, "fill4 %10d |\n", fill );
-			#endif
-		}
+	return 1;
+}
 
-	}
+/******************************************************************************
+** CUE CACHE
+*/
+
+void cue_cache_free(struct meterec_s *meterec, struct cue_s *cue) {
 
+	unsigned int port;
 
+	free(cue->mem);
+	cue->mem = NULL;
+	cue->pos = MAX_FRAME;
+	cue->frames = 0;
 
-	/* walk in the zero buffer and copy it to each port buffers (demux)*/
-	for (rdbuff_pos  = meterec->read_disk_buffer_thread_pos;
-		rdbuff_pos != meterec->read_disk_buffer_process_pos && *zbuff_pos < ZBUF_SIZE;
-		rdbuff_pos  = (rdbuff_pos + 1) & (DBUF_SIZE - 1), (*zbuff_pos)++, meterec->disk.playhead++ ) {
+	for (port=0; port<meterec->max_ports; port++)
+		cue->data[port] = NULL;
+}
 
-		for(take=1; take<meterec->n_takes+1; take++) {
+void cue_cache_stale(struct meterec_s *meterec) {
 
+	unsigned int index;
 
-			/* check if take is used */
-			if (meterec->takes[take].take_fd == NULL)
-				continue;
+	for (index=0; index<MAX_INDEX; index++)
+		meterec->cue[index].stale = 1;
+}
 
-			ntrack = meterec->takes[take].ntrack;
+unsigned int cue_cache_update(struct meterec_s *meterec) {
 
-			/* for each track belonging to this take */
-			for (track=0; track<ntrack; track++) {
+	struct cue_s *cue;
+	unsigned int index, plan, frames;
 
-				/* find what port is mapped to this track */
-				port = meterec->takes[take].track_port_map[track] ;
+	frames = meterec->cue_ms * meterec->jack.sample_rate / 1000;
 
-				/* check if this port needs data from this take */
-				if (meterec->ports[port].playback_take == take)
-                                    meterec->ports[port].read_disk_buffer[rdbuff_pos] = meterec->takes[take].buf[*zbuff_pos * ntrack + track] ;
+	for (index=0; index<MAX_INDEX; index++) {
 
-			}
+		cue = &meterec->cue[index];
 
+		if (!frames || meterec->seek_index[index] == MAX_FRAME) {
+			if (cue->mem)
+				cue_cache_free(meterec, cue);
+			continue;
 		}
 
-	}
+		if (cue->mem && cue->pos == meterec->seek_index[index] && !cue->stale)
+			continue;
 
-	if (*zbuff_pos == ZBUF_SIZE)
-		*zbuff_pos = 0;
+		if (!meterec->n_plan)
+			continue;
 
-	#ifdef DEBUG_BUFF
-	fprintf(meterec->fd_log, "fill_buffer: zbuff_pos %4X/%4X | rdbuff_pos %5X/%5X | thread_pos %5X/%5X | process_pos %5X/%5X\n",
-		*zbuff_pos, ZBUF_SIZE,
-		rdbuff_pos, DBUF_SIZE,
-		meterec->read_disk_buffer_thread_pos, DBUF_SIZE,
-		meterec->read_disk_buffer_process_pos, DBUF_SIZE);
-	#endif
+		cue_cache_free(meterec, cue);
 
-	return rdbuff_pos;
+		cue->mem = (float *) malloc((size_t)frames * meterec->n_plan * sizeof(float));
+		if (!cue->mem)
+			continue;
 
-}
+		read_disk_decode(meterec, meterec->seek_index[index], frames, 0, frames, cue->mem);
 
-void read_disk_seek(struct meterec_s *meterec, unsigned int seek) {
+		for (plan=0; plan<meterec->n_plan; plan++)
+			cue->data[meterec->plan[plan].port] = cue->mem + plan * frames;
 
-	unsigned int take;
-	sf_count_t reached;
-	int abs_seek;
+		cue->pos = meterec->seek_index[index];
+		cue->frames = frames;
+		cue->stale = 0;
 
-	for(take=1; take<meterec->n_takes+1; take++) {
+		log_info(meterec, "Reader thread: Decoded %d frames after index F%d for %d port(s)\n", frames, index + 1, meterec->n_plan);
 
-		/* check if track is used */
-		if (meterec->takes[take].take_fd == NULL)
-			continue;
+		/* one at a time, disk buffer has to be kept filled meanwhile */
+		return 1;
+	}
 
-		abs_seek = seek - meterec->takes[take].offset;
+	return 0;
+}
 
-		#ifdef DEBUG_SEEK
-		fprintf(meterec->fd_log, "read_disk_seek: seek take %d at rel position %d 0x%X (%.3f).\n", take, seek, seek, (float)seek/meterec->jack.sample_rate);
-		fprintf(meterec->fd_log, "read_disk_seek: seek take %d at abs position %d 0x%X (%.3f).\n", take, abs_seek, abs_seek, (float)abs_seek/meterec->jack.sample_rate);
-		#endif
+unsigned int cue_cache_fill(struct meterec_s *meterec) {
 
-		if (abs_seek > (int)meterec->takes[take].info.frames) {
+	struct cue_s *cue;
+	unsigned int index, plan, port, n;
 
-			reached = sf_seek(meterec->takes[take].take_fd, 0, SEEK_END);
-		}
-		else if (abs_seek < 0) {
+	for (index=0; index<MAX_INDEX; index++) {
 
-			reached = sf_seek(meterec->takes[take].take_fd, 0, SEEK_SET);
-		}
-		else {
+		cue = &meterec->cue[index];
 
-			reached = sf_seek(meterec->takes[take].take_fd, abs_seek, SEEK_SET);
-		}
+		if (!cue->mem || cue->stale || cue->pos != meterec->disk.playhead)
+			continue;
 
-		if (reached == -1) {
-			#ifdef DEBUG_SEEK
-			fprintf(meterec->fd_log, "read_disk_seek: failed (abs_seek=%d reached=%d)\n", abs_seek, reached);
-			#endif
+		/* leave room for the disk to catch up in the buffer */
+		n = ((CURSOR_GET(meterec->read_disk_buffer_process_pos) - meterec->read_disk_buffer_thread_pos) & (meterec->dbuf_size - 1)) / 2;
+		if (n > cue->frames)
+			n = cue->frames;
 
-			/* do not take corrective action for now, we may learn out of produced artifacts */
+		for (plan=0; plan<meterec->n_plan; plan++) {
+			port = meterec->plan[plan].port;
+			if (cue->data[port]) {
+				read_disk_sound(meterec, port);
+				dsp_ring_write(meterec->ports[port].read_disk_buffer, meterec->read_disk_buffer_thread_pos, meterec->dbuf_size, cue->data[port], n);
+			}
 		}
+
+		CURSOR_SET(meterec->read_disk_buffer_thread_pos, (meterec->read_disk_buffer_thread_pos + n) & (meterec->dbuf_size - 1));
+		meterec->disk.playhead += n;
+
+		return n;
 	}
-}
 
+	return 0;
+}
 
 void *reader_thread(void *d)
 {
-	unsigned int rdbuff_pos, zbuff_pos, thread_delay, may_loop;
+	unsigned int rdbuff_pos, zbuff_pos, thread_delay, may_loop, woken=0, cued, index;
 	struct event_s *event, *event_kill;
 	struct meterec_s *meterec ;
 
 	meterec = (struct meterec_s *)d ;
 
+	log_thread(meterec, LOG_READER);
+
 	thread_delay = set_thread_delay(meterec);
 
-	fprintf(meterec->fd_log, "Reader thread: started. Will wake every %.2dusec.\n", thread_delay);
+	log_info(meterec, "Reader thread: started. Will wake when signaled or every %dusec.\n", thread_delay);
 
 	/* empty buffer (reposition thread position in order to refill where process will first read) */
-	meterec->read_disk_buffer_thread_pos  = (meterec->read_disk_buffer_process_pos + 1);
-	meterec->read_disk_buffer_thread_pos &= (DBUF_SIZE - 1);
+	CURSOR_SET(meterec->read_disk_buffer_thread_pos, (CURSOR_GET(meterec->read_disk_buffer_process_pos) + 1) & (meterec->dbuf_size - 1));
 
 	/* open all files needed for this playback */
 	compute_takes_to_playback(meterec);
-	read_disk_open_fd(meterec);
+	read_disk_update_fd(meterec);
+
+	/* seek so offset is taken into account */
+	read_disk_seek(meterec, 0);
 
-	fprintf(meterec->fd_log,"Reader thread: Start reading files.\n");
+	log_info(meterec, "Reader thread: Start reading files.\n");
 
 	/* prefill buffer at once */
 	zbuff_pos = 0;
-	while (meterec->read_disk_buffer_thread_pos != meterec->read_disk_buffer_process_pos) {
+	while (meterec->read_disk_buffer_thread_pos != CURSOR_GET(meterec->read_disk_buffer_process_pos)) {
 		rdbuff_pos = fill_buffer(meterec, &zbuff_pos);
-		meterec->read_disk_buffer_thread_pos = rdbuff_pos;
+		CURSOR_SET(meterec->read_disk_buffer_thread_pos, rdbuff_pos);
 	}
 
-	meterec->disk_sts=ONGOING;
+	/* playback may start from the prefilled buffer */
+	__atomic_store_n(&meterec->disk_sts, ONGOING, __ATOMIC_RELEASE);
 
 	/* Start reading disk to fill the RT ringbuffer */
-	while ( meterec->disk_cmd==START ) {
+	while ( __atomic_load_n(&meterec->disk_cmd, __ATOMIC_ACQUIRE)==START ) {
+
+		/* collect requests posted by jack process */
+		pthread_mutex_lock(&meterec->event_mutex);
+		event_ring_drain(meterec, &meterec->disk_ring);
+		pthread_mutex_unlock(&meterec->event_mutex);
 
 		#ifdef DEBUG_QUEUES
 		event_queue_print(meterec, LOG);
@@ -482,32 +1818,42 @@ void *reader_thread(void *d)
 			case LOCK:
 			case NEWT:
 
-				read_disk_close_fd(meterec);
 				compute_takes_to_playback(meterec);
-				read_disk_open_fd(meterec);
+				read_disk_update_fd(meterec);
+
+				meterec->loop_cache.stale = 1;
+				cue_cache_stale(meterec);
 
 				/* no break here */
 
 			case SEEK:
 
 				/* make sure we fill buffer away from where jack read to avoid having to wait filling ringbuffer */
-				meterec->read_disk_buffer_thread_pos  = meterec->read_disk_buffer_process_pos - (DBUF_SIZE/2);
-				meterec->read_disk_buffer_thread_pos &= (DBUF_SIZE - 1);
-
-				read_disk_seek(meterec, event->new_playhead);
-
-				zbuff_pos = 0;
+				CURSOR_SET(meterec->read_disk_buffer_thread_pos, (CURSOR_GET(meterec->read_disk_buffer_process_pos) - (meterec->dbuf_size/2)) & (meterec->dbuf_size - 1));
 
 				event->buffer_pos  = meterec->read_disk_buffer_thread_pos ;
-				event->buffer_pos &= (DBUF_SIZE - 1);
+				event->buffer_pos &= (meterec->dbuf_size - 1);
 
 				meterec->disk.playhead = event->new_playhead;
 
+				/* a jump to an index starts from RAM, takes are read from the end of the cue */
+				cued = (event->type == SEEK) ? cue_cache_fill(meterec) : 0;
+
+				read_disk_seek(meterec, meterec->disk.playhead);
+
+				zbuff_pos = 0;
+
 				event->queue = PEND;
 
+				event_ring_discard(&meterec->jack_ring, ALL);
+
 				pthread_mutex_lock(&meterec->event_mutex);
-				find_rm_events(meterec, JACK, ALL);
 				find_rm_events(meterec, DISK, ALL);
+
+				/* jack process does not need to wait for the disk */
+				if (cued)
+					event_ring_post(meterec, &meterec->jack_ring, event);
+
 				pthread_mutex_unlock(&meterec->event_mutex);
 
 				break;
@@ -522,9 +1868,8 @@ void *reader_thread(void *d)
 						meterec->jack.playhead < meterec->loop.high) {
 
 						/*we need to empty buffer up to the loop point */
-						meterec->read_disk_buffer_thread_pos -= meterec->loop.high;
-						meterec->read_disk_buffer_thread_pos += meterec->disk.playhead;
-						meterec->read_disk_buffer_thread_pos &= (DBUF_SIZE - 1);
+						CURSOR_SET(meterec->read_disk_buffer_thread_pos,
+							(meterec->read_disk_buffer_thread_pos - meterec->loop.high + meterec->disk.playhead) & (meterec->dbuf_size - 1));
 
 						read_disk_seek(meterec, meterec->loop.low);
 						zbuff_pos = 0;
@@ -539,13 +1884,15 @@ void *reader_thread(void *d)
 
 				} else {
 					/* we are trying to cancel all ongoing loops */
-					event_kill = find_first_event(meterec, JACK, LOOP);
+					event_kill = event_ring_find_first(&meterec->jack_ring, LOOP);
 
 					if (event_kill) {
 						/* rewind to the oldest event loop */
-						meterec->read_disk_buffer_thread_pos = event_kill->buffer_pos ;
+						CURSOR_SET(meterec->read_disk_buffer_thread_pos, event_kill->buffer_pos);
 					}
 
+					event_ring_discard(&meterec->jack_ring, LOOP);
+
 					pthread_mutex_lock(&meterec->event_mutex);
 					find_rm_events(meterec, ALL, LOOP);
 					event = NULL;
@@ -559,6 +1906,16 @@ void *reader_thread(void *d)
 		}
 
 
+		/* short loops are played from RAM by jack process */
+		if (loop_cache_update(meterec))
+			zbuff_pos = 0;
+
+		/* takes opened while playing are decoded in memory bit by bit */
+		read_disk_preload_update(meterec);
+
+		if (cue_cache_update(meterec))
+			zbuff_pos = 0;
+
 		may_loop = 0;
 		if (meterec->loop.enable)
 			if (meterec->disk.playhead < meterec->loop.high)
@@ -573,19 +1930,20 @@ void *reader_thread(void *d)
 				zbuff_pos = 0;
 
 				rdbuff_pos -= (meterec->disk.playhead - meterec->loop.high);
-				rdbuff_pos &= (DBUF_SIZE - 1);
+				rdbuff_pos &= (meterec->dbuf_size - 1);
 
 				meterec->disk.playhead = meterec->loop.low;
 
-				pthread_mutex_lock(&meterec->event_mutex);
-				add_event(meterec, JACK, LOOP, meterec->loop.low, meterec->loop.high, rdbuff_pos);
-				pthread_mutex_unlock(&meterec->event_mutex);
+				if (!event_ring_add(meterec, &meterec->jack_ring, JACK, LOOP, meterec->loop.low, meterec->loop.high, rdbuff_pos))
+					log_error(meterec, "Reader thread: jack event ring full, loop event lost.\n");
 			}
 
 		#ifdef DEBUG_QUEUES
 		event_queue_print(meterec, LOG);
 		#endif
 
+		pthread_mutex_lock(&meterec->event_mutex);
+
 		event = find_first_event(meterec, PEND, ALL);
 
 		if (event)
@@ -595,7 +1953,7 @@ void *reader_thread(void *d)
 					/* do not pass the event to jack process if we did not have data
 					to fill the buffer */
 					if (meterec->read_disk_buffer_thread_pos != rdbuff_pos)
-						event->queue = JACK;
+						event_ring_post(meterec, &meterec->jack_ring, event);
 					break;
 
 				case LOCK:
@@ -604,25 +1962,48 @@ void *reader_thread(void *d)
 					and only tell jack process to jump once we have a full
 					'buffer zero' advance */
 					if (meterec->disk.playhead > meterec->jack.playhead + ZBUF_SIZE)
-						event->queue = JACK;
+						event_ring_post(meterec, &meterec->jack_ring, event);
 					break;
 
 			}
 
-		meterec->read_disk_buffer_thread_pos = rdbuff_pos;
+		pthread_mutex_unlock(&meterec->event_mutex);
+
+		CURSOR_SET(meterec->read_disk_buffer_thread_pos, rdbuff_pos);
+
+		if (woken) {
+			if (thread_wake_done(&meterec->reader_wake))
+				log_info(meterec, "Reader thread: new maximum wake to fill latency %lluusec.\n", meterec->reader_wake.latency_max);
+			hist_add(&meterec->stats.reader_wake, meterec->reader_wake.latency);
+			woken = 0;
+		}
 
 		#ifdef DEBUG_QUEUES
 		event_queue_print(meterec, LOG);
 		#endif
 
-		usleep(thread_delay);
+		/* sleep until jack process consumed enough data (or an event comes in) */
+		if (RD_BUFF_LEN < DBUF_WAKE)
+			woken = thread_wait(&meterec->reader_wake, thread_delay);
 
 	}
 
+	/* jack process leaves the cache at its next period */
+	while (!loop_cache_retire(meterec))
+		thread_wait(&meterec->reader_wake, thread_delay);
+
+	loop_cache_free(meterec);
+
+	for (index=0; index<MAX_INDEX; index++)
+		cue_cache_free(meterec, &meterec->cue[index]);
+
 	/* close all fd's */
 	read_disk_close_fd(meterec);
 
-	fprintf(meterec->fd_log,"Reader thread: done.\n");
+	log_info(meterec, "Reader thread: wake to fill latency %lluusec (max %lluusec).\n",
+		meterec->reader_wake.latency, meterec->reader_wake.latency_max);
+
+	log_info(meterec, "Reader thread: done.\n");
 
 	meterec->disk_sts = OFF;
 
@@ -632,19 +2013,103 @@ void *reader_thread(void *d)
 
 float read_disk_buffer_level(struct meterec_s *meterec) {
 	float level;
-	level = (meterec->read_disk_buffer_process_pos - meterec->read_disk_buffer_thread_pos) & (DBUF_SIZE-1);
-	return  (float)(level / DBUF_SIZE);
+	level = (CURSOR_GET(meterec->read_disk_buffer_process_pos) - CURSOR_GET(meterec->read_disk_buffer_thread_pos)) & (meterec->dbuf_size-1);
+	return  (float)(level / meterec->dbuf_size);
 }
 
 float write_disk_buffer_level(struct meterec_s *meterec) {
 	float level;
-	level = (meterec->write_disk_buffer_process_pos - meterec->write_disk_buffer_thread_pos) & (DBUF_SIZE-1);
-	return  (float)(level / DBUF_SIZE);
+	level = (CURSOR_GET(meterec->write_disk_buffer_process_pos) - CURSOR_GET(meterec->write_disk_buffer_thread_pos)) & (meterec->dbuf_size-1);
+	return  (float)(level / meterec->dbuf_size);
 }
 
 unsigned int set_thread_delay(struct meterec_s *meterec) {
 
-	/* How long should we wait to read 10 times faster than data goes away */
-	return 1000000ul * ZBUF_SIZE / meterec->jack.sample_rate / 10;
+	/* Disk threads are woken by jack process, this is only how long they
+	   wait when nobody signals them: the time it takes to play a 'buffer zero' */
+	return 1000000ul * ZBUF_SIZE / meterec->jack.sample_rate;
+
+}
+
+/******************************************************************************
+** Disk buffers
+*/
+
+void disk_alloc_buffers(struct meterec_s *meterec, unsigned int n_ports) {
+
+	unsigned int port, ms, rate;
+	unsigned long long frames, size;
+	size_t len;
+	float *arena;
+
+	if (!n_ports)
+		return;
+
+	if (meterec->dbuf_ms_opt)
+		ms = meterec->dbuf_ms_opt;
+	else if (meterec->dbuf_ms)
+		ms = meterec->dbuf_ms;
+	else
+		ms = DBUF_MS;
+
+	if (ms > DBUF_MS_MAX)
+		ms = DBUF_MS_MAX;
+
+	/* mask arithmetic on buffer positions needs a power of two */
+	rate = meterec->jack.sample_rate ? meterec->jack.sample_rate : jack_get_sample_rate(meterec->client);
+	frames = (unsigned long long)ms * rate / 1000;
+	for (size = DBUF_MIN; size < frames && size < DBUF_MAX; size <<= 1) ;
+
+	/* one read and one write buffer per port, rounded so huge pages can be used */
+	len = (size_t)n_ports * 2 * size * sizeof(float);
+	len = (len + DBUF_ALIGN - 1) & ~((size_t)DBUF_ALIGN - 1);
+
+	arena = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (arena == MAP_FAILED) {
+		log_error(meterec, "Cannot allocate %zu bytes for disk buffers.\n", len);
+		exit_on_error("Cannot allocate disk buffers.");
+	}
+
+#ifdef MADV_HUGEPAGE
+	madvise(arena, len, MADV_HUGEPAGE);
+#endif
+
+	/* make sure jack process will never page fault on these buffers */
+	if (mlock(arena, len))
+		log_error(meterec, "Could not lock %zu bytes of disk buffers in memory, check memlock limit.\n", len);
+
+	memset(arena, 0, len);
+
+	for (port = 0; port < n_ports; port++) {
+		meterec->ports[port].read_disk_buffer  = arena + (size_t)port * 2 * size;
+		meterec->ports[port].write_disk_buffer = arena + (size_t)port * 2 * size + size;
+	}
+
+	meterec->dbuf_arena = arena;
+	meterec->dbuf_arena_len = len;
+	meterec->dbuf_size = size;
+
+	log_info(meterec, "Disk buffers: %dms requested, %llu frames per port, %zu bytes for %d ports.\n", ms, size, len, n_ports);
+
+}
+
+void disk_free_buffers(struct meterec_s *meterec) {
+
+	unsigned int port;
+
+	if (meterec->dbuf_arena == NULL)
+		return;
+
+	for (port = 0; port < meterec->max_ports; port++) {
+		meterec->ports[port].read_disk_buffer = NULL;
+		meterec->ports[port].write_disk_buffer = NULL;
+	}
+
+	munlock(meterec->dbuf_arena, meterec->dbuf_arena_len);
+	munmap(meterec->dbuf_arena, meterec->dbuf_arena_len);
+
+	meterec->dbuf_arena = NULL;
+	meterec->dbuf_arena_len = 0;
 
 }
@@ -25,4 +25,8 @@ void *reader_thread(void *d);
 float read_disk_buffer_level(struct meterec_s *meterec);
 float write_disk_buffer_level(struct meterec_s *meterec);
 unsigned int set_thread_delay(struct meterec_s *meterec);
-void read_disk_seek(struct meterec_s *meterec, unsigned int seek);
+void read_disk_seek(struct meterec_s *meterec, unsigned long long seek);
+void disk_alloc_buffers(struct meterec_s *meterec, unsigned int n_ports);
+void disk_free_buffers(struct meterec_s *meterec);
+char *take_track_file(const char *take_file, unsigned int track);
+void recover_take(struct meterec_s *meterec, unsigned int take);
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <semaphore.h>
 
 #include <sndfile.h>
 #include <jack/jack.h>
@@ -31,6 +32,8 @@
 #include "disk.h"
 #include "ports.h"
 #include "display.h"
+#include "engine.h"
+#include "stats.h"
 
 WINDOW * mainwin = NULL;
 
@@ -90,6 +93,7 @@ void display_init_windows(struct meterec_s *meterec, unsigned int w, unsigned in
 	meterec->display.wsc2 = newwin(    2,  w-9, p+4,    9); /* vu meter scale at bottom */
 	meterec->display.wclr = newwin(h-p-7,    w, p+6,    0); /* */
 	meterec->display.wcon = newwin(  h-3,    w,   2,    0); /* jack connections */
+	meterec->display.wsta = newwin(  h-3,    w,   2,    0); /* process and disk statistics */
 	meterec->display.wbot = newwin(    1, w-17, h-1,    0); /* infrmation about selected port */
 	meterec->display.wbdb = newwin(    1,   17, h-1, w-17); /* digital level of selected port */
 
@@ -203,6 +207,7 @@ void display_dynamic_content(struct meterec_s *meterec) {
 
 	display_rd_status(meterec);
 	display_wr_status(meterec);
+	display_preload(meterec);
 	display_loop(meterec);
 	display_current_view_name(meterec);
 
@@ -224,6 +229,10 @@ void display_dynamic_content(struct meterec_s *meterec) {
 			display_ports_tiny_meters(meterec);
 
 			break;
+
+		case STATS :
+			display_stats(meterec);
+			break;
 	}
 
 	display_port_info(meterec);
@@ -267,6 +276,10 @@ void display_debug_windows(struct meterec_s *meterec) {
 			display_box(meterec->display.wco );
 			display_box(meterec->display.wpii);
 			break;
+
+		case STATS :
+			display_box(meterec->display.wsta);
+			break;
 	}
 
 	/* ALL */
@@ -368,7 +381,8 @@ void display_right_aligned(char *message, unsigned int remain) {
 
 void display_port_info(struct meterec_s *meterec) {
 
-	unsigned int len, w, take, length;
+	unsigned int len, w, take;
+	unsigned long long length;
 	unsigned int port = meterec->pos.port;
 	struct port_s *port_p = &meterec->ports[port];
 	char *take_name = NULL;
@@ -405,7 +419,7 @@ void display_port_info(struct meterec_s *meterec) {
 		wprintw(win, "     |");
 
 	take = meterec->ports[port].playback_take;
-	length = meterec->takes[take].info.frames + meterec->takes[take].offset ;
+	length = take_info(meterec, take)->frames + meterec->takes[take].offset ;
 	if ( !take || length < meterec->jack.playhead )
 		wprintw(win, "EOT|");
 	else
@@ -498,7 +512,8 @@ void display_ports_tiny_meters(struct meterec_s *meterec) {
 
 void display_ports_modes(struct meterec_s *meterec) {
 
-	unsigned int port, take, length;
+	unsigned int port, take;
+	unsigned long long length;
 	WINDOW *win;
 
 	win = meterec->display.wpor;
@@ -531,7 +546,7 @@ void display_ports_modes(struct meterec_s *meterec) {
 			wprintw(win, " ");
 
 		take = meterec->ports[port].playback_take;
-		length = meterec->takes[take].info.frames + meterec->takes[take].offset ;
+		length = take_info(meterec, take)->frames + meterec->takes[take].offset ;
 		if ( !take || length < meterec->jack.playhead )
 			wprintw(win, "E");
 		else
@@ -861,7 +876,7 @@ void display_current_view_name(struct meterec_s *meterec) {
 
 	werase(win);
 
-	wmove(win, 0, w-27);
+	wmove(win, 0, w-32);
 	wprintw(win, "%6.2f%%", jack_cpu_load(meterec->client));
 
 	if (view==VU_IN)
@@ -880,20 +895,118 @@ void display_current_view_name(struct meterec_s *meterec) {
 		wprintw(win, "|    ");
 
 	if (view==PORT)
-		wprintw(win, "|CONs|");
+		wprintw(win, "|CONs");
+	else
+		wprintw(win, "|    ");
+
+	if (view==STATS)
+		wprintw(win, "|STAT|");
 	else
 		wprintw(win, "|    |");
 
 	wnoutrefresh(win);
 }
 
+static void display_stats_hist(WINDOW *win, int y, const char *name, struct hist_s *hist) {
+
+	mvwprintw(win, y, 1, "%-9s", name);
+
+	if (!__atomic_load_n(&hist->n, __ATOMIC_ACQUIRE)) {
+		wprintw(win, "-");
+		return;
+	}
+
+	wprintw(win, "p50 %6lluusec  p99 %6lluusec  max %6lluusec",
+		hist_percentile(hist, 50), hist_percentile(hist, 99), __atomic_load_n(&hist->max, __ATOMIC_RELAXED));
+}
+
+void display_stats(struct meterec_s *meterec) {
+
+	WINDOW *win = meterec->display.wsta;
+	struct stats_s *stats = &meterec->stats;
+	unsigned long long count, max_count = 1, max;
+	unsigned int bucket, i, bar, width, xruns;
+	float rate;
+
+	werase(win);
+
+	width = getmaxx(win) > 30 ? getmaxx(win) - 30 : 1;
+	rate = meterec->jack.sample_rate ? meterec->jack.sample_rate / 1000.0f : 1.0f;
+	xruns = __atomic_load_n(&stats->xruns, __ATOMIC_ACQUIRE);
+	max = __atomic_load_n(&stats->cycle.max, __ATOMIC_RELAXED);
+
+	mvwprintw(win, 0, 1, "PROCESS  %llu period(s) of %lluusec, ", __atomic_load_n(&stats->cycle.n, __ATOMIC_ACQUIRE), stats->budget);
+
+	if (xruns)
+		wcolor_set(win, RED, NULL);
+	wprintw(win, "%d xrun(s)", xruns);
+	if (xruns)
+		wprintw(win, ", last one %.0fusec late", stats->xrun_delay);
+	wcolor_set(win, DEFAULT, NULL);
+
+	display_stats_hist(win, 1, "cycle", &stats->cycle);
+	if (stats->budget)
+		wprintw(win, "  (%.1f%% of period)", 100.0f * max / stats->budget);
+
+	/* time spent in the process path against the period */
+	for (bucket = 0; bucket < LOAD_BUCKETS; bucket++) {
+		count = __atomic_load_n(&stats->load[bucket], __ATOMIC_RELAXED);
+		if (count > max_count)
+			max_count = count;
+	}
+
+	for (bucket = 0; bucket < LOAD_BUCKETS; bucket++) {
+
+		count = __atomic_load_n(&stats->load[bucket], __ATOMIC_RELAXED);
+
+		if (bucket < LOAD_BUCKETS - 1)
+			mvwprintw(win, 3 + bucket, 1, "LOAD %3d-%3d%% %10llu ", bucket * 10, bucket * 10 + 10, count);
+		else
+			mvwprintw(win, 3 + bucket, 1, "LOAD    >100%% %10llu ", count);
+
+		if (bucket >= 8)
+			wcolor_set(win, bucket == LOAD_BUCKETS - 1 ? RED : YELLOW, NULL);
+
+		bar = count * width / max_count;
+		if (count && !bar)
+			bar = 1;
+		for (i = 0; i < bar; i++)
+			waddch(win, '#');
+
+		wcolor_set(win, DEFAULT, NULL);
+	}
+
+	i = 4 + LOAD_BUCKETS;
+
+	mvwprintw(win, i++, 1, "DISK     read ahead min ");
+	if (stats->read_min == MAX_UINT)
+		wprintw(win, "-");
+	else
+		wprintw(win, "%d frames (%.0fms)", stats->read_min, stats->read_min / rate);
+
+	wprintw(win, ", write room min ");
+	if (stats->write_min == MAX_UINT)
+		wprintw(win, "-");
+	else
+		wprintw(win, "%d frames (%.0fms)", stats->write_min, stats->write_min / rate);
+
+	wprintw(win, ", %d/%d overflow(s)", meterec->read_disk_buffer_overflow, meterec->write_disk_buffer_overflow);
+
+	display_stats_hist(win, i++, "reader", &stats->reader_wake);
+	wprintw(win, "  wake to fill");
+	display_stats_hist(win, i++, "writer", &stats->writer_wake);
+	wprintw(win, "  wake to drain");
+
+	wnoutrefresh(win);
+}
+
 void display_loop(struct meterec_s *meterec) {
 
 	WINDOW *win = meterec->display.wloo;
 	struct time_s low, high, now;
 	werase(win);
 
-	if (meterec->loop.low == MAX_UINT)
+	if (meterec->loop.low == MAX_FRAME)
 		wprintw(win, "[-:--:--.---]");
 	else {
 		low.frm = meterec->loop.low;
@@ -907,7 +1020,7 @@ void display_loop(struct meterec_s *meterec) {
 	time_hms(&now);
 	wprintw(win, " %d:%02d:%02d.%03d ", now.h, now.m, now.s, now.ms);
 
-	if (meterec->loop.high == MAX_UINT)
+	if (meterec->loop.high == MAX_FRAME)
 		wprintw(win, "[-:--:--.---]");
 	else {
 		high.frm = meterec->loop.high;
@@ -944,6 +1057,24 @@ void display_rd_status(struct meterec_s *meterec) {
 	wnoutrefresh(win);
 }
 
+void display_preload(struct meterec_s *meterec) {
+
+	WINDOW *win = meterec->display.wttl;
+	char str[40];
+	unsigned int w = getmaxx(win);
+
+	if (!meterec->preload && !meterec->preload_opt)
+		return;
+
+	snprintf(str, sizeof(str), "RAM %zu/%dMB", meterec->preload_bytes >> 20, meterec->preload_mb);
+
+	wmove(win, 1, 0);
+	wclrtoeol(win);
+	mvwprintw(win, 1, (w - strlen(str)) / 2, "%s", str);
+
+	wnoutrefresh(win);
+}
+
 void display_wr_status(struct meterec_s *meterec) {
 
 	WINDOW *win = meterec->display.wwrs;
@@ -986,6 +1117,7 @@ void display_take_info(struct meterec_s *meterec) {
 
 	WINDOW *win = meterec->display.wtak;
 	char *take_name ="";
+	char *lenght, null_lenght[TAKE_LENGHT_LEN];
 	unsigned int port, take, len, w;
 
 	werase(win);
@@ -1001,11 +1133,19 @@ void display_take_info(struct meterec_s *meterec) {
 	if (take_name == NULL)
 		take_name = "";
 
+	take_info(meterec, take);
+	if (*meterec->takes[take].lenght)
+		lenght = meterec->takes[take].lenght;
+	else {
+		time_null_sprint(null_lenght);
+		lenght = null_lenght;
+	}
+
 	wprintw(win, "Take %2d ",take);
-	wprintw(win, "%s",  meterec->takes[take].port_has_track[port]?"|CONTENT":"|       " );
-	wprintw(win, "%s",  meterec->takes[take].port_has_lock[port]?"|LOCKED":"|      " );
+	wprintw(win, "%s",  take_has_track(meterec, take, port)?"|CONTENT":"|       " );
+	wprintw(win, "%s",  take_has_lock(meterec, take, port)?"|LOCKED":"|      " );
 	wprintw(win, "%s", (meterec->ports[port].playback_take == take)?"|PLAYING|":"|       |" );
-	wprintw(win, " [%s] ", meterec->takes[take].lenght);
+	wprintw(win, " [%s] ", lenght);
 
 	len = strlen(take_name);
 	w = getmaxx(win);
@@ -1019,7 +1159,7 @@ void display_session(struct meterec_s *meterec)
 {
 
 	WINDOW *win = meterec->display.wses;
-	unsigned int take, port;
+	unsigned int take, port, first, last, w;
 	unsigned int y_pos, x_pos;
 
 	werase(win);
@@ -1027,6 +1167,23 @@ void display_session(struct meterec_s *meterec)
 	y_pos = meterec->pos.port;
 	x_pos = meterec->pos.take;
 
+	/* only the takes fitting the window are shown, scrolled to keep the cursor in */
+	w = getmaxx(win);
+	w = w > 1 ? w - 1 : 1;
+
+	first = meterec->display.take_first;
+	if (x_pos < first)
+		first = x_pos;
+	if (x_pos >= first + w)
+		first = x_pos - w + 1;
+	if (first < 1 || first > meterec->n_takes)
+		first = 1;
+	meterec->display.take_first = first;
+
+	last = first + w - 1;
+	if (last > meterec->n_takes)
+		last = meterec->n_takes;
+
 	for (port=0; port<meterec->n_ports; port++) {
 
 		color_port(meterec, port, win);
@@ -1036,7 +1193,7 @@ void display_session(struct meterec_s *meterec)
 		else
 			wattroff(win, A_REVERSE);
 
-		for (take=1; take<meterec->n_takes+1; take++) {
+		for (take=first; take<last+1; take++) {
 
 			if ((y_pos == port) || (x_pos == take))
 				wattron(win, A_REVERSE);
@@ -1049,11 +1206,11 @@ void display_session(struct meterec_s *meterec)
 			if ( meterec->ports[port].playback_take == take )
 				wattron(win, A_BOLD);
 
-			if ( meterec->takes[take].port_has_lock[port] )
-				wprintw(win, meterec->takes[take].port_has_track[port]?"L":"l");
+			if ( take_has_lock(meterec, take, port) )
+				wprintw(win, take_has_track(meterec, take, port)?"L":"l");
 			else if ( meterec->ports[port].playback_take == take )
 				wprintw(win, "P");
-			else if ( meterec->takes[take].port_has_track[port] )
+			else if ( take_has_track(meterec, take, port) )
 				wprintw(win, "X");
 			else
 				wprintw(win, "-");
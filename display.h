@@ -33,6 +33,8 @@ void display_ports_modes(struct meterec_s *meterec);
 void display_ports_tiny_meters(struct meterec_s *meterec);
 void display_rd_status(struct meterec_s *meterec);
 void display_wr_status(struct meterec_s *meterec);
+void display_preload(struct meterec_s *meterec);
+void display_stats(struct meterec_s *meterec);
 void display_current_view_name(struct meterec_s *meterec);
 void display_meter(struct meterec_s *meterec);
 void display_init_scale(int side, WINDOW *win);
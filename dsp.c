@@ -0,0 +1,487 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSP_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DSP_NEON
+#endif
+
+#include "dsp.h"
+
+struct dsp_s dsp;
+
+/******************************************************************************
+** Scalar kernels
+*/
+
+static void scalar_zero(float *dst, unsigned int n) {
+
+	memset(dst, 0, n * sizeof(float));
+}
+
+static void scalar_copy(float *dst, const float *src, unsigned int n) {
+
+	memcpy(dst, src, n * sizeof(float));
+}
+
+static void scalar_add(float *dst, const float *src, unsigned int n) {
+
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] += src[i];
+}
+
+static void scalar_sum(float *dst, const float *a, const float *b, unsigned int n) {
+
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = a[i] + b[i];
+}
+
+static float scalar_peak(const float *src, unsigned int n, float peak) {
+
+	unsigned int i;
+	float s;
+
+	for (i = 0; i < n; i++) {
+		s = fabsf(src[i]);
+		if (s > peak)
+			peak = s;
+	}
+
+	return peak;
+}
+
+static void scalar_deinterleave(float *dst, const float *src, unsigned int stride, unsigned int n) {
+
+	unsigned int i;
+
+	if (stride == 1) {
+		memcpy(dst, src, n * sizeof(float));
+		return;
+	}
+
+	for (i = 0; i + 4 <= n; i += 4, src += 4 * stride) {
+		dst[i]     = src[0];
+		dst[i + 1] = src[stride];
+		dst[i + 2] = src[2 * stride];
+		dst[i + 3] = src[3 * stride];
+	}
+
+	for ( ; i < n; i++, src += stride)
+		dst[i] = src[0];
+}
+
+/******************************************************************************
+** SSE kernels
+*/
+
+#ifdef DSP_X86
+
+__attribute__((target("sse2")))
+static void sse_add(float *dst, const float *src, unsigned int n) {
+
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+
+	for ( ; i < n; i++)
+		dst[i] += src[i];
+}
+
+__attribute__((target("sse2")))
+static void sse_sum(float *dst, const float *a, const float *b, unsigned int n) {
+
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+	for ( ; i < n; i++)
+		dst[i] = a[i] + b[i];
+}
+
+__attribute__((target("sse2")))
+static float sse_peak(const float *src, unsigned int n, float peak) {
+
+	unsigned int i;
+	float max[4];
+	__m128 vmax, mask;
+
+	mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	vmax = _mm_set1_ps(peak);
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vmax = _mm_max_ps(vmax, _mm_and_ps(_mm_loadu_ps(src + i), mask));
+
+	_mm_storeu_ps(max, vmax);
+
+	for (peak = max[0], i = 1; i < 4; i++)
+		if (max[i] > peak)
+			peak = max[i];
+
+	return scalar_peak(src + (n & ~3u), n & 3u, peak);
+}
+
+__attribute__((target("sse2")))
+static void sse_deinterleave(float *dst, const float *src, unsigned int stride, unsigned int n) {
+
+	unsigned int i;
+
+	/* stereo takes are the common case, other layouts are gathered one by one */
+	if (stride != 2) {
+		scalar_deinterleave(dst, src, stride, n);
+		return;
+	}
+
+	/* second load reaches src[2*i+7], past the last sample of the right channel on the last block */
+	for (i = 0; i + 4 < n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_shuffle_ps(_mm_loadu_ps(src + 2*i), _mm_loadu_ps(src + 2*i + 4), _MM_SHUFFLE(2, 0, 2, 0)));
+
+	for ( ; i < n; i++)
+		dst[i] = src[2*i];
+}
+
+/******************************************************************************
+** AVX2 kernels
+*/
+
+__attribute__((target("avx2")))
+static void avx2_add(float *dst, const float *src, unsigned int n) {
+
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+
+	for ( ; i < n; i++)
+		dst[i] += src[i];
+}
+
+__attribute__((target("avx2")))
+static void avx2_sum(float *dst, const float *a, const float *b, unsigned int n) {
+
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+
+	for ( ; i < n; i++)
+		dst[i] = a[i] + b[i];
+}
+
+__attribute__((target("avx2")))
+static float avx2_peak(const float *src, unsigned int n, float peak) {
+
+	unsigned int i, j;
+	float max[8];
+	__m256 vmax0, vmax1, mask;
+
+	mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	vmax0 = _mm256_set1_ps(peak);
+	vmax1 = vmax0;
+
+	/* two accumulators to hide max latency */
+	for (i = 0; i + 16 <= n; i += 16) {
+		vmax0 = _mm256_max_ps(vmax0, _mm256_and_ps(_mm256_loadu_ps(src + i), mask));
+		vmax1 = _mm256_max_ps(vmax1, _mm256_and_ps(_mm256_loadu_ps(src + i + 8), mask));
+	}
+
+	for ( ; i + 8 <= n; i += 8)
+		vmax0 = _mm256_max_ps(vmax0, _mm256_and_ps(_mm256_loadu_ps(src + i), mask));
+
+	_mm256_storeu_ps(max, _mm256_max_ps(vmax0, vmax1));
+
+	for (peak = max[0], j = 1; j < 8; j++)
+		if (max[j] > peak)
+			peak = max[j];
+
+	/* do not call SSE kernels from here, mixing encodings is slow */
+	for ( ; i < n; i++)
+		if (fabsf(src[i]) > peak)
+			peak = fabsf(src[i]);
+
+	return peak;
+}
+
+__attribute__((target("avx2")))
+static void avx2_deinterleave(float *dst, const float *src, unsigned int stride, unsigned int n) {
+
+	unsigned int i;
+	__m256i index;
+
+	if (stride == 1) {
+		memcpy(dst, src, n * sizeof(float));
+		return;
+	}
+
+	index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_i32gather_ps(src + i * stride, index, 4));
+
+	for ( ; i < n; i++)
+		dst[i] = src[i * stride];
+}
+
+#endif
+
+/******************************************************************************
+** NEON kernels
+*/
+
+#ifdef DSP_NEON
+
+static void neon_add(float *dst, const float *src, unsigned int n) {
+
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+
+	for ( ; i < n; i++)
+		dst[i] += src[i];
+}
+
+static void neon_sum(float *dst, const float *a, const float *b, unsigned int n) {
+
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vaddq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+
+	for ( ; i < n; i++)
+		dst[i] = a[i] + b[i];
+}
+
+static float neon_peak(const float *src, unsigned int n, float peak) {
+
+	unsigned int i;
+	float max[4];
+	float32x4_t vmax;
+
+	vmax = vdupq_n_f32(peak);
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vmax = vmaxq_f32(vmax, vabsq_f32(vld1q_f32(src + i)));
+
+	vst1q_f32(max, vmax);
+
+	for (peak = max[0], i = 1; i < 4; i++)
+		if (max[i] > peak)
+			peak = max[i];
+
+	return scalar_peak(src + (n & ~3u), n & 3u, peak);
+}
+
+#endif
+
+/******************************************************************************
+** Dispatch
+*/
+
+void dsp_init(unsigned int select) {
+
+	dsp.name = "scalar";
+	dsp.zero = scalar_zero;
+	dsp.copy = scalar_copy;
+	dsp.add  = scalar_add;
+	dsp.sum  = scalar_sum;
+	dsp.peak = scalar_peak;
+	dsp.deinterleave = scalar_deinterleave;
+
+	if (select == DSP_SCALAR)
+		return;
+
+#ifdef DSP_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2")) {
+		dsp.name = "sse2";
+		dsp.add  = sse_add;
+		dsp.sum  = sse_sum;
+		dsp.peak = sse_peak;
+		dsp.deinterleave = sse_deinterleave;
+	}
+
+	if (select != DSP_SSE2 && __builtin_cpu_supports("avx2")) {
+		dsp.name = "avx2";
+		dsp.add  = avx2_add;
+		dsp.sum  = avx2_sum;
+		dsp.peak = avx2_peak;
+		dsp.deinterleave = avx2_deinterleave;
+	}
+#endif
+
+#ifdef DSP_NEON
+	dsp.name = "neon";
+	dsp.add  = neon_add;
+	dsp.sum  = neon_sum;
+	dsp.peak = neon_peak;
+#endif
+
+}
+
+/******************************************************************************
+** Ring buffer helpers
+*/
+
+void dsp_ring_read(float *dst, const float *ring, unsigned int pos, unsigned int size, unsigned int n) {
+
+	unsigned int first;
+
+	first = size - pos;
+
+	if (first >= n) {
+		dsp.copy(dst, ring + pos, n);
+		return;
+	}
+
+	dsp.copy(dst, ring + pos, first);
+	dsp.copy(dst + first, ring, n - first);
+}
+
+void dsp_ring_write(float *ring, unsigned int pos, unsigned int size, const float *src, unsigned int n) {
+
+	unsigned int first;
+
+	first = size - pos;
+
+	if (first >= n) {
+		dsp.copy(ring + pos, src, n);
+		return;
+	}
+
+	dsp.copy(ring + pos, src, first);
+	dsp.copy(ring, src + first, n - first);
+}
+
+void dsp_ring_zero(float *ring, unsigned int pos, unsigned int size, unsigned int n) {
+
+	unsigned int first;
+
+	first = size - pos;
+
+	if (first >= n) {
+		dsp.zero(ring + pos, n);
+		return;
+	}
+
+	dsp.zero(ring + pos, first);
+	dsp.zero(ring, n - first);
+}
+
+void dsp_ring_write_sum(float *ring, unsigned int pos, unsigned int size, const float *a, const float *b, unsigned int n) {
+
+	unsigned int first;
+
+	first = size - pos;
+
+	if (first >= n) {
+		dsp.sum(ring + pos, a, b, n);
+		return;
+	}
+
+	dsp.sum(ring + pos, a, b, first);
+	dsp.sum(ring, a + first, b + first, n - first);
+}
+
+void dsp_ring_deinterleave(float *ring, unsigned int pos, unsigned int size, const float *src, unsigned int stride, unsigned int n) {
+
+	unsigned int first;
+
+	first = size - pos;
+
+	if (first >= n) {
+		dsp.deinterleave(ring + pos, src, stride, n);
+		return;
+	}
+
+	dsp.deinterleave(ring + pos, src, stride, first);
+	dsp.deinterleave(ring, src + first * stride, stride, n - first);
+}
+
+void dsp_ring_interleave(float *dst, unsigned int stride, const float *ring, unsigned int pos, unsigned int size, unsigned int n) {
+
+	unsigned int first, i;
+
+	if (stride == 1) {
+		dsp_ring_read(dst, ring, pos, size, n);
+		return;
+	}
+
+	first = size - pos;
+	if (first > n)
+		first = n;
+
+	for (i = 0; i < first; i++)
+		dst[i * stride] = ring[pos + i];
+
+	for ( ; i < n; i++)
+		dst[i * stride] = ring[i - first];
+}
+
+unsigned int dsp_loop_read(float *dst, const float *loop, unsigned int len, unsigned int pos, unsigned int n) {
+
+	unsigned int first;
+
+	while (n) {
+
+		first = len - pos;
+		if (first > n)
+			first = n;
+
+		dsp.copy(dst, loop + pos, first);
+
+		dst += first;
+		n -= first;
+		pos += first;
+
+		if (pos == len)
+			pos = 0;
+	}
+
+	return pos;
+}
+
+void dsp_crossfade(float *dst, const float *src, unsigned int n) {
+
+	unsigned int i;
+	float gain;
+
+	for (i = 0; i < n; i++) {
+		gain = (float)(i + 1) / (n + 1);
+		dst[i] = dst[i] * (1.0f - gain) + src[i] * gain;
+	}
+}
@@ -0,0 +1,58 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/* kernel selection */
+#define DSP_AUTO 0
+#define DSP_SCALAR 1
+#define DSP_SSE2 2   /* x86 kernels up to SSE2 only, to check them on AVX2 hosts */
+
+/*
+note :
+- kernels work on plain sample arrays, no alignment required.
+- ring variants split the access in two at the end of the ring, size must be
+  a power of two.
+*/
+struct dsp_s
+{
+	const char *name;
+
+	void  (*zero) (float *dst, unsigned int n);
+	void  (*copy) (float *dst, const float *src, unsigned int n);
+	void  (*add)  (float *dst, const float *src, unsigned int n);
+	void  (*sum)  (float *dst, const float *a, const float *b, unsigned int n);
+	float (*peak) (const float *src, unsigned int n, float peak);
+	void  (*deinterleave) (float *dst, const float *src, unsigned int stride, unsigned int n);
+};
+
+extern struct dsp_s dsp;
+
+void dsp_init(unsigned int select);
+
+void dsp_ring_read     (float *dst, const float *ring, unsigned int pos, unsigned int size, unsigned int n);
+void dsp_ring_write    (float *ring, unsigned int pos, unsigned int size, const float *src, unsigned int n);
+void dsp_ring_zero     (float *ring, unsigned int pos, unsigned int size, unsigned int n);
+void dsp_ring_write_sum(float *ring, unsigned int pos, unsigned int size, const float *a, const float *b, unsigned int n);
+void dsp_ring_deinterleave(float *ring, unsigned int pos, unsigned int size, const float *src, unsigned int stride, unsigned int n);
+void dsp_ring_interleave  (float *dst, unsigned int stride, const float *ring, unsigned int pos, unsigned int size, unsigned int n);
+
+unsigned int dsp_loop_read(float *dst, const float *loop, unsigned int len, unsigned int pos, unsigned int n);
+void dsp_crossfade(float *dst, const float *src, unsigned int n);
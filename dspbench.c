@@ -0,0 +1,335 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+** Micro benchmark of the per port work done by process_jack_data():
+** peak of input, ring buffer read with wrap around, peak of output,
+** OVR mixing into the write ring buffer, monitor and pass thru sums.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "dsp.h"
+
+#define RING_SIZE 0x8000
+
+struct bench_port_s
+{
+	float *in;
+	float *out;
+	float *read_ring;
+	float *write_ring;
+	float peak_in;
+	float peak_out;
+};
+
+static unsigned long long ticks(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* the per sample loop process_jack_data() used to run */
+static void period_inline(struct bench_port_s *ports, unsigned int n_ports, float *mon, unsigned int pos, unsigned int nframes) {
+
+	unsigned int port, i, read_pos, write_pos;
+	float s;
+
+	for (i = 0; i < nframes; i++)
+		mon[i] = 0.0f;
+
+	for (port = 0; port < n_ports; port++) {
+
+		for (i = 0; i < nframes; i++)
+			mon[i] += ports[port].in[i];
+
+		read_pos = pos;
+		for (i = 0; i < nframes; i++) {
+			ports[port].out[i] = ports[port].read_ring[read_pos];
+			read_pos = (read_pos + 1) & (RING_SIZE - 1);
+
+			s = fabs(ports[port].in[i] * 1.0f);
+			if (s > ports[port].peak_in)
+				ports[port].peak_in = s;
+
+			s = fabs(ports[port].out[i] * 1.0f);
+			if (s > ports[port].peak_out)
+				ports[port].peak_out = s;
+		}
+
+		write_pos = pos;
+		for (i = 0; i < nframes; i++) {
+			ports[port].write_ring[write_pos] = ports[port].in[i] + ports[port].out[i];
+			write_pos = (write_pos + 1) & (RING_SIZE - 1);
+		}
+
+		for (i = 0; i < nframes; i++)
+			ports[port].out[i] += ports[port].in[i];
+	}
+}
+
+/* the same work using dsp kernels, as process_jack_data() does now */
+static void period_dsp(struct bench_port_s *ports, unsigned int n_ports, float *mon, unsigned int pos, unsigned int nframes) {
+
+	unsigned int port;
+
+	dsp.zero(mon, nframes);
+
+	for (port = 0; port < n_ports; port++) {
+
+		dsp.add(mon, ports[port].in, nframes);
+
+		ports[port].peak_in = dsp.peak(ports[port].in, nframes, ports[port].peak_in);
+
+		dsp_ring_read(ports[port].out, ports[port].read_ring, pos, RING_SIZE, nframes);
+		ports[port].peak_out = dsp.peak(ports[port].out, nframes, ports[port].peak_out);
+
+		dsp_ring_write_sum(ports[port].write_ring, pos, RING_SIZE, ports[port].in, ports[port].out, nframes);
+
+		dsp.add(ports[port].out, ports[port].in, nframes);
+	}
+}
+
+static double run(const char *name, void (*period)(struct bench_port_s *, unsigned int, float *, unsigned int, unsigned int),
+	struct bench_port_s *ports, unsigned int n_ports, float *mon, unsigned int nframes, unsigned int periods) {
+
+	unsigned int i, port, pos = RING_SIZE - nframes/2;
+	unsigned long long start, elapsed, best = ~0ull;
+	double cost;
+
+	for (port = 0; port < n_ports; port++)
+		ports[port].peak_in = ports[port].peak_out = 0.0f;
+
+	/* keep best of several runs to get rid of scheduling noise */
+	for (i = 0; i < periods; i++) {
+		start = ticks();
+		period(ports, n_ports, mon, pos, nframes);
+		elapsed = ticks() - start;
+		if (elapsed < best)
+			best = elapsed;
+		pos = (pos + nframes) & (RING_SIZE - 1);
+	}
+
+	cost = (double)best / n_ports;
+
+	printf("%-8s %5d ports %5d frames %10.1f %s/port/period\n", name, n_ports, nframes, cost,
+#if defined(__x86_64__) || defined(__i386__)
+		"cycles"
+#else
+		"ns"
+#endif
+		);
+
+	return cost;
+}
+
+static int check(struct bench_port_s *ports, unsigned int n_ports, unsigned int nframes) {
+
+	struct bench_port_s ref;
+	unsigned int port, pos;
+	int errors = 0;
+
+	/* compare dispatched kernels against scalar ones on an unaligned, wrapping access */
+	ref.out = malloc((nframes + 1) * sizeof(float));
+	ref.write_ring = malloc(RING_SIZE * sizeof(float));
+
+	for (port = 0; port < n_ports; port++) {
+
+		pos = RING_SIZE - nframes/2 - 1;
+
+		dsp_init(DSP_SCALAR);
+		memcpy(ref.write_ring, ports[port].write_ring, RING_SIZE * sizeof(float));
+		dsp_ring_read(ref.out + 1, ports[port].read_ring, pos, RING_SIZE, nframes);
+		dsp_ring_write_sum(ref.write_ring, pos, RING_SIZE, ports[port].in + 1, ref.out + 1, nframes - 1);
+		ref.peak_out = dsp.peak(ref.out + 1, nframes, 0.0f);
+
+		dsp_init(DSP_AUTO);
+		dsp_ring_read(ports[port].out, ports[port].read_ring, pos, RING_SIZE, nframes);
+		dsp_ring_write_sum(ports[port].write_ring, pos, RING_SIZE, ports[port].in + 1, ports[port].out, nframes - 1);
+		ports[port].peak_out = dsp.peak(ports[port].out, nframes, 0.0f);
+
+		if (ref.peak_out != ports[port].peak_out)
+			errors++;
+		if (memcmp(ref.out + 1, ports[port].out, nframes * sizeof(float)))
+			errors++;
+		if (memcmp(ref.write_ring, ports[port].write_ring, RING_SIZE * sizeof(float)))
+			errors++;
+	}
+
+	free(ref.out);
+	free(ref.write_ring);
+
+	return errors;
+}
+
+#define CHECK_STRIDE 9
+#define CHECK_RING 64
+
+/* sources are sized to the last sample of the last track, so an over-read shows under ASan */
+static int check_deinterleave(unsigned int select) {
+
+	static const unsigned int lengths[] = { 1, 2, 3, 4, 5, 7, 8, 9, 12, 15, 16, 17, 31, 33, 63 };
+	unsigned int stride, track, l, n, i, pos;
+	float *src, *ref, *dst, ref_ring[CHECK_RING], ring[CHECK_RING];
+	int errors = 0;
+
+	for (stride = 1; stride <= CHECK_STRIDE; stride++)
+		for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+
+			n = lengths[l];
+			src = malloc(stride * n * sizeof(float));
+			ref = malloc(n * sizeof(float));
+			dst = malloc(n * sizeof(float));
+
+			for (i = 0; i < stride * n; i++)
+				src[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+
+			for (track = 0; track < stride; track++) {
+
+				dsp_init(DSP_SCALAR);
+				dsp.deinterleave(ref, src + track, stride, n);
+
+				dsp_init(select);
+				dsp.deinterleave(dst, src + track, stride, n);
+
+				if (memcmp(ref, dst, n * sizeof(float)))
+					errors++;
+
+				/* split at the end of the ring, from one frame before to all of it after */
+				for (pos = CHECK_RING - n; pos <= CHECK_RING; pos++) {
+
+					memset(ref_ring, 0, sizeof(ref_ring));
+					memset(ring, 0, sizeof(ring));
+
+					dsp_init(DSP_SCALAR);
+					dsp_ring_deinterleave(ref_ring, pos & (CHECK_RING - 1), CHECK_RING, src + track, stride, n);
+
+					dsp_init(select);
+					dsp_ring_deinterleave(ring, pos & (CHECK_RING - 1), CHECK_RING, src + track, stride, n);
+
+					if (memcmp(ref_ring, ring, sizeof(ring)))
+						errors++;
+				}
+			}
+
+			free(src);
+			free(ref);
+			free(dst);
+		}
+
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned int n_ports = 64, nframes = 32, periods = 2000, port, i;
+	struct bench_port_s *ports;
+	float *mon;
+	double inline_cost, scalar_cost, dsp_cost;
+
+	while ((opt = getopt(argc, argv, "p:n:i:h")) != -1) {
+		switch (opt) {
+			case 'p':
+				n_ports = atoi(optarg);
+				break;
+			case 'n':
+				nframes = atoi(optarg);
+				break;
+			case 'i':
+				periods = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				fprintf(stderr, "%s [-p ports] [-n frames per period] [-i periods]\n", argv[0]);
+				exit(1);
+		}
+	}
+
+	if (!n_ports || nframes < 2 || nframes > RING_SIZE/2) {
+		fprintf(stderr, "Invalid ports or frames per period.\n");
+		exit(1);
+	}
+
+	srand(1);
+
+	ports = calloc(n_ports, sizeof(struct bench_port_s));
+	mon = malloc(nframes * sizeof(float));
+
+	for (port = 0; port < n_ports; port++) {
+		ports[port].in = malloc(nframes * sizeof(float));
+		ports[port].out = malloc(nframes * sizeof(float));
+		ports[port].read_ring = malloc(RING_SIZE * sizeof(float));
+		ports[port].write_ring = calloc(RING_SIZE, sizeof(float));
+
+		for (i = 0; i < nframes; i++)
+			ports[port].in[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+		for (i = 0; i < RING_SIZE; i++)
+			ports[port].read_ring[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+	}
+
+	inline_cost = run("inline", period_inline, ports, n_ports, mon, nframes, periods);
+
+	dsp_init(DSP_SCALAR);
+	scalar_cost = run(dsp.name, period_dsp, ports, n_ports, mon, nframes, periods);
+
+	dsp_init(DSP_AUTO);
+	dsp_cost = run(dsp.name, period_dsp, ports, n_ports, mon, nframes, periods);
+
+	printf("speedup  %.2fx vs inline, %.2fx vs scalar kernels\n", inline_cost / dsp_cost, scalar_cost / dsp_cost);
+
+	if (check(ports, n_ports, nframes)) {
+		printf("ERROR: %s kernels do not match scalar kernels\n", dsp.name);
+		return 1;
+	}
+
+	if (check_deinterleave(DSP_AUTO) || check_deinterleave(DSP_SSE2)) {
+		printf("ERROR: %s deinterleave does not match scalar deinterleave\n", dsp.name);
+		return 1;
+	}
+
+	for (port = 0; port < n_ports; port++) {
+		free(ports[port].in);
+		free(ports[port].out);
+		free(ports[port].read_ring);
+		free(ports[port].write_ring);
+	}
+	free(ports);
+	free(mon);
+
+	return 0;
+}
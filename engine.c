@@ -0,0 +1,550 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <sndfile.h>
+#include <jack/jack.h>
+#include <curses.h>
+
+#include "config.h"
+#include "position.h"
+#include "meterec.h"
+#include "disk.h"
+#include "queue.h"
+#include "engine.h"
+#include "stats.h"
+
+/******************************************************************************
+** Takes and ports
+*/
+
+unsigned int take_to_playback(struct meterec_s *meterec, unsigned int port) {
+
+	unsigned int take;
+
+	for ( take = meterec->n_takes + 1; take > 0; take-- )
+		if (take_has_lock(meterec, take, port))
+		break;
+
+	if (!take)
+		take = meterec->n_takes + 1;
+
+	for ( ; take > 0; take-- )
+		if (take_has_track(meterec, take, port))
+			break;
+
+	return take;
+
+}
+
+void compute_takes_to_playback(struct meterec_s *meterec) {
+
+	unsigned int port;
+
+	for ( port = 0; port < meterec->n_ports; port++ )
+		meterec->ports[port].playback_take = take_to_playback(meterec, port);
+
+}
+
+int changed_takes_to_playback(struct meterec_s *meterec) {
+
+	unsigned int port;
+
+	for ( port = 0; port < meterec->n_ports; port++ )
+		if (meterec->ports[port].playback_take != take_to_playback(meterec, port))
+			return 1;
+
+	return 0;
+
+}
+
+void compute_tracks_to_record(struct meterec_s *meterec) {
+
+	unsigned int port;
+
+	meterec->n_tracks = 0;
+
+	for ( port = 0; port < meterec->n_ports; port++ )
+		if ( meterec->ports[port].record ) {
+
+			take_set_track(meterec, meterec->n_takes+1, meterec->n_tracks, port);
+
+			meterec->n_tracks ++;
+
+		}
+
+	meterec->takes[meterec->n_takes+1].ntrack = meterec->n_tracks ;
+
+}
+
+/******************************************************************************
+** INITs
+*/
+
+void init_ports(struct meterec_s *meterec) {
+
+	meterec->n_ports = 0;
+	meterec->max_ports = 0;
+
+	meterec->ports = NULL;
+	meterec->plan = NULL;
+	meterec->span = NULL;
+	meterec->jack_in = NULL;
+	meterec->jack_out = NULL;
+
+}
+
+static void *grow_array(void *array, unsigned int old, unsigned int n, size_t size) {
+
+	char *grown;
+
+	grown = (char *) realloc(array, n * size);
+	if (!grown)
+		exit_on_error("Cannot allocate port arrays.");
+
+	memset(grown + old * size, 0, (n - old) * size);
+
+	return grown;
+}
+
+/* ports are allocated while the session is loaded, before any thread looks past n_ports */
+void alloc_ports(struct meterec_s *meterec, unsigned int n) {
+
+	unsigned int port, index, old;
+
+	old = meterec->max_ports;
+
+	if (n <= old)
+		return;
+
+	meterec->ports = grow_array(meterec->ports, old, n, sizeof(struct port_s));
+	meterec->plan = grow_array(meterec->plan, old, n, sizeof(struct plan_s));
+	meterec->span = grow_array(meterec->span, old, n, sizeof(struct span_s));
+	meterec->jack_in = grow_array(meterec->jack_in, old, n, sizeof(float *));
+	meterec->jack_out = grow_array(meterec->jack_out, old, n, sizeof(float *));
+	meterec->loop_cache.data = grow_array(meterec->loop_cache.data, old, n, sizeof(float *));
+
+	for (index=0; index<MAX_INDEX; index++)
+		meterec->cue[index].data = grow_array(meterec->cue[index].data, old, n, sizeof(float *));
+
+	for (port = old; port < n; port++) {
+
+		meterec->ports[port].monitor = OFF;
+		meterec->ports[port].record = OFF;
+		meterec->ports[port].mute = OFF;
+		meterec->ports[port].thru = OFF;
+
+		meterec->ports[port].db_out = -1.0f / 0.0f;
+		meterec->ports[port].db_in = -1.0f / 0.0f;
+		meterec->ports[port].db_max_in = -1.0f / 0.0f;
+		meterec->ports[port].db_max_out = -1.0f / 0.0f;
+
+	}
+
+	meterec->max_ports = n;
+
+}
+
+void free_ports(struct meterec_s *meterec) {
+
+	unsigned int port, con, index;
+
+	for (port = 0; port < meterec->max_ports; port++) {
+
+		free(meterec->ports[port].input_connected);
+		free(meterec->ports[port].output_connected);
+
+		for (con = 0; con < meterec->ports[port].n_cons; con++)
+			free(meterec->ports[port].connections[con]);
+
+		free(meterec->ports[port].connections);
+		free(meterec->ports[port].name);
+
+	}
+
+	disk_free_buffers(meterec);
+
+	free(meterec->ports);
+	free(meterec->plan);
+	free(meterec->span);
+	free(meterec->jack_in);
+	free(meterec->jack_out);
+	free(meterec->loop_cache.data);
+
+	for (index=0; index<MAX_INDEX; index++)
+		free(meterec->cue[index].data);
+
+}
+
+void init_takes(struct meterec_s *meterec) {
+
+	size_t len;
+
+	meterec->n_takes = 1;
+
+	/* takes are never moved as threads hold on to them, only pages touched get memory */
+	len = (size_t)MAX_TAKES * sizeof(struct take_s);
+
+	meterec->takes = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (meterec->takes == MAP_FAILED) {
+		printf("Cannot reserve %zu bytes for %d takes.\n", len, MAX_TAKES);
+		exit(1);
+	}
+
+	pthread_mutex_init(&meterec->take_mutex, NULL);
+
+}
+
+void free_takes(struct meterec_s *meterec) {
+
+	unsigned int take;
+
+	/* nothing was touched past the take beeing recorded */
+	for (take=0; take<meterec->n_takes+3 && take<MAX_TAKES; take++) {
+
+		free(meterec->takes[take].name);
+		free(meterec->takes[take].take_file);
+		free(meterec->takes[take].buf);
+		free(meterec->takes[take].track_port_map);
+		free(meterec->takes[take].port_flags);
+		free(meterec->takes[take].track_fd);
+		free(meterec->takes[take].track_map);
+
+	}
+
+	munmap(meterec->takes, (size_t)MAX_TAKES * sizeof(struct take_s));
+
+}
+
+/******************************************************************************
+** Take maps and information
+*/
+
+static void take_grow_ports(struct meterec_s *meterec, struct take_s *take, unsigned int port) {
+
+	unsigned char *flags;
+	unsigned int n;
+
+	if (port < take->n_port_flags)
+		return;
+
+	/* sized for the session ports at once, so it is not moved while others read it */
+	n = meterec->max_ports > port ? meterec->max_ports : port + 1;
+
+	flags = (unsigned char *) realloc(take->port_flags, n);
+	if (!flags)
+		exit_on_error("Cannot allocate take port flags.");
+
+	memset(flags + take->n_port_flags, 0, n - take->n_port_flags);
+
+	take->port_flags = flags;
+	__atomic_store_n(&take->n_port_flags, n, __ATOMIC_RELEASE);
+}
+
+static void take_grow_tracks(struct take_s *take, unsigned int track) {
+
+	unsigned int n, old;
+
+	if (track < take->max_track)
+		return;
+
+	old = take->max_track;
+	for (n = old ? old << 1 : 2; n <= track; n <<= 1) ;
+
+	take->track_port_map = (unsigned int *) realloc(take->track_port_map, n * sizeof(unsigned int));
+	take->track_fd = (SNDFILE **) realloc(take->track_fd, n * sizeof(SNDFILE *));
+	take->track_map = (struct wavmap_s **) realloc(take->track_map, n * sizeof(struct wavmap_s *));
+
+	if (!take->track_port_map || !take->track_fd || !take->track_map)
+		exit_on_error("Cannot allocate take track map.");
+
+	memset(take->track_port_map + old, 0, (n - old) * sizeof(unsigned int));
+	memset(take->track_fd + old, 0, (n - old) * sizeof(SNDFILE *));
+	memset(take->track_map + old, 0, (n - old) * sizeof(struct wavmap_s *));
+
+	take->max_track = n;
+}
+
+unsigned int take_has_track(struct meterec_s *meterec, unsigned int take, unsigned int port) {
+
+	struct take_s *t = &meterec->takes[take];
+
+	if (port >= __atomic_load_n(&t->n_port_flags, __ATOMIC_ACQUIRE))
+		return 0;
+
+	return t->port_flags[port] & TAKE_HAS_TRACK;
+}
+
+unsigned int take_has_lock(struct meterec_s *meterec, unsigned int take, unsigned int port) {
+
+	struct take_s *t = &meterec->takes[take];
+
+	if (port >= __atomic_load_n(&t->n_port_flags, __ATOMIC_ACQUIRE))
+		return 0;
+
+	return t->port_flags[port] & TAKE_HAS_LOCK;
+}
+
+void take_set_lock(struct meterec_s *meterec, unsigned int take, unsigned int port, unsigned int lock) {
+
+	struct take_s *t = &meterec->takes[take];
+
+	if (!lock && port >= t->n_port_flags)
+		return;
+
+	take_grow_ports(meterec, t, port);
+
+	if (lock)
+		t->port_flags[port] |= TAKE_HAS_LOCK;
+	else
+		t->port_flags[port] &= ~TAKE_HAS_LOCK;
+}
+
+void take_set_track(struct meterec_s *meterec, unsigned int take, unsigned int track, unsigned int port) {
+
+	struct take_s *t = &meterec->takes[take];
+
+	take_grow_ports(meterec, t, port);
+	take_grow_tracks(t, track);
+
+	t->track_port_map[track] = port;
+	t->port_flags[port] |= TAKE_HAS_TRACK;
+}
+
+static void take_lenght_sprint(struct take_s *take) {
+
+	struct time_s tlenght;
+
+	time_init_frm(&tlenght, take->info.samplerate, take->info.frames + take->offset);
+	time_sprint(&tlenght, take->lenght);
+}
+
+void take_set_info(struct meterec_s *meterec, unsigned int take, SF_INFO *info) {
+
+	struct take_s *t = &meterec->takes[take];
+
+	pthread_mutex_lock(&meterec->take_mutex);
+
+	t->info = *info;
+	t->info_sts = ON;
+	take_lenght_sprint(t);
+
+	pthread_mutex_unlock(&meterec->take_mutex);
+}
+
+void take_set_file(struct meterec_s *meterec, unsigned int take, char *file, unsigned int layout) {
+
+	struct take_s *t = &meterec->takes[take];
+
+	pthread_mutex_lock(&meterec->take_mutex);
+
+	free(t->take_file);
+	t->take_file = file;
+	t->layout = layout;
+
+	pthread_mutex_unlock(&meterec->take_mutex);
+}
+
+char *take_default_file(struct meterec_s *meterec, unsigned int take) {
+
+	char *file;
+
+	file = (char *) malloc( strlen(meterec->session) + strlen("_000000.") + strlen(meterec->output_ext) + 1 );
+	sprintf(file, "%s_%04d.%s", meterec->session, take, meterec->output_ext);
+
+	return file;
+}
+
+SF_INFO *take_info(struct meterec_s *meterec, unsigned int take) {
+
+	struct take_s *t = &meterec->takes[take];
+	SF_INFO info;
+	SNDFILE *fd;
+
+	if (t->info_sts)
+		return &t->info;
+
+	pthread_mutex_lock(&meterec->take_mutex);
+
+	/* only the header is read, file is opened for playback by the reader thread */
+	if (!t->info_sts && t->take_file && take <= meterec->n_takes) {
+
+		memset(&info, 0, sizeof(info));
+		fd = sf_open(t->take_file, SFM_READ, &info);
+
+		if (fd) {
+			sf_close(fd);
+			t->info = info;
+			take_lenght_sprint(t);
+		}
+
+		/* not tried again, the reader thread sets it when it opens the file */
+		t->info_sts = ON;
+	}
+
+	pthread_mutex_unlock(&meterec->take_mutex);
+
+	return &t->info;
+}
+
+void pre_option_init(struct meterec_s *meterec) {
+
+	unsigned int index;
+
+	meterec->n_tracks = 0;
+	meterec->connect_ports = 1;
+
+	meterec->jack_name = PACKAGE_NAME;
+
+	meterec->session = NULL;
+	meterec->session = (char *) malloc( strlen(PACKAGE_NAME) + 1 );
+	strcpy(meterec->session, PACKAGE_NAME);
+
+	meterec->conf_file = NULL;
+
+	meterec->monitor = NULL;
+
+	meterec->record_sts = OFF;
+	meterec->record_cmd = STOP;
+
+	meterec->playback_sts = OFF;
+	meterec->playback_cmd = START;
+
+	meterec->keyboard_cmd = START;
+
+	meterec->jack_sts = OFF;
+	meterec->curses_sts = OFF;
+	meterec->config_sts = OFF;
+	meterec->config_save = 0;
+
+	meterec->jack_transport = 1;
+
+	meterec->pos.port = 0;
+	meterec->pos.take = 0;
+	meterec->pos.inout = 0;
+	meterec->pos.con_in = 0;
+	meterec->pos.con_out = 0;
+	meterec->pos.n_con_in = 0;
+	meterec->pos.n_con_out = 0;
+
+	meterec->jack.sample_rate = 0;
+	meterec->jack.playhead = 0;
+
+	meterec->disk.playhead = 0;
+	meterec->disk.window = 0;
+	meterec->n_span = 0;
+
+	meterec->all_input_ports = NULL;
+	meterec->all_output_ports = NULL;
+
+	meterec->client = NULL;
+	meterec->fd_log = NULL;
+	meterec->log.running = 0;
+
+	stats_init(&meterec->stats);
+	meterec->stats_file = NULL;
+	meterec->takes_file = NULL;
+
+	meterec->write_disk_buffer_thread_pos = 0;
+	meterec->write_disk_buffer_process_pos = 0;
+	meterec->write_disk_buffer_overflow = 0;
+
+	meterec->rollover.pending = 0;
+	meterec->rollover.buffer_pos = 0;
+	meterec->rollover.playhead = 0;
+
+	meterec->read_disk_buffer_thread_pos = 1; /* Hum... Would be better to rework thread loop... */
+	meterec->read_disk_buffer_process_pos = 0;
+	meterec->read_disk_buffer_overflow = 0;
+
+	meterec->dbuf_ms = 0;
+	meterec->dbuf_ms_opt = 0;
+	meterec->output_layout = TAKE_INTERLEAVED;
+	meterec->take_expect_s = 0;
+	meterec->checkpoint_s = 0;
+	meterec->loop_cache_s = LOOP_CACHE_SEC;
+	meterec->loop_fade_ms = 0;
+	meterec->cue_ms = CUE_CACHE_MS;
+	meterec->preload = 0;
+	meterec->preload_opt = 0;
+	meterec->preload_mb = PRELOAD_MB;
+	meterec->preload_bytes = 0;
+	meterec->preload_job = NULL;
+	meterec->dbuf_size = DBUF_MIN;
+	meterec->dbuf_arena = NULL;
+	meterec->dbuf_arena_len = 0;
+
+	for (index=0; index<MAX_INDEX; index++) {
+		meterec->seek_index[index] = MAX_FRAME;
+
+		meterec->cue[index].pos = MAX_FRAME;
+		meterec->cue[index].frames = 0;
+		meterec->cue[index].stale = 0;
+		meterec->cue[index].mem = NULL;
+		meterec->cue[index].data = NULL;
+	}
+
+	meterec->loop.low = MAX_FRAME;
+	meterec->loop.high = MAX_FRAME;
+	meterec->loop.enable = 0;
+
+	meterec->loop_cache.ready = 0;
+	meterec->loop_cache.active = 0;
+	meterec->loop_cache.stale = 0;
+	meterec->loop_cache.low = MAX_FRAME;
+	meterec->loop_cache.high = MAX_FRAME;
+	meterec->loop_cache.fade = 0;
+	meterec->loop_cache.start = 0;
+	meterec->loop_cache.frames = 0;
+	meterec->loop_cache.done = 0;
+	meterec->loop_cache.mem = NULL;
+	meterec->loop_cache.len = 0;
+	meterec->loop_cache.data = NULL;
+
+	meterec->display.view = VU_IN;
+	meterec->display.pre_view = NONE;
+	meterec->display.names = ON;
+	meterec->display.width = 0;
+	meterec->display.take_first = 1;
+	meterec->display.rate = 24;
+	meterec->display.needs_update = 0;
+	meterec->display.needed_update = 0;
+
+	meterec->event = NULL;
+	pthread_mutex_init(&meterec->event_mutex, NULL);
+
+	event_ring_init(&meterec->jack_ring);
+	event_ring_init(&meterec->disk_ring);
+
+	for (index=0; index<MAX_EVENT_TYPES; index++)
+		meterec->event_pending[index] = 0;
+
+	thread_wake_init(&meterec->reader_wake);
+	thread_wake_init(&meterec->writer_wake);
+}
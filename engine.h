@@ -0,0 +1,42 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+unsigned int take_to_playback(struct meterec_s *meterec, unsigned int port);
+void compute_takes_to_playback(struct meterec_s *meterec);
+void compute_tracks_to_record(struct meterec_s *meterec);
+int changed_takes_to_playback(struct meterec_s *meterec);
+
+void init_ports(struct meterec_s *meterec);
+void alloc_ports(struct meterec_s *meterec, unsigned int n);
+void free_ports(struct meterec_s *meterec);
+void init_takes(struct meterec_s *meterec);
+void free_takes(struct meterec_s *meterec);
+unsigned int take_has_track(struct meterec_s *meterec, unsigned int take, unsigned int port);
+unsigned int take_has_lock(struct meterec_s *meterec, unsigned int take, unsigned int port);
+void take_set_lock(struct meterec_s *meterec, unsigned int take, unsigned int port, unsigned int lock);
+void take_set_track(struct meterec_s *meterec, unsigned int take, unsigned int track, unsigned int port);
+void take_set_info(struct meterec_s *meterec, unsigned int take, SF_INFO *info);
+SF_INFO *take_info(struct meterec_s *meterec, unsigned int take);
+void take_set_file(struct meterec_s *meterec, unsigned int take, char *file, unsigned int layout);
+char *take_default_file(struct meterec_s *meterec, unsigned int take);
+void pre_option_init(struct meterec_s *meterec);
@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <signal.h>
+#include <semaphore.h>
 
 #include <sndfile.h>
 #include <jack/jack.h>
@@ -37,12 +38,14 @@
 #include "config.h"
 #include "position.h"
 #include "meterec.h"
+#include "log.h"
 #include "display.h"
 #include "disk.h"
 #include "conf.h"
 #include "ports.h"
 #include "queue.h"
 #include "keyboard.h"
+#include "engine.h"
 
 char* realloc_freetext(char **name)
 {
@@ -65,14 +68,15 @@ char* realloc_freetext(char **name)
 void *keyboard_thread(void *arg) {
 
 	struct meterec_s *meterec ;
-	struct event_s *event ;
-	unsigned int y_pos, x_pos, port, take;
+	unsigned int y_pos, x_pos, port, take, seeking;
 	int key = 0;
 	int freetext = 0;
 	char *text = NULL;
 
 	meterec = (struct meterec_s *)arg ;
 
+	log_thread(meterec, LOG_KEYBOARD);
+
 	noecho();
 	cbreak();
 	nodelay(stdscr, FALSE);
@@ -82,7 +86,7 @@ void *keyboard_thread(void *arg) {
 
 		key = wgetch(stdscr);
 
-		fprintf(meterec->fd_log, "Key pressed: 0%03o %4d '%s'\n", key, key, keyname(key));
+		log_info(meterec, "Key pressed: 0%03o %4d '%s'\n", key, key, keyname(key));
 
 		y_pos = meterec->pos.port;
 		x_pos = meterec->pos.take;
@@ -149,21 +153,19 @@ void *keyboard_thread(void *arg) {
 			/*
 			** Change Locks
 			*/
-			event = find_first_event(meterec, ALL, LOCK);
-
-			if (!event) {
+			if (!event_pending(meterec, LOCK)) {
 
 				switch (key) {
 					case 'l' : /* clear all other locks for that port & process with toggle */
 						for ( take=0 ; take < meterec->n_takes+1 ; take++)
-							meterec->takes[take].port_has_lock[y_pos] = 0 ;
+							take_set_lock(meterec, take, y_pos, 0);
 
 					case 'L' : /* toggle lock at this position */
-						meterec->takes[x_pos].port_has_lock[y_pos] = !meterec->takes[x_pos].port_has_lock[y_pos] ;
+						take_set_lock(meterec, x_pos, y_pos, !take_has_lock(meterec, x_pos, y_pos));
 
 						if (changed_takes_to_playback(meterec)) {
 							pthread_mutex_lock( &meterec->event_mutex );
-							add_event(meterec, DISK, LOCK, MAX_UINT, meterec->jack.playhead, MAX_UINT);
+							add_event(meterec, DISK, LOCK, MAX_FRAME, meterec->jack.playhead, MAX_UINT);
 							pthread_mutex_unlock( &meterec->event_mutex );
 						}
 						break;
@@ -171,19 +173,19 @@ void *keyboard_thread(void *arg) {
 					case 'a' : /* clear all other locks & process with toggle */
 						for ( port=0 ; port < meterec->n_ports ; port++)
 							for ( take=0 ; take < meterec->n_takes+1 ; take++)
-								meterec->takes[take].port_has_lock[port] = 0 ;
+								take_set_lock(meterec, take, port, 0);
 
 					case 'A' : /* toggle lock for all ports depending on this position */
-						if ( meterec->takes[x_pos].port_has_lock[y_pos] )
+						if ( take_has_lock(meterec, x_pos, y_pos) )
 							for ( port=0 ; port < meterec->n_ports ; port++)
-								meterec->takes[x_pos].port_has_lock[port] = 0;
+								take_set_lock(meterec, x_pos, port, 0);
 						else
 							for ( port=0 ; port < meterec->n_ports ; port++)
-								meterec->takes[x_pos].port_has_lock[port] = 1;
+								take_set_lock(meterec, x_pos, port, 1);
 
 						if (changed_takes_to_playback(meterec)) {
 							pthread_mutex_lock( &meterec->event_mutex );
-							add_event(meterec, DISK, LOCK, MAX_UINT, meterec->jack.playhead, MAX_UINT);
+							add_event(meterec, DISK, LOCK, MAX_FRAME, meterec->jack.playhead, MAX_UINT);
 							pthread_mutex_unlock( &meterec->event_mutex );
 						}
 						break;
@@ -194,7 +196,7 @@ void *keyboard_thread(void *arg) {
 			break;
 		case VU_IN:
 		case VU_OUT:
-			event = find_first_event(meterec, ALL, SEEK);
+			seeking = event_pending(meterec, SEEK);
 
 			switch (key) {
 				/* reset absolute maximum markers */
@@ -209,24 +211,24 @@ void *keyboard_thread(void *arg) {
 					break;
 
 				case KEY_LEFT:
-					if (!meterec->record_sts && !event) {
+					if (!meterec->record_sts && !seeking) {
 						if (meterec->jack_transport)
 							jack_transport_locate(meterec->client, seek(meterec,-5));
 						else {
 							pthread_mutex_lock( &meterec->event_mutex );
-							add_event(meterec, DISK, SEEK, MAX_UINT, seek(meterec,-5), MAX_UINT);
+							add_event(meterec, DISK, SEEK, MAX_FRAME, seek(meterec,-5), MAX_UINT);
 							pthread_mutex_unlock( &meterec->event_mutex );
 						}
 					}
 					break;
 
 				case KEY_RIGHT:
-					if (!meterec->record_sts && !event) {
+					if (!meterec->record_sts && !seeking) {
 						if (meterec->jack_transport)
 							jack_transport_locate(meterec->client, seek(meterec,5));
 						else {
 							pthread_mutex_lock( &meterec->event_mutex );
-							add_event(meterec, DISK, SEEK, MAX_UINT, seek(meterec,5), MAX_UINT);
+							add_event(meterec, DISK, SEEK, MAX_FRAME, seek(meterec,5), MAX_UINT);
 							pthread_mutex_unlock( &meterec->event_mutex );
 						}
 					}
@@ -467,6 +469,9 @@ void *keyboard_thread(void *arg) {
 					meterec->display.view = PORT;
 
 				else if (meterec->display.view == PORT)
+					meterec->display.view = STATS;
+
+				else if (meterec->display.view == STATS)
 					meterec->display.view = VU_IN;
 
 				break;
@@ -475,7 +480,7 @@ void *keyboard_thread(void *arg) {
 				if (meterec->playback_sts == ONGOING) {
 					stop(meterec);
 					pthread_mutex_lock( &meterec->event_mutex );
-					add_event(meterec, DISK, NEWT, MAX_UINT, meterec->jack.playhead, MAX_UINT);
+					add_event(meterec, DISK, NEWT, MAX_FRAME, meterec->jack.playhead, MAX_UINT);
 					pthread_mutex_unlock( &meterec->event_mutex );
 				} else {
                                     if (meterec->record_sts == OFF)
@@ -488,7 +493,7 @@ void *keyboard_thread(void *arg) {
 			case 127: /* BACKSPACE */
 			case 263: /* BACKSPACE */
 				if (meterec->record_sts == ONGOING && meterec->playback_sts == ONGOING)
-					meterec->record_cmd = RESTART;
+					__atomic_store_n(&meterec->record_cmd, RESTART, __ATOMIC_RELEASE);
 				else if (meterec->record_sts == OFF && meterec->playback_sts == OFF)
 					start_record(meterec);
 				else if (meterec->record_sts == ONGOING && meterec->playback_sts == OFF)
@@ -520,7 +525,7 @@ void *keyboard_thread(void *arg) {
 					is already processing the data,
 					so let's seek to the begining of the loop ourselves */
 					pthread_mutex_lock( &meterec->event_mutex );
-					add_event(meterec, DISK, SEEK, MAX_UINT, meterec->loop.low, MAX_UINT);
+					add_event(meterec, DISK, SEEK, MAX_FRAME, meterec->loop.low, MAX_UINT);
 					pthread_mutex_unlock( &meterec->event_mutex );
 				}
 				break;
@@ -540,14 +545,14 @@ void *keyboard_thread(void *arg) {
 		/* set loop using CONTROL */
 		if ( KEY_F(25) <= key && key <= KEY_F(36) ) {
 			/* store index before setting loop if index is free */
-			if (meterec->seek_index[key - KEY_F(25)] == MAX_UINT) {
+			if (meterec->seek_index[key - KEY_F(25)] == MAX_FRAME) {
 				meterec->seek_index[key - KEY_F(25)] = meterec->jack.playhead ;
 				if (set_loop(meterec, meterec->jack.playhead)) {
 					/* The disk tread cannot be aware of this loop as it
 					is already processing the data,
 					so let's seek to the begining of the loop ourselves */
 					pthread_mutex_lock( &meterec->event_mutex );
-					add_event(meterec, DISK, SEEK, MAX_UINT, meterec->loop.low, MAX_UINT);
+					add_event(meterec, DISK, SEEK, MAX_FRAME, meterec->loop.low, MAX_UINT);
 					pthread_mutex_unlock( &meterec->event_mutex );
 				}
 			}
@@ -555,17 +560,17 @@ void *keyboard_thread(void *arg) {
 				set_loop(meterec, meterec->seek_index[key - KEY_F(25)]);
 		}
 		/* seek to index */
-		event = find_first_event(meterec, ALL, SEEK);
-		if (!meterec->record_sts && !event) {
+		seeking = event_pending(meterec, SEEK);
+		if (!meterec->record_sts && !seeking) {
 
 			if ( KEY_F(1) <= key && key <= KEY_F(12) ) {
-				if (meterec->seek_index[key - KEY_F(1)] != MAX_UINT) {
-					jack_nframes_t pos = meterec->seek_index[key - KEY_F(1)];
+				if (meterec->seek_index[key - KEY_F(1)] != MAX_FRAME) {
+					unsigned long long pos = meterec->seek_index[key - KEY_F(1)];
 					if (meterec->jack_transport)
 						jack_transport_locate(meterec->client, pos);
 					else {
 						pthread_mutex_lock( &meterec->event_mutex );
-						add_event(meterec, DISK, SEEK, MAX_UINT, pos, MAX_UINT);
+						add_event(meterec, DISK, SEEK, MAX_FRAME, pos, MAX_UINT);
 						pthread_mutex_unlock( &meterec->event_mutex );
 					}
 				}
@@ -576,7 +581,7 @@ void *keyboard_thread(void *arg) {
 					jack_transport_locate(meterec->client, 0);
 				else {
 					pthread_mutex_lock( &meterec->event_mutex );
-					add_event(meterec, DISK, SEEK, MAX_UINT, 0, MAX_UINT);
+					add_event(meterec, DISK, SEEK, MAX_FRAME, 0, MAX_UINT);
 					pthread_mutex_unlock( &meterec->event_mutex );
 				}
 			}
@@ -0,0 +1,182 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include <curses.h>
+#include <sndfile.h>
+#include <jack/jack.h>
+
+#include "config.h"
+#include "meterec.h"
+#include "queue.h"
+#include "log.h"
+
+/* how often the logger thread drains the rings, usec */
+#define LOG_DELAY 20000
+
+/* ring of the calling thread, NULL for threads logging directly */
+static __thread struct log_ring_s *log_ring = NULL;
+
+/******************************************************************************
+** PRODUCERS
+*/
+
+/* call once from a thread that may log while jack process runs */
+void log_thread(struct meterec_s *meterec, unsigned int ring) {
+
+	log_ring = &meterec->log.ring[ring];
+}
+
+/* no lock, no allocation: safe from the jack process */
+void log_printf(struct meterec_s *meterec, unsigned int level, const char *fmt, ...) {
+
+	struct log_ring_s *ring = log_ring;
+	struct log_entry_s *slot;
+	unsigned int write;
+	va_list ap;
+
+	va_start(ap, fmt);
+
+	if (!ring || !__atomic_load_n(&meterec->log.running, __ATOMIC_ACQUIRE)) {
+		if (meterec->fd_log)
+			vfprintf(meterec->fd_log, fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	write = ring->write;
+
+	if (write - __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+		__atomic_store_n(&ring->lost, ring->lost + 1, __ATOMIC_RELEASE);
+		va_end(ap);
+		return;
+	}
+
+	slot = &ring->slot[write & (LOG_RING_SIZE - 1)];
+	slot->level = level;
+	vsnprintf(slot->msg, LOG_MSG_LEN, fmt, ap);
+
+	__atomic_store_n(&ring->write, write + 1, __ATOMIC_RELEASE);
+
+	va_end(ap);
+}
+
+/******************************************************************************
+** LOGGER
+*/
+
+static unsigned int log_drain(struct meterec_s *meterec) {
+
+	struct log_ring_s *ring;
+	struct log_entry_s *slot;
+	unsigned int i, read, write, lost, n = 0;
+	size_t len;
+
+	for (i = 0; i < LOG_RINGS; i++) {
+
+		ring = &meterec->log.ring[i];
+
+		write = __atomic_load_n(&ring->write, __ATOMIC_ACQUIRE);
+
+		for (read = ring->read; read != write; read++, n++) {
+
+			slot = &ring->slot[read & (LOG_RING_SIZE - 1)];
+			fputs(slot->msg, meterec->fd_log);
+
+			/* vsnprintf cut the message */
+			len = strlen(slot->msg);
+			if (len == LOG_MSG_LEN - 1 && slot->msg[len - 1] != '\n')
+				fputs("...\n", meterec->fd_log);
+
+			__atomic_store_n(&ring->read, read + 1, __ATOMIC_RELEASE);
+		}
+
+		lost = __atomic_load_n(&ring->lost, __ATOMIC_ACQUIRE);
+		if (lost != ring->reported) {
+			fprintf(meterec->fd_log, "Logger thread: %d message(s) lost.\n", lost - ring->reported);
+			ring->reported = lost;
+			n++;
+		}
+	}
+
+	if (n)
+		fflush(meterec->fd_log);
+
+	return n;
+}
+
+static void *logger_thread(void *d) {
+
+	struct meterec_s *meterec = (struct meterec_s *)d;
+
+#ifdef SCHED_IDLE
+	/* only run when nothing else wants the CPU */
+	struct sched_param param;
+
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+	while (__atomic_load_n(&meterec->log.running, __ATOMIC_ACQUIRE)) {
+		thread_wait(&meterec->log.wake, LOG_DELAY);
+		log_drain(meterec);
+	}
+
+	return (void*)0;
+}
+
+void log_start(struct meterec_s *meterec) {
+
+	if (!meterec->fd_log || meterec->log.running)
+		return;
+
+	memset(meterec->log.ring, 0, sizeof(meterec->log.ring));
+	thread_wake_init(&meterec->log.wake);
+
+	__atomic_store_n(&meterec->log.running, 1, __ATOMIC_RELEASE);
+
+	if (pthread_create(&meterec->log.thread, NULL, logger_thread, (void *)meterec))
+		__atomic_store_n(&meterec->log.running, 0, __ATOMIC_RELEASE);
+}
+
+/* back to direct writes, with whatever was queued written out */
+void log_stop(struct meterec_s *meterec) {
+
+	if (!meterec->log.running)
+		return;
+
+	__atomic_store_n(&meterec->log.running, 0, __ATOMIC_RELEASE);
+	thread_wake(&meterec->log.wake);
+	pthread_join(meterec->log.thread, NULL);
+
+	log_drain(meterec);
+}
@@ -0,0 +1,45 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+/* log levels */
+#define LOG_ERROR 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+
+/* messages above this level are compiled out */
+#ifndef LOG_LEVEL
+#if defined(DEBUG_BUFF) || defined(DEBUG_SEEK) || defined(DEBUG_QUEUES)
+#define LOG_LEVEL LOG_DEBUG
+#else
+#define LOG_LEVEL LOG_INFO
+#endif
+#endif
+
+#define log_error(meterec, ...) log_printf(meterec, LOG_ERROR, __VA_ARGS__)
+#define log_info(meterec, ...)  do { if (LOG_INFO <= LOG_LEVEL) log_printf(meterec, LOG_INFO, __VA_ARGS__); } while (0)
+#define log_debug(meterec, ...) do { if (LOG_DEBUG <= LOG_LEVEL) log_printf(meterec, LOG_DEBUG, __VA_ARGS__); } while (0)
+
+void log_printf(struct meterec_s *meterec, unsigned int level, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+void log_thread(struct meterec_s *meterec, unsigned int ring);
+void log_start(struct meterec_s *meterec);
+void log_stop(struct meterec_s *meterec);
@@ -22,12 +22,12 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <dirent.h>
 #include <math.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <signal.h>
+#include <semaphore.h>
 
 #include <sndfile.h>
 #include <jack/jack.h>
@@ -43,6 +43,12 @@
 #include "ports.h"
 #include "queue.h"
 #include "keyboard.h"
+#include "dsp.h"
+#include "process.h"
+#include "engine.h"
+#include "log.h"
+#include "stats.h"
+#include "takes.h"
 
 #ifdef HAVE_JACK_SESSION_H
 #include <jack/session.h>
@@ -123,8 +129,10 @@ static void cleanup() {
 
 	running = 0;
 
-	if (meterec->disk_sts)
-		meterec->disk_cmd = OFF;
+	if (meterec->disk_sts) {
+		__atomic_store_n(&meterec->disk_cmd, OFF, __ATOMIC_RELEASE);
+		thread_wake(&meterec->reader_wake);
+	}
 
 	if (meterec->curses_sts)
 		display_cleanup_curses(meterec);
@@ -138,9 +146,18 @@ static void cleanup() {
 	if (wr_dt)
 		pthread_join(wr_dt, NULL);
 
+	/* takes recorded or first read during this run */
+	if (meterec->config_sts && meterec->takes_file)
+		takes_cache_write(meterec);
+
 	if (meterec->jack_sts)
 		cleanup_jack(meterec);
 
+	if (meterec->stats.file_s && meterec->stats_file)
+		stats_write(meterec, meterec->stats_file);
+
+	log_stop(meterec);
+
 	if (meterec->fd_log)
 		fclose(meterec->fd_log);
 
@@ -199,13 +216,13 @@ void read_peak(float bias) {
 
 }
 
-int set_loop(struct meterec_s *meterec, unsigned int loophead) {
+int set_loop(struct meterec_s *meterec, unsigned long long loophead) {
 
 	if (meterec->jack_transport)
         return 0;
 
-	if (meterec->loop.low == MAX_UINT) {
-		if (meterec->loop.high == MAX_UINT) {
+	if (meterec->loop.low == MAX_FRAME) {
+		if (meterec->loop.high == MAX_FRAME) {
 			meterec->loop.low = loophead;
 			return 0;
 		}
@@ -239,290 +256,17 @@ void clr_loop(struct meterec_s *meterec, unsigned int bound) {
 	meterec->loop.enable = 0;
 
 	if (bound & BOUND_LOW)
-		meterec->loop.low = MAX_UINT;
+		meterec->loop.low = MAX_FRAME;
 
 	if (bound & BOUND_HIGH)
-		meterec->loop.high = MAX_UINT;
+		meterec->loop.high = MAX_FRAME;
 
 	pthread_mutex_lock( &meterec->event_mutex );
-	add_event(meterec, DISK, LOOP, MAX_UINT, MAX_UINT, MAX_UINT);
+	add_event(meterec, DISK, LOOP, MAX_FRAME, MAX_FRAME, MAX_UINT);
 	pthread_mutex_unlock( &meterec->event_mutex );
 
 }
 
-/******************************************************************************
-** Takes and ports
-*/
-
-unsigned int take_to_playback(struct meterec_s *meterec, unsigned int port) {
-
-	unsigned int take;
-
-	for ( take = meterec->n_takes + 1; take > 0; take-- )
-		if (meterec->takes[take].port_has_lock[port])
-		break;
-
-	if (!take)
-		take = meterec->n_takes + 1;
-
-	for ( ; take > 0; take-- )
-		if (meterec->takes[take].port_has_track[port])
-			break;
-
-	return take;
-
-}
-
-void compute_takes_to_playback(struct meterec_s *meterec) {
-
-	unsigned int port;
-
-	for ( port = 0; port < meterec->n_ports; port++ )
-		meterec->ports[port].playback_take = take_to_playback(meterec, port);
-
-}
-
-int changed_takes_to_playback(struct meterec_s *meterec) {
-
-	unsigned int port;
-
-	for ( port = 0; port < meterec->n_ports; port++ )
-		if (meterec->ports[port].playback_take != take_to_playback(meterec, port))
-			return 1;
-
-	return 0;
-
-}
-
-void compute_tracks_to_record(struct meterec_s *meterec) {
-
-	unsigned int port;
-
-	meterec->n_tracks = 0;
-
-	for ( port = 0; port < meterec->n_ports; port++ )
-		if ( meterec->ports[port].record ) {
-
-			meterec->takes[meterec->n_takes+1].port_has_track[port] = 1;
-			meterec->takes[meterec->n_takes+1].track_port_map[meterec->n_tracks] = port ;
-
-			meterec->n_tracks ++;
-
-		}
-
-	meterec->takes[meterec->n_takes+1].ntrack = meterec->n_tracks ;
-
-}
-
-/******************************************************************************
-** INITs
-*/
-
-void init_ports(struct meterec_s *meterec) {
-
-	unsigned int port, con;
-
-	meterec->n_ports = 0;
-
-	for (port = 0; port < MAX_PORTS; port++) {
-
-		meterec->ports[port].input = NULL;
-		meterec->ports[port].output = NULL;
-
-		meterec->ports[port].input_connected = NULL;
-		meterec->ports[port].output_connected = NULL;
-
-		meterec->ports[port].n_cons = 0;
-		for (con = 0; con < MAX_CONS; con++)
-			meterec->ports[port].connections[con] = NULL;
-
-		meterec->ports[port].name = NULL;
-
-		meterec->ports[port].write_disk_buffer = NULL;
-		meterec->ports[port].read_disk_buffer = NULL;
-		meterec->ports[port].monitor = OFF;
-		meterec->ports[port].record = OFF;
-		meterec->ports[port].mute = OFF;
-		meterec->ports[port].thru = OFF;
-
-		meterec->ports[port].peak_out = 0.0f;
-		meterec->ports[port].db_out = -1.0f / 0.0f;
-
-		meterec->ports[port].peak_in = 0.0f;
-		meterec->ports[port].db_in = -1.0f / 0.0f;
-
-		meterec->ports[port].max_in = 0.0f;
-		meterec->ports[port].db_max_in = -1.0f / 0.0f;
-
-		meterec->ports[port].max_out = 0.0f;
-		meterec->ports[port].db_max_out = -1.0f / 0.0f;
-
-		meterec->ports[port].dkpeak_in = 0;
-		meterec->ports[port].dktime_in = 0;
-		meterec->ports[port].dkmax_in = 0;
-
-		meterec->ports[port].dkpeak_out = 0;
-		meterec->ports[port].dktime_out = 0;
-		meterec->ports[port].dkmax_out = 0;
-
-		meterec->ports[port].clip_in = 0;
-		meterec->ports[port].clip_out = 0;
-
-		meterec->ports[port].playback_take = 0;
-
-	}
-
-}
-
-void free_ports(struct meterec_s *meterec) {
-
-	unsigned int port, con;
-
-	for (port = 0; port < MAX_PORTS; port++) {
-
-		free(meterec->ports[port].input_connected);
-		free(meterec->ports[port].output_connected);
-
-		for (con = 0; con < meterec->ports[port].n_cons; con++)
-			free(meterec->ports[port].connections[con]);
-
-		free(meterec->ports[port].name);
-
-		free(meterec->ports[port].write_disk_buffer);
-		free(meterec->ports[port].read_disk_buffer);
-
-	}
-
-}
-
-void init_takes(struct meterec_s *meterec) {
-
-	unsigned int port, take, track ;
-
-	meterec->n_takes = 1;
-
-	for (take=0; take<MAX_TAKES; take++) {
-
-		meterec->takes[take].name = NULL;
-		meterec->takes[take].lenght = NULL;
-		meterec->takes[take].take_file = NULL;
-		meterec->takes[take].take_fd = NULL;
-		meterec->takes[take].buf = NULL;
-		meterec->takes[take].info.format = 0;
-
-		meterec->takes[take].ntrack = 0;
-
-		meterec->takes[take].lenght = (char *) malloc(20);
-		time_null_sprint(meterec->takes[take].lenght);
-
-		meterec->takes[take].offset = 0;
-
-		for (track=0; track<MAX_TRACKS; track++) {
-			meterec->takes[take].track_port_map[track] = 0;
-		}
-
-		for (port=0; port<MAX_PORTS; port++) {
-			meterec->takes[take].port_has_track[port] = 0;
-			meterec->takes[take].port_has_lock[port] = 0;
-		}
-
-	}
-
-}
-
-void free_takes(struct meterec_s *meterec) {
-
-	unsigned int take;
-
-	for (take=0; take<MAX_TAKES; take++) {
-
-		free(meterec->takes[take].name);
-		free(meterec->takes[take].take_file);
-		free(meterec->takes[take].take_fd);
-		free(meterec->takes[take].buf);
-		free(meterec->takes[take].lenght);
-
-	}
-
-}
-
-void pre_option_init(struct meterec_s *meterec) {
-
-	unsigned int index;
-
-	meterec->n_tracks = 0;
-	meterec->connect_ports = 1;
-
-	meterec->jack_name = PACKAGE_NAME;
-
-	meterec->session = NULL;
-	meterec->session = (char *) malloc( strlen(PACKAGE_NAME) + 1 );
-	strcpy(meterec->session, PACKAGE_NAME);
-
-	meterec->conf_file = NULL;
-
-	meterec->monitor = NULL;
-
-	meterec->record_sts = OFF;
-	meterec->record_cmd = STOP;
-
-	meterec->playback_sts = OFF;
-	meterec->playback_cmd = START;
-
-	meterec->keyboard_cmd = START;
-
-	meterec->jack_sts = OFF;
-	meterec->curses_sts = OFF;
-	meterec->config_sts = OFF;
-
-	meterec->jack_transport = 1;
-
-	meterec->pos.port = 0;
-	meterec->pos.take = 0;
-	meterec->pos.inout = 0;
-	meterec->pos.con_in = 0;
-	meterec->pos.con_out = 0;
-	meterec->pos.n_con_in = 0;
-	meterec->pos.n_con_out = 0;
-
-	meterec->jack.sample_rate = 0;
-	meterec->jack.playhead = 0;
-
-	meterec->disk.playhead = 0;
-
-	meterec->all_input_ports = NULL;
-	meterec->all_output_ports = NULL;
-
-	meterec->client = NULL;
-	meterec->fd_log = NULL;
-
-	meterec->write_disk_buffer_thread_pos = 0;
-	meterec->write_disk_buffer_process_pos = 0;
-	meterec->write_disk_buffer_overflow = 0;
-
-	meterec->read_disk_buffer_thread_pos = 1; /* Hum... Would be better to rework thread loop... */
-	meterec->read_disk_buffer_process_pos = 0;
-	meterec->read_disk_buffer_overflow = 0;
-
-	for (index=0; index<MAX_INDEX; index++)
-		meterec->seek_index[index] = MAX_UINT;
-
-	meterec->loop.low = MAX_UINT;
-	meterec->loop.high = MAX_UINT;
-	meterec->loop.enable = 0;
-
-	meterec->display.view = VU_IN;
-	meterec->display.pre_view = NONE;
-	meterec->display.names = ON;
-	meterec->display.width = 0;
-	meterec->display.rate = 24;
-	meterec->display.needs_update = 0;
-	meterec->display.needed_update = 0;
-
-	meterec->event = NULL;
-	pthread_mutex_init(&meterec->event_mutex, NULL);
-}
-
 void free_options(struct meterec_s *meterec) {
 
 	free(meterec->all_input_ports);
@@ -532,6 +276,8 @@ void free_options(struct meterec_s *meterec) {
 	free(meterec->setup_file);
 	free(meterec->conf_file);
 	free(meterec->log_file);
+	free(meterec->stats_file);
+	free(meterec->takes_file);
 	free(meterec->output_ext);
 
 }
@@ -620,42 +366,6 @@ void resolve_conf_file(struct meterec_s *meterec, char *conf_file) {
 	free(conf_file_test);
 }
 
-int find_take_name(char *session, unsigned int take, char **name) {
-
-	struct dirent *entry;
-	DIR *dp;
-	char *current = ".";
-	char *pattern;
-
-	pattern = (char *) malloc( strlen(session) + strlen("_0000.") + 1 );
-	sprintf(pattern,"%s_%04d.", session, take);
-
-	dp = opendir(current);
-
-	if (dp == NULL) {
-		perror("opendir");
-		return 0;
-	}
-
-	while((entry = readdir(dp)))
-		if (strncmp(entry->d_name, pattern, strlen(pattern)) == 0) {
-
-			*name = (char *) malloc( strlen(entry->d_name) + 1);
-			strcpy(*name, entry->d_name);
-
-			closedir(dp);
-			free(pattern);
-
-			return 1;
-		}
-
-	closedir(dp);
-	free(pattern);
-
-	return 0;
-
-}
-
 void post_option_init(struct meterec_s *meterec) {
 
 	char *session;
@@ -671,6 +381,12 @@ void post_option_init(struct meterec_s *meterec) {
 	meterec->log_file = (char *) malloc( strlen(session) + strlen(".log") + 1 );
 	sprintf(meterec->log_file,"%s.log",session);
 
+	meterec->stats_file = (char *) malloc( strlen(session) + strlen(".stats") + 1 );
+	sprintf(meterec->stats_file,"%s.stats",session);
+
+	meterec->takes_file = (char *) malloc( strlen(session) + strlen(".takes") + 1 );
+	sprintf(meterec->takes_file,"%s.takes",session);
+
 	meterec->output_ext = (char *) malloc( strlen(output_ext) + 1 );
 	sprintf(meterec->output_ext,"%s",output_ext);
 
@@ -704,45 +420,24 @@ void post_option_init(struct meterec_s *meterec) {
 
 }
 
-void find_existing_takes(struct meterec_s *meterec) {
-
-	unsigned int take;
-	struct time_s tlenght;
-
-	/* this needs to be moved at config file reading time and file creation time */
-	for (take=1; take<MAX_TAKES; take++) {
-
-		if ( find_take_name(meterec->session, take, &meterec->takes[take].take_file) ) {
-			fprintf(meterec->fd_log, "Found existing file '%s' for take %d\n", meterec->takes[take].take_file, take);
-
-			meterec->takes[take].take_fd = sf_open(
-				meterec->takes[take].take_file,
-				SFM_READ,
-				&meterec->takes[take].info);
+/******************************************************************************
+** JACK callback process
+*/
+/* jack process thread logs through its own ring */
+static void jack_thread_init(void *arg) {
 
-			if (meterec->takes[take].take_fd) {
+	log_thread((struct meterec_s *)arg, LOG_PROCESS);
+}
 
-				time_init_frm(&tlenght,
-					meterec->takes[take].info.samplerate,
-					meterec->takes[take].info.frames + meterec->takes[take].offset);
+static int jack_xrun(void *arg) {
 
-				time_sprint(&tlenght, meterec->takes[take].lenght);
+	struct meterec_s *meterec = (struct meterec_s *)arg;
 
-				sf_close(meterec->takes[take].take_fd);
-				meterec->takes[take].take_fd = NULL;
-			}
+	stats_xrun(meterec, jack_get_xrun_delayed_usecs(meterec->client));
 
-		}
-		else {
-			meterec->takes[take].take_file = (char *) malloc( strlen(meterec->session) + strlen("_0000.????") + 1 );
-			sprintf(meterec->takes[take].take_file, "%s_%04d.%s", meterec->session, take, meterec->output_ext);
-		}
-	}
+	return 0;
 }
 
-/******************************************************************************
-** JACK callback process
-*/
 static int update_jack_buffsize(jack_nframes_t nframes, void *arg) {
 
 	struct meterec_s *meterec ;
@@ -782,12 +477,9 @@ static int jack_sync_callback(jack_transport_state_t state, jack_position_t *pos
 	struct meterec_s *meterec ;
 	meterec = (struct meterec_s *)arg ;
 
-    /* A seek disk event means we are about to reload data for new location */
-    if (find_first_event(meterec, DISK, SEEK))
-	    return false;
-
-    /* A seek pending event means we are busy rebuffering after a relocation a*/
-    if (find_first_event(meterec, PEND, SEEK))
+    /* A seek event in flight means we are about to reload or busy rebuffering
+       data for a new location */
+    if (event_pending(meterec, SEEK))
 	    return false;
 
     return true;
@@ -797,239 +489,39 @@ static int jack_sync_callback(jack_transport_state_t state, jack_position_t *pos
 /* Callback called by JACK when audio is available. */
 static int process_jack_data(jack_nframes_t nframes, void *arg) {
 
-	jack_default_audio_sample_t *in, *out, *mon=NULL;
+	struct process_io_s io;
 	jack_position_t pos;
-	static jack_transport_state_t transport_state=JackTransportStopped, previous_transport_state;
-	unsigned int i, port, write_pos, read_pos, remaining_write_disk_buffer, remaining_read_disk_buffer;
-	unsigned int playback_ongoing;
-	static unsigned int record_ongoing;
-	float s;
+	unsigned int port;
 	struct meterec_s *meterec ;
-	struct event_s *event;
-
-        int mute;
 
 	meterec = (struct meterec_s *)arg ;
 
-	if (meterec->jack_transport) {
-		previous_transport_state = transport_state;
-		transport_state = jack_transport_query(meterec->client, &pos);
-
-		/* send a stop command if the transport state as changed for stopped */
-		if (previous_transport_state != transport_state)
-			if (transport_state == JackTransportStopped) {
-				meterec->playback_cmd = OFF;
-				meterec->record_cmd = OFF;
-			}
-
-		/* compute local flags stable for this cycle */
-		playback_ongoing = ((transport_state == JackTransportRolling) && (meterec->playback_cmd == START));
-
-	}
-	else {
-		/* compute local flags stable for this cycle */
-		playback_ongoing = (meterec->playback_cmd == START);
-
-	}
-
-	if (!record_ongoing && (meterec->record_cmd != OFF)) {
-		/* we are now starting a recording. */
-		meterec->takes[meterec->n_takes+1].offset = meterec->jack.playhead;
-
-	}
-
-	record_ongoing = (meterec->record_cmd != OFF);
-
-	event = find_first_event(meterec, JACK, ALL);
-
-	if (event) {
-		switch (event->type) {
-
-			case LOCK:
-			case NEWT:
-				meterec->read_disk_buffer_process_pos = event->buffer_pos - 1;
-
-				/* if we seek because of a file re-open, compensate for what played since re-open request */
-				meterec->read_disk_buffer_process_pos += (meterec->jack.playhead  - event->new_playhead);
-				meterec->read_disk_buffer_process_pos &= (DBUF_SIZE - 1);
-
-				#ifdef DEBUG_QUEUES
-				event_print(meterec, LOG, event);
-				fprintf(meterec->fd_log, "jack:                            playhead %d |max %d |nframes %d\n", meterec->jack.playhead, meterec->read_disk_buffer_process_pos+ nframes, nframes);
-				#endif
-
-				pthread_mutex_lock(&meterec->event_mutex);
-				rm_event(meterec, event);
-				event = NULL;
-				pthread_mutex_unlock(&meterec->event_mutex);
-				break;
-			case SEEK:
-				meterec->read_disk_buffer_process_pos = event->buffer_pos;
-				meterec->jack.playhead = event->new_playhead;
-				pthread_mutex_lock(&meterec->event_mutex);
-				rm_event(meterec, event);
-				event = NULL;
-				pthread_mutex_unlock(&meterec->event_mutex);
-				break;
-		}
-	}
-
-    if (meterec->jack_transport && meterec->jack.playhead != pos.frame) {
-		// Jack indicates we are no longer at the expected transport position
-		event = find_first_event(meterec, ALL, SEEK);
-		if (!meterec->record_sts && !event) {
-			fprintf(meterec->fd_log, "jackd requires new position %d (was %lu)\n", pos.frame, meterec->jack.playhead);
-			pthread_mutex_lock( &meterec->event_mutex );
-			add_event(meterec, DISK, SEEK, MAX_UINT, pos.frame, MAX_UINT);
-			pthread_mutex_unlock( &meterec->event_mutex );
-		}
-	}
-
-	/* get the monitor port buffer*/
-	if (meterec->monitor != NULL) {
-		mon = (jack_default_audio_sample_t *) jack_port_get_buffer(meterec->monitor, nframes);
-
-		/* clean buffer because we will accumulate on it */
-		for (i = 0; i < nframes; i++)
-			mon[i] = 0.0f;
+	io.in = meterec->jack_in;
+	io.out = meterec->jack_out;
 
+	if (meterec->jack_transport) {
+		io.transport_state = jack_transport_query(meterec->client, &pos);
+		io.transport_frame = pos.frame;
 	}
 
-	/* get the audio samples, and find the peak sample */
 	for (port = 0; port < meterec->n_ports; port++) {
 
 		/* just in case the port isn't registered yet */
-		if (meterec->ports[port].input == NULL)
-			continue;
-
-		/* just in case the port isn't registered yet */
-		if (meterec->ports[port].output == NULL)
+		if (meterec->ports[port].input == NULL || meterec->ports[port].output == NULL) {
+			io.in[port] = NULL;
+			io.out[port] = NULL;
 			continue;
-
-		out = (jack_default_audio_sample_t *) jack_port_get_buffer(meterec->ports[port].output, nframes);
-		in = (jack_default_audio_sample_t *) jack_port_get_buffer(meterec->ports[port].input, nframes);
-
-		/* copy monitored ports to the monitor port*/
-		if (meterec->monitor != NULL)
-			if (meterec->ports[port].monitor)
-				for (i = 0; i < nframes; i++)
-					mon[i] += in[i];
-
-                mute  = record_ongoing;
-                mute &= meterec->ports[port].record == REC;
-                mute |= meterec->ports[port].mute;
-
-		if (playback_ongoing) {
-			meterec->playback_sts = ONGOING;
-
-			read_pos = meterec->read_disk_buffer_process_pos;
-
-			for (i = 0; i < nframes; i++) {
-
-				if (mute)
-					out[i] = 0.0f;
-				else
-					out[i] = meterec->ports[port].read_disk_buffer[read_pos];
-
-				/* update buffer pointer */
-				read_pos = (read_pos + 1) & (DBUF_SIZE - 1);
-
-				/* compute peak of input (recordable) data*/
-				s = fabs(in[i] * 1.0f) ;
-				if (s > meterec->ports[port].peak_in)
-					meterec->ports[port].peak_in = s;
-
-                                if (mute)
-                                    continue;
-
-				/* compute peak of output (playback) data */
-				s = fabs(meterec->ports[port].read_disk_buffer[read_pos] * 1.0f) ;
-				if (s > meterec->ports[port].peak_out)
-					meterec->ports[port].peak_out = s;
-			}
-
-			if (record_ongoing) {
-
-			write_pos = meterec->write_disk_buffer_process_pos;
-
-			for (i = 0; i < nframes; i++) {
-
-				/* Fill write disk buffer */
-				if (meterec->ports[port].record==OVR)
-					meterec->ports[port].write_disk_buffer[write_pos] = in[i] + out[i];
-				else if (meterec->ports[port].record)
-					meterec->ports[port].write_disk_buffer[write_pos] = in[i];
-
-				/* update buffer pointer */
-				write_pos = (write_pos + 1) & (DBUF_SIZE - 1);
-
-				}
-
-			}
-		}
-		else {
-			meterec->playback_sts = OFF;
-
-			for (i = 0; i < nframes; i++) {
-
-				out[i] = 0.0f ;
-
-				/* compute peak */
-				s = fabs(in[i] * 1.0f) ;
-				if (s > meterec->ports[port].peak_in)
-					meterec->ports[port].peak_in = s;
-
-			}
-
-		}
-
-		if (meterec->ports[port].thru)
-			for (i = 0; i < nframes; i++)
-				out[i] += in[i];
-
-	}
-
-	if (playback_ongoing) {
-
-		/* track buffer over/under flow -- needs rework */
-		remaining_read_disk_buffer = DBUF_SIZE - ((meterec->read_disk_buffer_thread_pos-meterec->read_disk_buffer_process_pos) & (DBUF_SIZE-1));
-
-		if (remaining_read_disk_buffer <= nframes)
-			meterec->read_disk_buffer_overflow++;
-
-		/* positon read pointer to end of ringbuffer */
-		meterec->read_disk_buffer_process_pos = (meterec->read_disk_buffer_process_pos + nframes) & (DBUF_SIZE - 1);
-
-		/* set new playhead position */
-		meterec->jack.playhead += nframes ;
-
-		if (event)
-			if (event->type == LOOP)
-				if (meterec->jack.playhead > event->new_playhead) {
-					meterec->jack.playhead -= ( event->new_playhead - event->old_playhead );
-					pthread_mutex_lock( &meterec->event_mutex );
-					rm_event(meterec, event);
-					event = NULL;
-					pthread_mutex_unlock( &meterec->event_mutex );
-				}
-
-		if (record_ongoing) {
-
-			/* track buffer over/under flow */
-			remaining_write_disk_buffer = DBUF_SIZE - ((meterec->write_disk_buffer_process_pos-meterec->write_disk_buffer_thread_pos) & (DBUF_SIZE-1));
-
-			if (remaining_write_disk_buffer <= nframes)
-				meterec->write_disk_buffer_overflow++;
-
-			/* positon write pointer to end of ringbuffer*/
-			meterec->write_disk_buffer_process_pos = (meterec->write_disk_buffer_process_pos + nframes) & (DBUF_SIZE - 1);
-
 		}
 
+		io.in[port] = (float *) jack_port_get_buffer(meterec->ports[port].input, nframes);
+		io.out[port] = (float *) jack_port_get_buffer(meterec->ports[port].output, nframes);
 	}
 
-	return 0;
+	io.mon = NULL;
+	if (meterec->monitor != NULL)
+		io.mon = (float *) jack_port_get_buffer(meterec->monitor, nframes);
 
+	return process_data(meterec, nframes, &io);
 }
 /******************************************************************************
 ** THREAD Utils
@@ -1058,7 +550,7 @@ void start_record(struct meterec_s *meterec) {
 
 void cancel_record(struct meterec_s *meterec) {
 
-	meterec->record_cmd = STOP;
+	__atomic_store_n(&meterec->record_cmd, STOP, __ATOMIC_RELEASE);
 
 	pthread_join(wr_dt, NULL);
 
@@ -1078,7 +570,8 @@ void stop(struct meterec_s *meterec) {
 		jack_transport_stop(meterec->client);
 	else {
 		meterec->playback_cmd = STOP;
-		meterec->record_cmd = STOP;
+		__atomic_store_n(&meterec->record_cmd, STOP, __ATOMIC_RELEASE);
+		thread_wake(&meterec->writer_wake);
 	}
 }
 
@@ -1092,20 +585,21 @@ void roll(struct meterec_s *meterec) {
 		start_playback(meterec);
 }
 
-unsigned int seek(struct meterec_s *meterec, int seek_sec) {
+unsigned long long seek(struct meterec_s *meterec, int seek_sec) {
 
-	jack_nframes_t nframes, sample_rate;
+	unsigned long long nframes;
+	long long delta;
 
 	nframes = meterec->jack.playhead;
-	sample_rate = meterec->jack.sample_rate;
+	delta = (long long)seek_sec * meterec->jack.sample_rate;
 
-	fprintf(meterec->fd_log,"seek: at %d needs to seek %d (sr=%d)\n",nframes,seek_sec * sample_rate,sample_rate );
+	fprintf(meterec->fd_log,"seek: at %llu needs to seek %lld (sr=%d)\n",nframes,delta,meterec->jack.sample_rate );
 
-	if ( seek_sec < 0 )
-		if ( nframes < abs( seek_sec ) * sample_rate )
+	if ( delta < 0 )
+		if ( nframes < (unsigned long long)(-delta) )
 			return 0;
 
-	return (nframes + seek_sec * sample_rate);
+	return (nframes + delta);
 
 }
 
@@ -1117,12 +611,15 @@ unsigned int seek(struct meterec_s *meterec, int seek_sec) {
 /* Display how to use this program */
 static int usage( const char * progname ) {
 	fprintf(stderr, "version %s\n\n", VERSION);
-	fprintf(stderr, "%s [-f freqency] [-r ref-level] [-s session-name] [-j jack-name] [-o output-format] [-u uuid] [-t][-p][-c][-i]\n\n", progname);
+	fprintf(stderr, "%s [-f freqency] [-r ref-level] [-s session-name] [-j jack-name] [-o output-format] [-b buffer-ms] [-u uuid] [-l][-m][-t][-p][-c][-i]\n\n", progname);
 	fprintf(stderr, "where  -f      is how often to update the meter per second [24]\n");
 	fprintf(stderr, "       -r      is the reference signal level for 0dB on the meter [0]\n");
 	fprintf(stderr, "       -s      is session name [%s]\n",meterec->session);
 	fprintf(stderr, "       -j      is the jack client name [%s]\n",meterec->jack_name);
 	fprintf(stderr, "       -o      is the record output format (w64, wav, flac, ogg) [%s]\n",output_ext);
+	fprintf(stderr, "       -b      is the disk buffer length in milliseconds, up to %d [%d]\n", DBUF_MS_MAX, DBUF_MS);
+	fprintf(stderr, "       -l      record one mono file per track instead of one file per take\n");
+	fprintf(stderr, "       -m      decode takes played back in memory instead of streaming them\n");
 	fprintf(stderr, "       -u      is the uuid value to be restored [none]\n");
 	fprintf(stderr, "       -t      record a new take at start\n");
 	fprintf(stderr, "       -p      no playback at start\n");
@@ -1183,17 +680,19 @@ int main(int argc, char *argv[])
 	jack_status_t status;
 	float ref_lev = 0;
 	int rate = 24;
-	int opt;
+	int opt, buffer_ms;
 	float bias = 1.0f;
 
 	meterec = (struct meterec_s *) malloc( sizeof(struct meterec_s) ) ;
 
+	dsp_init(DSP_AUTO);
+
 	init_ports(meterec);
 	init_takes(meterec);
 
 	pre_option_init(meterec);
 
-	while ((opt = getopt(argc, argv, "r:f:s:j:o:u:ptchvi")) != -1) {
+	while ((opt = getopt(argc, argv, "r:f:s:j:o:b:u:lmptchvi")) != -1) {
 		switch (opt) {
 			case 'r':
 				ref_lev = atof(optarg);
@@ -1216,9 +715,27 @@ int main(int argc, char *argv[])
 				output_ext = optarg ;
 				break;
 
+			case 'b':
+				buffer_ms = atoi(optarg);
+				if (buffer_ms <= 0 || buffer_ms > DBUF_MS_MAX) {
+					printf("Sorry, disk buffer length must be 1 to %d ms.\n", DBUF_MS_MAX);
+					exit(1);
+				}
+				meterec->dbuf_ms_opt = buffer_ms;
+				break;
+
 			case 'u':
 				uuid = atoi(optarg);
 				break;
+
+			case 'l':
+				meterec->output_layout = TAKE_TRACKS;
+				break;
+
+			case 'm':
+				meterec->preload_opt = 1;
+				break;
+
 			case 't':
 				meterec->record_cmd = START;
 				break;
@@ -1253,15 +770,19 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	log_start(meterec);
+
 	fprintf(meterec->fd_log,"---- Options ----\n");
 	fprintf(meterec->fd_log,"Reference level: %.1fdB\n", ref_lev);
 	fprintf(meterec->fd_log,"Updates per second: %d\n", meterec->display.rate);
 	fprintf(meterec->fd_log,"Session name: %s\n", meterec->session);
 	fprintf(meterec->fd_log,"Jack client name: %s\n", meterec->jack_name);
 	fprintf(meterec->fd_log,"Output format: %s\n", output_ext);
+	fprintf(meterec->fd_log,"Output layout: %s\n", meterec->output_layout==TAKE_TRACKS?"one file per track":"one file per take");
 	fprintf(meterec->fd_log,"%slayback at startup.\n",meterec->playback_cmd?"P":"No p");
 	fprintf(meterec->fd_log,"%secording new take at startup.\n",meterec->record_cmd?"R":"Not r");
 	fprintf(meterec->fd_log,"%snteract with jack transport.\n",meterec->jack_transport?"I":"Do not i");
+	fprintf(meterec->fd_log,"DSP kernels: %s\n", dsp.name);
 	fprintf(meterec->fd_log,"---- Starting ----\n");
 
 	/* Register with Jack */
@@ -1282,11 +803,15 @@ int main(int argc, char *argv[])
 	meterec->jack_sts = ONGOING;
 
 	/* Register the signal process callback */
+	jack_set_thread_init_callback(meterec->client, jack_thread_init, meterec);
 	jack_set_process_callback(meterec->client, process_jack_data, meterec);
 
 	/* register slow sync callback for transport */
 	jack_set_sync_callback(meterec->client, jack_sync_callback, meterec);
 
+	/* Register function to count xruns */
+	jack_set_xrun_callback(meterec->client, jack_xrun, meterec);
+
 	/* Register function to handle buffer size change */
 	jack_set_buffer_size_callback(meterec->client, update_jack_buffsize, meterec);
 
@@ -1371,6 +896,12 @@ int main(int argc, char *argv[])
 
 		doupdate();
 
+		/* disk threads do not save configuration themselves while recording */
+		if (__atomic_exchange_n(&meterec->config_save, 0, __ATOMIC_ACQ_REL))
+			save_conf(meterec);
+
+		stats_update(meterec);
+
 		fsleep( 1.0f/rate );
 
 	}
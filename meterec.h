@@ -22,30 +22,102 @@
 
 
 
-/* maximum number of connections per port - no known limit*/
-#define MAX_CONS 24
+/* ports and their connections are as many as the session has, see alloc_ports() */
 
-/* maximum number of ports - no known limit, only extra memory used */
-#define MAX_PORTS 64
+/* maximum number of tracks in a take - track files are numbered on 3 digits */
+#define MAX_TRACKS 999
 
-/* maximum number of tracks - no known limit, only extra memory used */
-#define MAX_TRACKS MAX_PORTS
+/* maximum number of takes - only address space is reserved, pages are used as takes are added */
+#define MAX_TAKES 100000
 
-/* maximum number of takes - no known limit, only extra memory used */
-#define MAX_TAKES 100
+/* take files opened at once at startup to read what changed since last run */
+#define PROBE_THREADS 8
 
-/* size of disk wait buffer, must be power of two */
-#define DBUF_SIZE 0x20000
+/* takes no longer played back are kept open until one of these is exceeded */
+#define CACHE_MAX_FILES 128
+#define CACHE_MAX_MB 512
+
+/* default longest loop played from RAM in seconds, 0 disables */
+#define LOOP_CACHE_SEC 30
+
+/* 'buffer zero' of a loop decoded by each reader pass while it is cached */
+#define LOOP_CACHE_STEP 4
+
+/* default memory budget for takes decoded in memory by preload mode */
+#define PRELOAD_MB 1024
+
+/* 'buffer zero' of a take decoded in memory by each reader pass while playing */
+#define PRELOAD_STEP 4
+
+/* default length decoded in advance after each seek index in ms, 0 disables */
+#define CUE_CACHE_MS 500
+
+/* default length of disk wait buffers in ms, rounded up to a power of two frames */
+#define DBUF_MS 2000
+
+/* longest disk wait buffers accepted in ms, from -b or buffer_ms */
+#define DBUF_MS_MAX 20000
+
+/* minimum size of disk wait buffers in frames, must be power of two */
+#define DBUF_MIN (2*ZBUF_SIZE)
+
+/* maximum size of disk wait buffers in frames, must be power of two */
+#define DBUF_MAX 0x1000000
+
+/* disk wait buffers arena is rounded to this size so it can be backed by huge pages */
+#define DBUF_ALIGN 0x200000
 
 /* size of disk buffers */
 #define ZBUF_SIZE 4096
 
+/* disk buffer cursors written by one thread are kept this far from the others */
+#define CACHE_LINE 64
+
+/* a cursor is stored with release by the thread owning it once the samples it
+   covers are written (or read), and loaded with acquire by the other thread */
+#define CURSOR_GET(pos) __atomic_load_n(&(pos), __ATOMIC_ACQUIRE)
+#define CURSOR_SET(pos, val) __atomic_store_n(&(pos), (val), __ATOMIC_RELEASE)
+
+/* amount of data (frames) process lets build up before waking a disk thread */
+#define DBUF_WAKE (ZBUF_SIZE/4)
+
 /*number of seek indexes*/
 #define MAX_INDEX 12
 
 /* max when editing port names */
 #define MAX_NAME_LEN 80
 
+/* number of event slots between jack process and disk threads, must be power of two */
+#define EVENT_RING_SIZE 32
+
+/* log messages each logging thread can queue, must be power of two */
+#define LOG_RING_SIZE 256
+#define LOG_MSG_LEN 160
+
+/* threads logging through a ring, the others write to the log file directly */
+#define LOG_PROCESS 0
+#define LOG_READER 1
+#define LOG_WRITER 2
+#define LOG_SPARE 3
+#define LOG_KEYBOARD 4
+#define LOG_RINGS 5
+
+/* log2 buckets of telemetry histograms */
+#define HIST_BUCKETS 32
+
+/* process load buckets: 10% steps up to the period budget, then over budget */
+#define LOAD_BUCKETS 11
+
+/* number of event types (see queue.h) */
+#define MAX_EVENT_TYPES 5
+
+/* take file layout */
+#define TAKE_INTERLEAVED 0
+#define TAKE_TRACKS 1
+
+/* take file opened in advance is written under this name until rollover */
+#define SPARE_PREFIX ".spare_"
+
 /* commands */
 #define STOP 0
 #define START 1
@@ -81,6 +153,7 @@
 #define VU_OUT 2
 #define EDIT 3
 #define PORT 4
+#define STATS 5
 
 /* port selection */
 #define CON_OUT (-1)
@@ -99,6 +172,9 @@
 
 #define MAX_UINT ((unsigned int)(-1))
 
+/* frame positions on the session timeline are 64 bits, this one means none */
+#define MAX_FRAME ((unsigned long long)(-1))
+
 /*
 note :
 - take 0 is before the session start, there will never be data in take 0
@@ -138,24 +214,52 @@ take 7 contains 2 tracks that are mapped on port 3 and 8
 
 */
 
+/*
+note :
+- takes are never moved, the table is reserved once and only the pages of takes
+  in use are touched. A take slot full of 0's is a valid empty take.
+- track maps and port flags only hold what the take has, they are grown before
+  the take is played back or recorded.
+- file information is read the first time it is needed, see take_info().
+*/
+
+#define TAKE_HAS_TRACK 0x1
+#define TAKE_HAS_LOCK  0x2
+
+/* longest "h:mm:ss.mss" a take lenght prints to */
+#define TAKE_LENGHT_LEN 24
+
 struct take_s
 {
 	unsigned int ntrack; /* number of tracks in this take */
+	unsigned int max_track; /* tracks that fit in the maps below */
 
-	unsigned int track_port_map[MAX_TRACKS]; /* track maps to a port : track_port_map[track] = port */
-	unsigned int port_has_track[MAX_PORTS]; /* port has a track assigned : port_has_track[port] = 1/0 */
-	unsigned int port_has_lock[MAX_PORTS]; /* port is marked locked for playback on this take : port_has_lock[port] = 1/0 */
+	unsigned int *track_port_map; /* track maps to a port : track_port_map[track] = port */
+	unsigned char *port_flags; /* port has a track and/or is marked locked for playback on this take */
+	unsigned int n_port_flags;
 
 	char *name ;
-	char *lenght ;
-	char *take_file ;
+	char lenght[TAKE_LENGHT_LEN] ; /* empty until take information is known */
+	char *take_file ; /* first track file name if TAKE_TRACKS layout */
 	SNDFILE *take_fd;
 	SF_INFO info;
+	unsigned int info_sts; /* info was read, or tried to */
+
+	unsigned int layout; /* TAKE_INTERLEAVED: one file, TAKE_TRACKS: one mono file per track */
+	SNDFILE **track_fd; /* TAKE_TRACKS: only tracks played back are opened */
+
+	/* uncompressed files are memory mapped instead of opened with libsndfile */
+	struct wavmap_s *take_map;
+	struct wavmap_s **track_map;
 
 	/* how many samples away from time 0 this take was recorded. */
-	unsigned int offset;
+	unsigned long long offset;
 
 	float *buf ;
+	unsigned long window; /* last 'buffer zero' window read, older means buf is silent */
+
+	unsigned int playing; /* take is read for the current playback selection */
+	unsigned long long used; /* when take stopped playing, for LRU eviction of open takes */
 
 };
 
@@ -166,14 +270,19 @@ struct port_s
 	jack_port_t *output;
 
 	unsigned int n_cons;
+	unsigned int max_cons;
 	const char **input_connected;
 	const char **output_connected;
-	char *connections[MAX_CONS];
+	char **connections;
 	char *name;
 
 	float *write_disk_buffer;
 	float *read_disk_buffer;
 
+	unsigned int silent;   /* read disk buffer only holds 0's, set by reader thread */
+	unsigned int zero_pos; /* reader thread: ring span known to hold 0's */
+	unsigned int zero_len;
+
 	float peak_in;
 	float max_in;
 	float peak_out;
@@ -204,22 +313,242 @@ struct port_s
 
 };
 
+/*
+note :
+- the playback plan lists, for each port playing back a take, where its samples
+  are in the take interleaved 'buffer zero'.
+- it is rebuilt by the reader thread when takes are (re)opened, on LOCK/NEWT.
+- buf is where the track starts in 'buffer zero', stride is the distance between
+  two samples of the track: number of tracks if interleaved, 1 if one file per track.
+*/
+struct plan_s {
+
+	unsigned int take;
+	unsigned int track;
+	unsigned int port;
+	float *buf;
+	unsigned int stride;
+};
+
+/*
+note :
+- the timeline index lists takes played back as [start, end) frame intervals
+  sorted by start. It is rebuilt with the playback plan.
+- the reader thread only reads takes meeting the 'buffer zero' window, ports of
+  other takes get 0's in their disk buffer, written once per lap at most.
+*/
+struct span_s {
+
+	unsigned int take;
+	unsigned long long start;
+	unsigned long long end;
+};
+
 struct event_s {
 
 	unsigned int id;
 	unsigned int type;
 	unsigned int queue;
-	jack_nframes_t old_playhead;
-	jack_nframes_t new_playhead;
+	unsigned long long old_playhead;
+	unsigned long long new_playhead;
 	unsigned int buffer_pos;
 	struct event_s *next;
 	struct event_s *prev;
 };
 
+/*
+note :
+- an event ring has a single producer thread and a single consumer thread.
+- slots are preallocated and only written by the producer, so the jack process
+  never has to lock, allocate or walk a list to exchange events with disk threads.
+- the producer can ask the consumer to drop what was published so far using
+  discard (all events) or discard_loop (LOOP events only).
+*/
+struct event_ring_s {
+
+	unsigned int write;        /* written by producer only */
+	unsigned int read;         /* written by consumer only */
+	unsigned int discard;      /* drop all events published before this position */
+	unsigned int discard_loop; /* drop LOOP events published before this position */
+
+	struct event_s slot[EVENT_RING_SIZE];
+};
+
+/*
+note :
+- a disk thread sleeps on its semaphore until the jack process (or an event)
+  signals there is work to do.
+- signaled makes sure the semaphore is posted only once per wake up, time is
+  when it was posted so the thread can measure wake to fill latency.
+*/
+struct wake_s
+{
+	sem_t sem;
+	unsigned int signaled;
+	unsigned long long time;        /* usec */
+	unsigned long long latency;     /* usec */
+	unsigned long long latency_max; /* usec */
+};
+
+/*
+note :
+- each logging thread formats its messages in its own single producer / single
+  consumer ring, so the jack process never waits on a stdio lock.
+- the logger thread drains all rings to the log file, a full ring drops the
+  message and counts it in lost.
+*/
+struct log_entry_s
+{
+	unsigned int level;
+	char msg[LOG_MSG_LEN];
+};
+
+struct log_ring_s
+{
+	unsigned int write;    /* written by producer only */
+	unsigned int read;     /* written by logger only */
+	unsigned int lost;     /* written by producer only */
+	unsigned int reported; /* lost messages already reported by logger */
+
+	struct log_entry_s slot[LOG_RING_SIZE];
+};
+
+struct log_s
+{
+	unsigned int running;
+	pthread_t thread;
+	struct wake_s wake;
+
+	struct log_ring_s ring[LOG_RINGS];
+};
+
+/*
+note :
+- a histogram is written by one thread only and read by the main loop while it
+  changes, a snapshot may be one sample off.
+- bucket 0 counts zeros, bucket n values from 2^(n-1) to 2^n - 1.
+*/
+struct hist_s
+{
+	unsigned long long count[HIST_BUCKETS];
+	unsigned long long n;
+	unsigned long long max;
+};
+
+/*
+note :
+- cycle is the time spent in the process path each period, load the same time
+  against the period budget.
+- read_min is the least data the process found ahead in the read disk buffer
+  while playing back, write_min the least room left in the write disk buffer
+  while recording, in frames.
+- xruns are counted by the jack xrun callback, xrun_delay is the last one's.
+- file_s is the interval the stats file is rewritten at, 0 for no file.
+*/
+struct stats_s
+{
+	struct hist_s cycle;        /* usec */
+	unsigned long long load[LOAD_BUCKETS];
+	unsigned long long budget;  /* usec */
+	struct hist_s reader_wake;  /* usec */
+	struct hist_s writer_wake;  /* usec */
+	unsigned int read_min;
+	unsigned int write_min;
+	unsigned int xruns;
+	float xrun_delay;           /* usec */
+
+	unsigned int file_s;
+	unsigned long long file_time;
+};
+
+/*
+note :
+- a take rollover is requested by the keyboard with record_cmd = RESTART.
+- the jack process notes where in the write disk buffer the next take starts,
+  and the playhead at that sample, then publishes pending.
+- the writer thread drains the finished take up to buffer_pos, swaps in the
+  take file opened in the background, and clears pending.
+*/
+struct rollover_s
+{
+	unsigned int pending;
+	unsigned int buffer_pos;
+	unsigned long long playhead;
+};
+
+/*
+note :
+- a loop shorter than loop_cache_s seconds is decoded once by the reader thread
+  for every port played back, then the jack process plays it from RAM and wraps
+  at the loop end by itself, the disk buffer is left untouched meanwhile.
+- data[port] points at loop start, fade frames before it are kept to crossfade
+  the end of the loop with what leads to its start.
+- ready is published by the reader thread, active is set by the jack process
+  while it reads the cache, so the reader only frees it once active is cleared.
+- the reader decodes LOOP_CACHE_STEP 'buffer zero' per pass, between disk
+  buffer fills, ready is only set once the whole loop is in.
+*/
+struct loop_cache_s
+{
+	unsigned int ready;
+	unsigned int active;
+	unsigned int stale;  /* takes played back changed, needs decoding again */
+
+	unsigned long long low;
+	unsigned long long high;
+	unsigned int fade;
+
+	unsigned long long start; /* first frame decoded, fade frames before low */
+	unsigned int frames;      /* frames to decode per port */
+	unsigned int done;        /* frames decoded so far */
+
+	float *mem;
+	size_t len;
+	float **data; /* one per port, NULL if port has nothing to play back */
+};
+
+/*
+note :
+- the reader thread keeps cue_ms decoded after each seek index for the ports
+  played back, so a jump to an index fills the disk buffer from RAM at once and
+  takes are only read from the end of that window.
+- cues are decoded again, one at a time, when takes played back change.
+*/
+struct cue_s
+{
+	unsigned long long pos; /* seek index this window starts at */
+	unsigned int frames;
+	unsigned int stale;
+
+	float *mem;
+	float **data; /* one per port, NULL if port has nothing to play back */
+};
+
+/*
+note :
+- in preload mode, a take opened while playback runs keeps being streamed and
+  the reader thread decodes it in memory thru a handle of its own, PRELOAD_STEP
+  'buffer zero' per pass. The decoded copy replaces the streamed file once
+  complete. Only takes opened before playback starts are decoded at once.
+*/
+struct preload_s
+{
+	unsigned int take;
+	unsigned int track;    /* MAX_UINT for a take file with all tracks */
+	char *file;
+
+	SNDFILE *fd;           /* decoding handle, apart from the streamed one */
+	struct wavmap_s *map;
+	struct wavmap_s *ram;  /* decoded copy */
+	sf_count_t done;       /* frames decoded so far */
+
+	struct preload_s *next;
+};
+
 struct loop_s
 {
-	unsigned int low;
-	unsigned int high;
+	unsigned long long low;
+	unsigned long long high;
 	unsigned int enable;
 };
 
@@ -237,12 +566,13 @@ struct pos_s
 struct jack_s
 {
 	unsigned int sample_rate;
-	unsigned long playhead;
+	unsigned long long playhead;
 };
 
 struct disk_s
 {
-	unsigned long playhead;
+	unsigned long long playhead;
+	unsigned long window; /* 'buffer zero' windows read so far */
 };
 
 
@@ -257,6 +587,7 @@ struct display_s
 	unsigned int height;
 	unsigned int rate;
 	unsigned int decay_len;
+	unsigned int take_first; /* first take shown in the session view */
 
 	WINDOW* wrds;
 	WINDOW* wwrs;
@@ -274,6 +605,7 @@ struct display_s
 	WINDOW* wbot;
 	WINDOW* wbdb;
 	WINDOW* wcon;
+	WINDOW* wsta;
 
 	WINDOW* wpi;
 	WINDOW* wpii;
@@ -315,6 +647,7 @@ struct meterec_s
 
 	unsigned int curses_sts;
 	unsigned int config_sts;
+	unsigned int config_save;  /* from disk threads to main loop */
 	unsigned int jack_sts;
 
 	unsigned int jack_transport;
@@ -325,25 +658,36 @@ struct meterec_s
 	const char **all_output_ports;
 
 	unsigned int n_ports;
-	struct port_s ports[MAX_PORTS];
+	unsigned int max_ports; /* ports allocated, per port arrays below have as many */
+	struct port_s *ports;
 
 	unsigned int n_takes;
-	struct take_s takes[MAX_TAKES];
+	struct take_s *takes;
+	pthread_mutex_t take_mutex; /* take information read by display or reader thread */
 
 	unsigned int n_tracks;
 
+	unsigned int n_plan;
+	struct plan_s *plan;
+	unsigned int n_span;
+	struct span_s *span; /* at most one take played back per port */
+
 	jack_client_t *client;
 	jack_nframes_t jack_buffsize;
 
 	jack_port_t *monitor;
+	float **jack_in;  /* port buffers handed to process for a jack period */
+	float **jack_out;
 
-	jack_nframes_t seek_index[MAX_INDEX];
+	unsigned long long seek_index[MAX_INDEX];
+	struct cue_s cue[MAX_INDEX];
 
 	struct jack_s jack;
 
 	struct disk_s disk;
 
 	struct loop_s loop;
+	struct loop_cache_s loop_cache;
 
 	struct pos_s pos;
 
@@ -352,32 +696,66 @@ struct meterec_s
 	struct event_s *event;
 	pthread_mutex_t event_mutex ;
 
+	struct event_ring_s jack_ring; /* from reader thread to jack process */
+	struct event_ring_s disk_ring; /* from jack process to reader thread */
+	unsigned int event_pending[MAX_EVENT_TYPES]; /* events in flight in queue and rings per type */
+
+	struct wake_s reader_wake;
+	struct wake_s writer_wake;
+
+	struct log_s log;
+	struct stats_s stats;
+	char *stats_file;
+	char *takes_file; /* take information kept from one run to the other */
+
 	unsigned int output_fmt;
 	char *output_ext;
-
-	unsigned int write_disk_buffer_thread_pos;
-	unsigned int write_disk_buffer_process_pos;
+	unsigned int output_layout; /* TAKE_INTERLEAVED or TAKE_TRACKS for new takes */
+	unsigned int take_expect_s; /* expected take length to preallocate, 0 if unknown */
+	unsigned int checkpoint_s;  /* take header checkpoint interval, 0 for default */
+	unsigned int loop_cache_s;  /* longest loop played from RAM */
+	unsigned int loop_fade_ms;  /* crossfade at loop end, 0 for none */
+	unsigned int cue_ms;        /* decoded after each seek index */
+	unsigned int preload;       /* decode takes played back in memory, from .mrec */
+	unsigned int preload_opt;   /* same from command line */
+	unsigned int preload_mb;    /* memory budget for decoded takes */
+	size_t preload_bytes;       /* memory used by decoded takes */
+	struct preload_s *preload_job; /* takes being decoded in memory, oldest first */
+
+	unsigned int dbuf_ms;     /* disk buffer length from .mrec, 0 for default */
+	unsigned int dbuf_ms_opt; /* disk buffer length from command line, 0 if not set */
+	unsigned int dbuf_size;   /* disk buffer size in frames, power of two */
+	float *dbuf_arena;        /* all ports disk buffers, in one locked memory area */
+	size_t dbuf_arena_len;
+
+	struct rollover_s rollover;
+
+	/* padding keeps cursors of each thread on cache lines of their own */
+	char pad_write_thread[CACHE_LINE];
+	unsigned int write_disk_buffer_thread_pos;   /* writer thread */
+	char pad_write_process[CACHE_LINE];
+	unsigned int write_disk_buffer_process_pos;  /* jack process */
 	unsigned int write_disk_buffer_overflow;
 
-	unsigned int read_disk_buffer_thread_pos;
-	unsigned int read_disk_buffer_process_pos;
+	char pad_read_thread[CACHE_LINE];
+	unsigned int read_disk_buffer_thread_pos;    /* reader thread */
+	char pad_read_process[CACHE_LINE];
+	unsigned int read_disk_buffer_process_pos;   /* jack process */
 	unsigned int read_disk_buffer_overflow;
+	char pad_end[CACHE_LINE];
 
 };
 
 void halt(int sig);
 void exit_on_error(char * reason);
-void compute_takes_to_playback(struct meterec_s *meterec);
-void compute_tracks_to_record(struct meterec_s *meterec);
-int changed_takes_to_playback(struct meterec_s *meterec);
 
 void stop(struct meterec_s *meterec);
 void roll(struct meterec_s *meterec);
-unsigned int seek(struct meterec_s *meterec, int seek_sec);
+unsigned long long seek(struct meterec_s *meterec, int seek_sec);
 void start_disk(struct meterec_s *meterec);
 void start_playback(struct meterec_s *meterec);
 void start_record(struct meterec_s *meterec) ;
 void cancel_record(struct meterec_s *meterec) ;
 
-int set_loop(struct meterec_s *meterec, unsigned int loophead);
+int set_loop(struct meterec_s *meterec, unsigned long long loophead);
 void clr_loop(struct meterec_s *meterec, unsigned int bound);
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <semaphore.h>
 
 #include <curses.h>
 #include <sndfile.h>
@@ -195,6 +196,31 @@ void create_monitor_port(struct meterec_s *meterec) {
 
 }
 
+/* connection lists grow as needed, there is no limit on connections per port */
+void add_connection(struct meterec_s *meterec, const char *port_name, unsigned int port) {
+
+	struct port_s *p = &meterec->ports[port];
+	char **connections;
+	unsigned int max;
+
+	if (p->n_cons == p->max_cons) {
+
+		max = p->max_cons ? p->max_cons * 2 : 8;
+
+		connections = (char **) realloc(p->connections, max * sizeof(char *));
+		if (!connections)
+			exit_on_error("Cannot allocate port connections.");
+
+		p->connections = connections;
+		p->max_cons = max;
+	}
+
+	p->connections[p->n_cons] = (char *) malloc( strlen(port_name) + 1 );
+	strcpy(p->connections[p->n_cons], port_name);
+
+	p->n_cons += 1;
+}
+
 void register_port_old(struct meterec_s *meterec, char *port_name, unsigned int port) {
 
 	char *tmp = NULL;
@@ -222,17 +248,13 @@ void register_port_old(struct meterec_s *meterec, char *port_name, unsigned int
 		return;
 
 	}
-	else {
-		meterec->ports[port].connections[meterec->ports[port].n_cons] = (char *) malloc( strlen(port_name) + 1 );
-		strcpy(meterec->ports[port].connections[meterec->ports[port].n_cons], port_name);
-		meterec->ports[port].n_cons += 1;
-	}
+	else
+		add_connection(meterec, port_name, port);
 }
 
 void register_port(struct meterec_s *meterec, char *port_name, unsigned int port) {
 
 	jack_port_t *jack_port;
-	unsigned int con = meterec->ports[port].n_cons;
 
 	/* Get the port we are connecting to */
 	jack_port = jack_port_by_name(meterec->client, port_name);
@@ -241,10 +263,7 @@ void register_port(struct meterec_s *meterec, char *port_name, unsigned int port
 	if (jack_port == NULL)
 		fprintf(meterec->fd_log, "Can't find port '%s' will connect later if port becomes available.\n", port_name);
 
-	meterec->ports[port].connections[con] = (char *) malloc( strlen(port_name) + 1 );
-	strcpy(meterec->ports[port].connections[con], port_name);
-
-	meterec->ports[port].n_cons += 1;
+	add_connection(meterec, port_name, port);
 
 }
 
@@ -265,7 +284,7 @@ void deregister_port(struct meterec_s *meterec, char *port_name, unsigned int po
 		for ( ; con<n_cons; con++)
 			meterec->ports[port].connections[con] = meterec->ports[port].connections[con+1];
 
-		meterec->ports[port].connections[n_cons+1] = NULL;
+		meterec->ports[port].connections[n_cons] = NULL;
 
 		meterec->ports[port].n_cons = n_cons;
 	}
@@ -25,6 +25,7 @@ void process_port_register(jack_port_id_t port_id, int new, void *arg);
 void create_input_port(struct meterec_s *meterec, unsigned int port);
 void create_output_port(struct meterec_s *meterec, unsigned int port);
 void create_monitor_port(struct meterec_s *meterec) ;
+void add_connection(struct meterec_s *meterec, const char *port_name, unsigned int port);
 void register_port_old(struct meterec_s *meterec, char *port_name, unsigned int port);
 void register_port(struct meterec_s *meterec, char *port_name, unsigned int port);
 void * connect_all_ports(void *d);
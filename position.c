@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <semaphore.h>
 
 #include <curses.h>
 #include <sndfile.h>
@@ -49,41 +50,42 @@ void time_zero_sprint(char * string) {
 
 void time_hms(struct time_s * time) {
 
-	unsigned int rate = time->rate;
-	unsigned int frm = time->frm;
+	unsigned long long rate = time->rate;
+	unsigned long long frm = time->frm;
 
-	time->h = (unsigned int) ( frm / rate ) / 3600;
+	time->h = (unsigned int) (( frm / rate ) / 3600);
 
 	frm -= time->h  * rate * 3600;
 
-	time->m = (unsigned int) ((time->frm / rate ) / 60 ) % 60;
+	time->m = (unsigned int) (((time->frm / rate ) / 60 ) % 60);
 
 	frm -= time->m  * rate * 60;
 
-	time->s = (unsigned int) ( time->frm / rate ) % 60;
+	time->s = (unsigned int) (( time->frm / rate ) % 60);
 
 	frm -= time->s  * rate;
 
-	time->ms  = frm*10000;
-	time->ms /= rate ;
-	time->ms += 5;
-	time->ms /= 10;
-	time->ms %= 1000;
+	frm *= 10000;
+	frm /= rate ;
+	frm += 5;
+	frm /= 10;
+	time->ms = (unsigned int) (frm % 1000);
 
 
 }
 
 void time_frm(struct time_s * time) {
 
-	time->frm =  (unsigned int) (
-		time->h  * time->rate * 3600 +
-		time->m  * time->rate * 60 +
-		time->s  * time->rate +
-		(time->ms * time->rate) / 1000
-		);
+	unsigned long long rate = time->rate;
+
+	time->frm =
+		time->h  * rate * 3600 +
+		time->m  * rate * 60 +
+		time->s  * rate +
+		(time->ms * rate) / 1000;
 }
 
-void time_init_frm(struct time_s *time, unsigned int rate, unsigned int frames) {
+void time_init_frm(struct time_s *time, unsigned int rate, unsigned long long frames) {
 
 	time->rate = rate;
 	time->frm = frames;
@@ -22,7 +22,8 @@
 
 struct time_s
 {
-	unsigned int h,m,s,ms,frm,rate;
+	unsigned int h,m,s,ms,rate;
+	unsigned long long frm;
 };
 
 
@@ -32,5 +33,5 @@ void time_sprint(struct time_s * time, char * string);
 void time_hms(struct time_s * time);
 void time_frm(struct time_s * time);
 
-void time_init_frm(struct time_s *time, unsigned int rate, unsigned int frames);
+void time_init_frm(struct time_s *time, unsigned int rate, unsigned long long frames);
 void time_init_hms(struct time_s *time, unsigned int rate, unsigned int h, unsigned int m, unsigned int s, unsigned int ms);
@@ -0,0 +1,321 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <semaphore.h>
+
+#include <curses.h>
+#include <sndfile.h>
+#include <jack/jack.h>
+
+#include "config.h"
+#include "meterec.h"
+#include "log.h"
+#include "queue.h"
+#include "dsp.h"
+#include "process.h"
+#include "stats.h"
+#include "clock.h"
+
+/******************************************************************************
+** PROCESS
+*/
+
+/* what jack (or an offline backend) calls once per period */
+int process_data(struct meterec_s *meterec, jack_nframes_t nframes, struct process_io_s *io) {
+
+	jack_default_audio_sample_t *in, *out, *mon;
+	static jack_transport_state_t transport_state=JackTransportStopped, previous_transport_state;
+	unsigned int port, remaining_write_disk_buffer, remaining_read_disk_buffer;
+	unsigned int playback_ongoing, loop_len=0, loop_pos=0, ahead, thread_pos, record_cmd;
+	static unsigned int record_ongoing, loop_cached;
+	struct event_s *event;
+	struct loop_cache_s *cache;
+	unsigned long long start, seek;
+
+        int mute;
+
+	start = now_usec();
+
+	if (meterec->jack_transport) {
+		previous_transport_state = transport_state;
+		transport_state = io->transport_state;
+
+		/* send a stop command if the transport state as changed for stopped */
+		if (previous_transport_state != transport_state)
+			if (transport_state == JackTransportStopped) {
+				meterec->playback_cmd = OFF;
+				__atomic_store_n(&meterec->record_cmd, OFF, __ATOMIC_RELEASE);
+				thread_wake(&meterec->writer_wake);
+			}
+
+		/* compute local flags stable for this cycle */
+		playback_ongoing = ((transport_state == JackTransportRolling) && (meterec->playback_cmd == START));
+
+	}
+	else {
+		/* compute local flags stable for this cycle */
+		playback_ongoing = (meterec->playback_cmd == START);
+
+	}
+
+	/* other threads may stop the recording at any time, read the command once */
+	record_cmd = __atomic_load_n(&meterec->record_cmd, __ATOMIC_ACQUIRE);
+
+	if (!record_ongoing && (record_cmd != OFF)) {
+		/* we are now starting a recording. */
+		meterec->takes[meterec->n_takes+1].offset = meterec->jack.playhead;
+
+	}
+
+	record_ongoing = (record_cmd != OFF);
+
+	/* only a pending restart turns back into START, a stop posted meanwhile wins */
+	if (record_ongoing && (record_cmd == RESTART) && !__atomic_load_n(&meterec->rollover.pending, __ATOMIC_ACQUIRE) &&
+		__atomic_compare_exchange_n(&meterec->record_cmd, &record_cmd, START, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		/* next take starts with the first sample written in this cycle */
+		meterec->rollover.buffer_pos = meterec->write_disk_buffer_process_pos;
+		meterec->rollover.playhead = meterec->jack.playhead;
+		__atomic_store_n(&meterec->rollover.pending, 1, __ATOMIC_RELEASE);
+	}
+
+	event = event_ring_peek(meterec, &meterec->jack_ring);
+
+	if (event) {
+		switch (event->type) {
+
+			case LOCK:
+			case NEWT:
+				/* if we seek because of a file re-open, compensate for what played since re-open request */
+				CURSOR_SET(meterec->read_disk_buffer_process_pos,
+					(event->buffer_pos - 1 + (meterec->jack.playhead - event->new_playhead)) & (meterec->dbuf_size - 1));
+
+				#ifdef DEBUG_QUEUES
+				event_print(meterec, LOG, event);
+				log_debug(meterec, "jack:                            playhead %llu |max %d |nframes %d\n", meterec->jack.playhead, meterec->read_disk_buffer_process_pos+ nframes, nframes);
+				#endif
+
+				event_ring_pop(meterec, &meterec->jack_ring);
+				event = NULL;
+				break;
+			case SEEK:
+				CURSOR_SET(meterec->read_disk_buffer_process_pos, event->buffer_pos);
+				meterec->jack.playhead = event->new_playhead;
+				event_ring_pop(meterec, &meterec->jack_ring);
+				event = NULL;
+				break;
+		}
+	}
+
+    /* jack transport counts frames on 32 bits, compare modulo 2^32 */
+    if (meterec->jack_transport && (jack_nframes_t)meterec->jack.playhead != io->transport_frame) {
+		// Jack indicates we are no longer at the expected transport position
+		if (!meterec->record_sts && !event_pending(meterec, SEEK)) {
+			seek = (meterec->jack.playhead & ~0xFFFFFFFFULL) | io->transport_frame;
+			log_info(meterec, "jackd requires new position %u (was %llu)\n", io->transport_frame, meterec->jack.playhead);
+			event_ring_add(meterec, &meterec->disk_ring, DISK, SEEK, MAX_FRAME, seek, MAX_UINT);
+		}
+	}
+
+	/* play the loop from RAM if the reader thread cached it */
+	cache = &meterec->loop_cache;
+	__atomic_store_n(&cache->active, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&cache->ready, __ATOMIC_SEQ_CST) && meterec->loop.enable &&
+		cache->low == meterec->loop.low && cache->high == meterec->loop.high &&
+		meterec->jack.playhead >= cache->low && meterec->jack.playhead < cache->high) {
+
+		loop_cached = 1;
+		loop_len = cache->high - cache->low;
+		loop_pos = meterec->jack.playhead - cache->low;
+
+		/* the cache wraps by itself, disk buffer loop points are of no use */
+		while (event && event->type == LOOP) {
+			event_ring_pop(meterec, &meterec->jack_ring);
+			event = event_ring_peek(meterec, &meterec->jack_ring);
+		}
+	}
+	else {
+		__atomic_store_n(&cache->active, 0, __ATOMIC_SEQ_CST);
+
+		/* disk buffer was left behind while playing from RAM, refill it from here */
+		if (loop_cached)
+			event_ring_add(meterec, &meterec->disk_ring, DISK, SEEK, MAX_FRAME, meterec->jack.playhead, MAX_UINT);
+
+		loop_cached = 0;
+	}
+
+	/* get the monitor port buffer*/
+	mon = io->mon;
+	if (mon != NULL) {
+
+		/* clean buffer because we will accumulate on it */
+		dsp.zero(mon, nframes);
+
+	}
+
+	/* get the audio samples, and find the peak sample */
+	for (port = 0; port < meterec->n_ports; port++) {
+
+		/* just in case the port isn't registered yet */
+		if (io->in[port] == NULL || io->out[port] == NULL)
+			continue;
+
+		out = io->out[port];
+		in = io->in[port];
+
+		/* copy monitored ports to the monitor port*/
+		if (mon != NULL)
+			if (meterec->ports[port].monitor)
+				dsp.add(mon, in, nframes);
+
+                mute  = record_ongoing;
+                mute &= meterec->ports[port].record == REC;
+                mute |= meterec->ports[port].mute;
+
+		/* compute peak of input (recordable) data*/
+		meterec->ports[port].peak_in = dsp.peak(in, nframes, meterec->ports[port].peak_in);
+
+		if (playback_ongoing) {
+			meterec->playback_sts = ONGOING;
+
+			if (mute)
+				dsp.zero(out, nframes);
+			else {
+				if (!loop_cached) {
+					/* reader thread left nothing but 0's in this disk buffer */
+					if (__atomic_load_n(&meterec->ports[port].silent, __ATOMIC_ACQUIRE))
+						dsp.zero(out, nframes);
+					else
+						dsp_ring_read(out, meterec->ports[port].read_disk_buffer, meterec->read_disk_buffer_process_pos, meterec->dbuf_size, nframes);
+				}
+				else if (cache->data[port])
+					dsp_loop_read(out, cache->data[port], loop_len, loop_pos, nframes);
+				else
+					dsp.zero(out, nframes);
+
+				/* compute peak of output (playback) data */
+				meterec->ports[port].peak_out = dsp.peak(out, nframes, meterec->ports[port].peak_out);
+			}
+
+			if (record_ongoing) {
+
+				/* Fill write disk buffer */
+				if (meterec->ports[port].record==OVR)
+					dsp_ring_write_sum(meterec->ports[port].write_disk_buffer, meterec->write_disk_buffer_process_pos, meterec->dbuf_size, in, out, nframes);
+				else if (meterec->ports[port].record)
+					dsp_ring_write(meterec->ports[port].write_disk_buffer, meterec->write_disk_buffer_process_pos, meterec->dbuf_size, in, nframes);
+
+			}
+		}
+		else {
+			meterec->playback_sts = OFF;
+
+			dsp.zero(out, nframes);
+
+		}
+
+		if (meterec->ports[port].thru)
+			dsp.add(out, in, nframes);
+
+	}
+
+	if (playback_ongoing && loop_cached) {
+
+		/* wrap within the cached loop, disk buffer is left as is */
+		meterec->jack.playhead = cache->low + (loop_pos + nframes) % loop_len;
+
+	}
+	else if (playback_ongoing) {
+
+		thread_pos = CURSOR_GET(meterec->read_disk_buffer_thread_pos);
+
+		/* track buffer over/under flow -- needs rework */
+		remaining_read_disk_buffer = meterec->dbuf_size - ((thread_pos-meterec->read_disk_buffer_process_pos) & (meterec->dbuf_size-1));
+
+		/* data the reader thread is ahead of us, positions meet when full */
+		ahead = (thread_pos - meterec->read_disk_buffer_process_pos) & (meterec->dbuf_size - 1);
+		if (!ahead)
+			ahead = meterec->dbuf_size;
+		if (ahead < meterec->stats.read_min)
+			meterec->stats.read_min = ahead;
+
+		if (remaining_read_disk_buffer <= nframes)
+			meterec->read_disk_buffer_overflow++;
+
+		/* positon read pointer to end of ringbuffer */
+		CURSOR_SET(meterec->read_disk_buffer_process_pos, (meterec->read_disk_buffer_process_pos + nframes) & (meterec->dbuf_size - 1));
+
+		/* let reader thread know there is room to refill */
+		if (((meterec->read_disk_buffer_process_pos - thread_pos) & (meterec->dbuf_size - 1)) >= DBUF_WAKE)
+			thread_wake(&meterec->reader_wake);
+
+		/* set new playhead position */
+		meterec->jack.playhead += nframes ;
+
+		if (event)
+			if (event->type == LOOP)
+				if (meterec->jack.playhead > event->new_playhead) {
+					meterec->jack.playhead -= ( event->new_playhead - event->old_playhead );
+					event_ring_pop(meterec, &meterec->jack_ring);
+					event = NULL;
+				}
+
+	}
+
+	if (playback_ongoing) {
+
+		if (record_ongoing) {
+
+			thread_pos = CURSOR_GET(meterec->write_disk_buffer_thread_pos);
+
+			/* track buffer over/under flow */
+			remaining_write_disk_buffer = meterec->dbuf_size - ((meterec->write_disk_buffer_process_pos-thread_pos) & (meterec->dbuf_size-1));
+
+			if (remaining_write_disk_buffer < meterec->stats.write_min)
+				meterec->stats.write_min = remaining_write_disk_buffer;
+
+			if (remaining_write_disk_buffer <= nframes)
+				meterec->write_disk_buffer_overflow++;
+
+			/* positon write pointer to end of ringbuffer*/
+			CURSOR_SET(meterec->write_disk_buffer_process_pos, (meterec->write_disk_buffer_process_pos + nframes) & (meterec->dbuf_size - 1));
+
+			/* let writer thread know there is data to drain */
+			if (((meterec->write_disk_buffer_process_pos - thread_pos) & (meterec->dbuf_size - 1)) >= DBUF_WAKE)
+				thread_wake(&meterec->writer_wake);
+
+		}
+
+	}
+
+	/* reader thread may free the cache now */
+	if (loop_cached)
+		__atomic_store_n(&cache->active, 0, __ATOMIC_SEQ_CST);
+
+	stats_process(meterec, nframes, now_usec() - start);
+
+	return 0;
+
+}
@@ -0,0 +1,42 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+/*
+note :
+- what an audio backend hands to the process path for one period: jack gives
+  its port buffers, offline backends their own.
+- in[port] and out[port] are NULL for ports not registered (yet), mon is NULL
+  without monitor port.
+- transport is only looked at when meterec->jack_transport is set.
+*/
+struct process_io_s
+{
+	float **in;  /* n_ports buffers each */
+	float **out;
+	float *mon;
+
+	jack_transport_state_t transport_state;
+	jack_nframes_t transport_frame;
+};
+
+int process_data(struct meterec_s *meterec, jack_nframes_t nframes, struct process_io_s *io);
@@ -20,22 +20,31 @@
 
 */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <time.h>
 
 #include <sndfile.h>
 #include <jack/jack.h>
 #include <curses.h>
 
+#include "config.h"
 #include "meterec.h"
+#include "log.h"
 #include "queue.h"
 #include "conf.h"
+#include "clock.h"
+
+static unsigned int event_id=0;
 
-void add_event(struct meterec_s *meterec, unsigned int queue, unsigned int type, jack_nframes_t old_playhead, jack_nframes_t new_playhead, unsigned int buffer_pos) {
+void add_event(struct meterec_s *meterec, unsigned int queue, unsigned int type, unsigned long long old_playhead, unsigned long long new_playhead, unsigned int buffer_pos) {
 
 	struct event_s *event;
-	static unsigned int id=0;
 
 	event = meterec->event;
 
@@ -58,14 +67,17 @@ void add_event(struct meterec_s *meterec, unsigned int queue, unsigned int type,
 		event = event->next;
 	}
 
-	event->id = id;
+	event->id = __atomic_fetch_add(&event_id, 1, __ATOMIC_RELAXED);
 	event->type = type;
 	event->queue = queue;
 	event->old_playhead = old_playhead;
 	event->new_playhead = new_playhead;
 	event->buffer_pos = buffer_pos;
 
-	id++;
+	__atomic_add_fetch(&meterec->event_pending[type], 1, __ATOMIC_RELEASE);
+
+	if (queue == DISK)
+		thread_wake(&meterec->reader_wake);
 }
 
 int event_match(struct event_s *event, unsigned int queue, unsigned int type) {
@@ -135,10 +147,7 @@ struct event_s * find_last_event(struct meterec_s *meterec, unsigned int queue,
 	return NULL;
 }
 
-void rm_event(struct meterec_s *meterec, struct event_s *event) {
-
-	if (event == NULL)
-		return;
+static void unlink_event(struct meterec_s *meterec, struct event_s *event) {
 
 	if (event->prev)
 		event->prev->next = event->next ;
@@ -151,6 +160,17 @@ void rm_event(struct meterec_s *meterec, struct event_s *event) {
 	if (event->prev == NULL && event->next == NULL)
 		meterec->event = NULL;
 
+}
+
+void rm_event(struct meterec_s *meterec, struct event_s *event) {
+
+	if (event == NULL)
+		return;
+
+	unlink_event(meterec, event);
+
+	__atomic_sub_fetch(&meterec->event_pending[event->type], 1, __ATOMIC_RELEASE);
+
 	free(event);
 
 }
@@ -168,9 +188,252 @@ void find_rm_events(struct meterec_s *meterec, unsigned int queue, unsigned int
 
 }
 
+unsigned int event_pending(struct meterec_s *meterec, unsigned int type) {
+
+	return __atomic_load_n(&meterec->event_pending[type], __ATOMIC_ACQUIRE);
+
+}
+
+/*
+** Single producer / single consumer event rings
+*/
+
+void event_ring_init(struct event_ring_s *ring) {
+
+	ring->write = 0;
+	ring->read = 0;
+	ring->discard = 0;
+	ring->discard_loop = 0;
+
+}
+
+/* producer side: copy event in the next free slot, returns 0 if ring is full */
+int event_ring_push(struct event_ring_s *ring, struct event_s *event) {
+
+	unsigned int write;
+
+	write = ring->write;
+
+	if (write - __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE) >= EVENT_RING_SIZE)
+		return 0;
+
+	ring->slot[write & (EVENT_RING_SIZE-1)] = *event;
+	ring->slot[write & (EVENT_RING_SIZE-1)].next = NULL;
+	ring->slot[write & (EVENT_RING_SIZE-1)].prev = NULL;
+
+	__atomic_store_n(&ring->write, write + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/* producer side: build and publish a new event, safe to call from jack process */
+int event_ring_add(struct meterec_s *meterec, struct event_ring_s *ring, unsigned int queue, unsigned int type, unsigned long long old_playhead, unsigned long long new_playhead, unsigned int buffer_pos) {
+
+	struct event_s event;
+
+	event.id = __atomic_fetch_add(&event_id, 1, __ATOMIC_RELAXED);
+	event.type = type;
+	event.queue = queue;
+	event.old_playhead = old_playhead;
+	event.new_playhead = new_playhead;
+	event.buffer_pos = buffer_pos;
+
+	if (!event_ring_push(ring, &event))
+		return 0;
+
+	__atomic_add_fetch(&meterec->event_pending[type], 1, __ATOMIC_RELEASE);
+
+	if (queue == DISK)
+		thread_wake(&meterec->reader_wake);
+
+	return 1;
+}
+
+/* producer side: move an event from the queue to the ring, needs event_mutex */
+int event_ring_post(struct meterec_s *meterec, struct event_ring_s *ring, struct event_s *event) {
+
+	event->queue = JACK;
+
+	if (!event_ring_push(ring, event)) {
+		event->queue = PEND;
+		return 0;
+	}
+
+	/* event is still in flight, do not touch event_pending */
+	unlink_event(meterec, event);
+	free(event);
+
+	return 1;
+}
+
+/* producer side: ask consumer to drop events of that type published so far */
+void event_ring_discard(struct event_ring_s *ring, unsigned int type) {
+
+	if (type == LOOP)
+		__atomic_store_n(&ring->discard_loop, ring->write, __ATOMIC_RELEASE);
+	else
+		__atomic_store_n(&ring->discard, ring->write, __ATOMIC_RELEASE);
+
+}
+
+/* producer side: find the oldest event of that type not yet consumed */
+struct event_s * event_ring_find_first(struct event_ring_s *ring, unsigned int type) {
+
+	unsigned int pos, discard, discard_loop;
+	struct event_s *event;
+
+	discard = ring->discard;
+	discard_loop = ring->discard_loop;
+
+	for (pos = __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE); pos != ring->write; pos++) {
+
+		if ((int)(discard - pos) > 0)
+			continue;
+
+		event = &ring->slot[pos & (EVENT_RING_SIZE-1)];
+
+		if (event->type == LOOP && (int)(discard_loop - pos) > 0)
+			continue;
+
+		if (event_match(event, ALL, type))
+			return event;
+	}
+
+	return NULL;
+}
+
+/* consumer side: oldest event in the ring, skipping discarded ones */
+struct event_s * event_ring_peek(struct meterec_s *meterec, struct event_ring_s *ring) {
+
+	unsigned int read, write, discard, discard_loop;
+	struct event_s *event;
+
+	read = ring->read;
+	write = __atomic_load_n(&ring->write, __ATOMIC_ACQUIRE);
+	discard = __atomic_load_n(&ring->discard, __ATOMIC_ACQUIRE);
+	discard_loop = __atomic_load_n(&ring->discard_loop, __ATOMIC_ACQUIRE);
+
+	/* at most EVENT_RING_SIZE iterations */
+	for ( ; read != write; read++) {
+
+		event = &ring->slot[read & (EVENT_RING_SIZE-1)];
+
+		if ((int)(discard - read) <= 0)
+			if (event->type != LOOP || (int)(discard_loop - read) <= 0)
+				break;
+
+		__atomic_sub_fetch(&meterec->event_pending[event->type], 1, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&ring->read, read, __ATOMIC_RELEASE);
+
+	if (read == write)
+		return NULL;
+
+	return &ring->slot[read & (EVENT_RING_SIZE-1)];
+}
+
+/* consumer side: release the event returned by event_ring_peek */
+void event_ring_pop(struct meterec_s *meterec, struct event_ring_s *ring) {
+
+	struct event_s *event;
+
+	event = &ring->slot[ring->read & (EVENT_RING_SIZE-1)];
+
+	__atomic_sub_fetch(&meterec->event_pending[event->type], 1, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&ring->read, ring->read + 1, __ATOMIC_RELEASE);
+
+}
+
+/* consumer side: move all events of the ring to the queue, needs event_mutex */
+void event_ring_drain(struct meterec_s *meterec, struct event_ring_s *ring) {
+
+	struct event_s *event;
+
+	while ((event = event_ring_peek(meterec, ring))) {
+		add_event(meterec, event->queue, event->type, event->old_playhead, event->new_playhead, event->buffer_pos);
+		event_ring_pop(meterec, ring);
+	}
+
+}
+
+/*
+** Disk threads wake up
+*/
+
+void thread_wake_init(struct wake_s *wake) {
+
+	sem_init(&wake->sem, 0, 0);
+	wake->signaled = 0;
+	wake->time = 0;
+	wake->latency = 0;
+	wake->latency_max = 0;
+
+}
+
+/* safe to call from jack process: no lock, post semaphore once per wake up */
+void thread_wake(struct wake_s *wake) {
+
+	if (__atomic_exchange_n(&wake->signaled, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	__atomic_store_n(&wake->time, now_usec(), __ATOMIC_RELEASE);
+	sem_post(&wake->sem);
+
+}
+
+/* sleep until signaled or timeout (usec), returns 1 if signaled */
+int thread_wait(struct wake_s *wake, unsigned int timeout) {
+
+	struct timespec ts;
+	int ret;
+
+#ifdef HAVE_SEM_CLOCKWAIT
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+	ts.tv_sec  += timeout / 1000000;
+	ts.tv_nsec += (timeout % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec ++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+#ifdef HAVE_SEM_CLOCKWAIT
+	while ((ret = sem_clockwait(&wake->sem, CLOCK_MONOTONIC, &ts)) == -1 && errno == EINTR)
+		continue;
+#else
+	while ((ret = sem_timedwait(&wake->sem, &ts)) == -1 && errno == EINTR)
+		continue;
+#endif
+
+	/* only the waiter consuming the post rearms thread_wake: after a timeout a
+	   concurrent wake still owns its post, the next wait returns on it */
+	if (ret == 0)
+		__atomic_store_n(&wake->signaled, 0, __ATOMIC_RELEASE);
+
+	return ret == 0;
+}
+
+/* call once work requested by last wake up is done, returns 1 on new maximum */
+int thread_wake_done(struct wake_s *wake) {
+
+	wake->latency = now_usec() - __atomic_load_n(&wake->time, __ATOMIC_ACQUIRE);
+
+	if (wake->latency > wake->latency_max) {
+		wake->latency_max = wake->latency;
+		return 1;
+	}
+
+	return 0;
+}
+
 void event_queue_print(struct meterec_s *meterec, unsigned int where) {
 
 	struct event_s *event;
+	unsigned int pos;
 
 	if (where == CURSES)
 		printw(">-------------------------------------------------------\n");
@@ -179,7 +442,7 @@ void event_queue_print(struct meterec_s *meterec, unsigned int where) {
 		printf(">-------------------------------------------------------\n");
 
 	if (where == LOG)
-		fprintf(meterec->fd_log, ">-------------------------------------------------------\n");
+		log_info(meterec, ">-------------------------------------------------------\n");
 
 	event = meterec->event ;
 	while (event) {
@@ -187,6 +450,18 @@ void event_queue_print(struct meterec_s *meterec, unsigned int where) {
 		event = event->next;
 	}
 
+	if (where == CURSES)
+		printw("=-------------------------------------------------------\n");
+
+	if (where == STDOUT)
+		printf("=-------------------------------------------------------\n");
+
+	if (where == LOG)
+		log_info(meterec, "=-------------------------------------------------------\n");
+
+	for (pos = meterec->jack_ring.read; pos != meterec->jack_ring.write; pos++)
+		event_print(meterec, where, &meterec->jack_ring.slot[pos & (EVENT_RING_SIZE-1)]);
+
 	if (where == CURSES)
 		printw("^-------------------------------------------------------\n");
 
@@ -194,7 +469,7 @@ void event_queue_print(struct meterec_s *meterec, unsigned int where) {
 		printf("^-------------------------------------------------------\n");
 
 	if (where == LOG)
-		fprintf(meterec->fd_log, "^-------------------------------------------------------\n");
+		log_info(meterec, "^-------------------------------------------------------\n");
 
 }
 
@@ -209,6 +484,7 @@ void event_print(struct meterec_s *meterec, unsigned int where, struct event_s *
 		case SEEK: stype = "SEEK"; break;
 		case LOCK: stype = "LOCK"; break;
 		case LOOP: stype = "LOOP"; break;
+		case NEWT: stype = "NEWT"; break;
 	}
 
 	switch (event->queue) {
@@ -218,7 +494,7 @@ void event_print(struct meterec_s *meterec, unsigned int where, struct event_s *
 		case PEND: squeue = "PEND"; break;
 	}
 
-	sprintf(out, "id %2d |queue %s |type %s |old %d |new %d |buf %d", event->id, squeue, stype, event->old_playhead, event->new_playhead, event->buffer_pos);
+	sprintf(out, "id %2d |queue %s |type %s |old %lld |new %lld |buf %d", event->id, squeue, stype, event->old_playhead, event->new_playhead, event->buffer_pos);
 
 	if (where == CURSES)
 		printw("%s\n", out);
@@ -227,6 +503,6 @@ void event_print(struct meterec_s *meterec, unsigned int where, struct event_s *
 		printf("%s\n", out);
 
 	if (where == LOG)
-		fprintf(meterec->fd_log, "%s\n", out);
+		log_info(meterec, "%s\n", out);
 
 }
@@ -39,12 +39,28 @@
 #define LOG 3
 
 
-void             add_event        (struct meterec_s *meterec, unsigned int queue, unsigned int type, jack_nframes_t old_playhead, jack_nframes_t new_playhead, unsigned int buffer_pos);
+void             add_event        (struct meterec_s *meterec, unsigned int queue, unsigned int type, unsigned long long old_playhead, unsigned long long new_playhead, unsigned int buffer_pos);
 struct event_s * find_first_event (struct meterec_s *meterec, unsigned int queue, unsigned int type);
 struct event_s * find_last_event  (struct meterec_s *meterec, unsigned int queue, unsigned int type);
 void             rm_event         (struct meterec_s *meterec, struct event_s *event);
 void             find_rm_events   (struct meterec_s *meterec, unsigned int queue, unsigned int type);
 int              event_match      (struct event_s *event, unsigned int queue, unsigned int type);
+unsigned int     event_pending    (struct meterec_s *meterec, unsigned int type);
+
+void             event_ring_init      (struct event_ring_s *ring);
+int              event_ring_push      (struct event_ring_s *ring, struct event_s *event);
+int              event_ring_add       (struct meterec_s *meterec, struct event_ring_s *ring, unsigned int queue, unsigned int type, unsigned long long old_playhead, unsigned long long new_playhead, unsigned int buffer_pos);
+int              event_ring_post      (struct meterec_s *meterec, struct event_ring_s *ring, struct event_s *event);
+void             event_ring_discard   (struct event_ring_s *ring, unsigned int type);
+struct event_s * event_ring_find_first(struct event_ring_s *ring, unsigned int type);
+struct event_s * event_ring_peek      (struct meterec_s *meterec, struct event_ring_s *ring);
+void             event_ring_pop       (struct meterec_s *meterec, struct event_ring_s *ring);
+void             event_ring_drain     (struct meterec_s *meterec, struct event_ring_s *ring);
+
+void             thread_wake_init     (struct wake_s *wake);
+void             thread_wake          (struct wake_s *wake);
+int              thread_wait          (struct wake_s *wake, unsigned int timeout);
+int              thread_wake_done     (struct wake_s *wake);
 
 void             event_queue_print(struct meterec_s *meterec, unsigned int where);
 void             event_print      (struct meterec_s *meterec, unsigned int where, struct event_s *event);
@@ -0,0 +1,63 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+** meterec-recover: repair take files left open by a crash or power loss,
+** so they can be played back or imported in another application.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <aio.h>
+
+#include <sndfile.h>
+
+#include "wavout.h"
+
+int main(int argc, char *argv[])
+{
+	int i, ret, errors = 0;
+	unsigned long long frames;
+
+	if (argc < 2) {
+		fprintf(stderr, "%s take-file [take-file...]\n", argv[0]);
+		fprintf(stderr, "Fix header of WAV/W64 take files that were not closed properly.\n");
+		exit(1);
+	}
+
+	for (i = 1; i < argc; i++) {
+
+		frames = 0;
+		ret = wavout_recover(argv[i], &frames);
+
+		if (ret < 0) {
+			printf("%s: not a WAV/W64 file or cannot be repaired\n", argv[i]);
+			errors++;
+		}
+		else if (ret)
+			printf("%s: repaired, %llu frames\n", argv[i], frames);
+		else
+			printf("%s: ok, %llu frames\n", argv[i], frames);
+	}
+
+	return errors ? 1 : 0;
+}
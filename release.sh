@@ -22,6 +22,7 @@ meterec-$RELEASE/*.c \
 meterec-$RELEASE/*.h \
 meterec-$RELEASE/meterec.1 \
 meterec-$RELEASE/meterec-init-conf.1 \
+meterec-$RELEASE/meterec-recover.1 \
 meterec-$RELEASE/meterec-init-conf \
 meterec-$RELEASE/README \
 meterec-$RELEASE/NEWS \
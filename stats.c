@@ -0,0 +1,208 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <semaphore.h>
+
+#include <curses.h>
+#include <sndfile.h>
+#include <jack/jack.h>
+
+#include "config.h"
+#include "meterec.h"
+#include "stats.h"
+#include "clock.h"
+
+/******************************************************************************
+** HISTOGRAMS
+*/
+
+void stats_init(struct stats_s *stats) {
+
+	memset(stats, 0, sizeof(struct stats_s));
+
+	stats->read_min = MAX_UINT;
+	stats->write_min = MAX_UINT;
+}
+
+/* single writer, no lock: safe from the jack process */
+void hist_add(struct hist_s *hist, unsigned long long value) {
+
+	unsigned int bucket;
+
+	bucket = value ? 64 - __builtin_clzll(value) : 0;
+	if (bucket >= HIST_BUCKETS)
+		bucket = HIST_BUCKETS - 1;
+
+	__atomic_store_n(&hist->count[bucket], hist->count[bucket] + 1, __ATOMIC_RELAXED);
+
+	if (value > hist->max)
+		__atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&hist->n, hist->n + 1, __ATOMIC_RELEASE);
+}
+
+/* upper bound of the bucket holding the percentile, never above max */
+unsigned long long hist_percentile(struct hist_s *hist, unsigned int percent) {
+
+	unsigned long long n, sum = 0, bound, max;
+	unsigned int bucket;
+
+	n = __atomic_load_n(&hist->n, __ATOMIC_ACQUIRE);
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+	if (!n)
+		return 0;
+
+	for (bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+
+		sum += __atomic_load_n(&hist->count[bucket], __ATOMIC_RELAXED);
+
+		if (sum * 100 >= n * percent) {
+			bound = bucket ? (1ull << bucket) - 1 : 0;
+			return bound < max ? bound : max;
+		}
+	}
+
+	return max;
+}
+
+/******************************************************************************
+** PROBES
+*/
+
+/* once per period, from the process path */
+void stats_process(struct meterec_s *meterec, jack_nframes_t nframes, unsigned long long usec) {
+
+	struct stats_s *stats = &meterec->stats;
+	unsigned long long budget;
+	unsigned int bucket;
+
+	if (!meterec->jack.sample_rate)
+		return;
+
+	budget = (unsigned long long)nframes * 1000000 / meterec->jack.sample_rate;
+	if (!budget)
+		return;
+
+	stats->budget = budget;
+
+	hist_add(&stats->cycle, usec);
+
+	bucket = usec * 10 / budget;
+	if (bucket >= LOAD_BUCKETS)
+		bucket = LOAD_BUCKETS - 1;
+
+	__atomic_store_n(&stats->load[bucket], stats->load[bucket] + 1, __ATOMIC_RELAXED);
+}
+
+/* from the jack xrun callback */
+void stats_xrun(struct meterec_s *meterec, float delay) {
+
+	meterec->stats.xrun_delay = delay;
+	__atomic_store_n(&meterec->stats.xruns, meterec->stats.xruns + 1, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+** FILE
+*/
+
+static void stats_write_hist(FILE *fd, const char *name, struct hist_s *hist) {
+
+	fprintf(fd, "  \"%s\": {\"n\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu},\n", name,
+		__atomic_load_n(&hist->n, __ATOMIC_ACQUIRE),
+		hist_percentile(hist, 50), hist_percentile(hist, 90), hist_percentile(hist, 99),
+		__atomic_load_n(&hist->max, __ATOMIC_RELAXED));
+}
+
+/* rewritten as a whole so readers never see half a file */
+int stats_write(struct meterec_s *meterec, const char *file) {
+
+	struct stats_s *stats = &meterec->stats;
+	char *tmp;
+	FILE *fd;
+	unsigned int bucket;
+
+	tmp = (char *) malloc( strlen(file) + strlen(".tmp") + 1 );
+	sprintf(tmp, "%s.tmp", file);
+
+	fd = fopen(tmp, "w");
+	if (!fd) {
+		free(tmp);
+		return -1;
+	}
+
+	fprintf(fd, "{\n");
+	fprintf(fd, "  \"time\": %lld,\n", (long long)time(NULL));
+	fprintf(fd, "  \"budget_usec\": %llu,\n", stats->budget);
+	stats_write_hist(fd, "cycle_usec", &stats->cycle);
+
+	fprintf(fd, "  \"load\": [");
+	for (bucket = 0; bucket < LOAD_BUCKETS; bucket++)
+		fprintf(fd, "%s%llu", bucket ? ", " : "", __atomic_load_n(&stats->load[bucket], __ATOMIC_RELAXED));
+	fprintf(fd, "],\n");
+
+	stats_write_hist(fd, "reader_wake_usec", &stats->reader_wake);
+	stats_write_hist(fd, "writer_wake_usec", &stats->writer_wake);
+
+	fprintf(fd, "  \"read_min_frames\": %d,\n", stats->read_min == MAX_UINT ? -1 : (int)stats->read_min);
+	fprintf(fd, "  \"write_min_frames\": %d,\n", stats->write_min == MAX_UINT ? -1 : (int)stats->write_min);
+	fprintf(fd, "  \"read_overflows\": %u,\n", meterec->read_disk_buffer_overflow);
+	fprintf(fd, "  \"write_overflows\": %u,\n", meterec->write_disk_buffer_overflow);
+	fprintf(fd, "  \"xruns\": %u,\n", __atomic_load_n(&stats->xruns, __ATOMIC_ACQUIRE));
+	fprintf(fd, "  \"xrun_delay_usec\": %.0f\n", stats->xrun_delay);
+	fprintf(fd, "}\n");
+
+	if (fclose(fd) || rename(tmp, file)) {
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	free(tmp);
+
+	return 0;
+}
+
+/* from the main loop, rewrites the stats file every file_s seconds */
+void stats_update(struct meterec_s *meterec) {
+
+	unsigned long long now;
+
+	if (!meterec->stats.file_s || !meterec->stats_file)
+		return;
+
+	now = now_usec();
+
+	if (now - meterec->stats.file_time < (unsigned long long)meterec->stats.file_s * 1000000)
+		return;
+
+	meterec->stats.file_time = now;
+
+	if (stats_write(meterec, meterec->stats_file))
+		fprintf(meterec->fd_log, "Cannot write stats to '%s'.\n", meterec->stats_file);
+}
@@ -0,0 +1,30 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+void               stats_init      (struct stats_s *stats);
+void               hist_add        (struct hist_s *hist, unsigned long long value);
+unsigned long long hist_percentile (struct hist_s *hist, unsigned int percent);
+void               stats_process   (struct meterec_s *meterec, jack_nframes_t nframes, unsigned long long usec);
+void               stats_xrun      (struct meterec_s *meterec, float delay);
+int                stats_write     (struct meterec_s *meterec, const char *file);
+void               stats_update    (struct meterec_s *meterec);
@@ -0,0 +1,396 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+/*
+** Take index: the session directory is read once to find take files, and what
+** libsndfile says about each take is kept in <session>.takes next to them.
+** Takes not modified since they were last seen are neither recovered nor
+** opened at startup; the others are probed by a few threads at once.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <curses.h>
+#include <sndfile.h>
+#include <jack/jack.h>
+
+#include "config.h"
+#include "meterec.h"
+#include "disk.h"
+#include "engine.h"
+#include "takes.h"
+
+struct take_cache_s
+{
+	unsigned int take;
+	long long frames;
+	int channels;
+	int samplerate;
+	int format;
+	long long size;
+	long long mtime;
+	char *file;
+};
+
+struct probe_s
+{
+	struct meterec_s *meterec;
+	unsigned int *take;
+	unsigned int n;
+	unsigned int next;
+};
+
+/******************************************************************************
+** DIRECTORY
+*/
+
+/* take number of 'session_nnnn.ext' or track 'session_nnnn_ttt.ext', 0 otherwise */
+static unsigned int take_of_file(const char *name, const char *session, unsigned int *layout, unsigned int *track) {
+
+	const char *digits;
+	char *end;
+	unsigned long take;
+	size_t len;
+
+	len = strlen(session);
+
+	if (strncmp(name, session, len) || name[len] != '_')
+		return 0;
+
+	digits = name + len + 1;
+
+	if (*digits < '0' || *digits > '9')
+		return 0;
+
+	take = strtoul(digits, &end, 10);
+
+	/* numbered with at least 4 digits, no other leading 0's */
+	if (end - digits < 4 || (end - digits > 4 && *digits == '0'))
+		return 0;
+
+	*track = 0;
+
+	if (*end == '.')
+		*layout = TAKE_INTERLEAVED;
+	else if (end[0] == '_' && isdigit((unsigned char)end[1]) && isdigit((unsigned char)end[2]) && isdigit((unsigned char)end[3]) && end[4] == '.') {
+		*layout = TAKE_TRACKS;
+		*track = atoi(end + 1);
+		if (!*track)
+			return 0;
+	}
+	else
+		return 0;
+
+	if (!take || take >= MAX_TAKES - 2)
+		return 0;
+
+	return (unsigned int)take;
+}
+
+/* one pass on the directory, returns the highest take found */
+static unsigned int takes_scan(struct meterec_s *meterec) {
+
+	struct dirent *entry;
+	struct take_s *take;
+	unsigned int n, layout, track, last = 0;
+	size_t spare_len;
+	DIR *dp;
+
+	dp = opendir(".");
+
+	if (dp == NULL) {
+		fprintf(meterec->fd_log, "Cannot read session directory.\n");
+		return 0;
+	}
+
+	spare_len = strlen(SPARE_PREFIX);
+
+	while ((entry = readdir(dp))) {
+
+		/* next take opened in advance when a crash stopped recording */
+		if (strncmp(entry->d_name, SPARE_PREFIX, spare_len) == 0) {
+			if (take_of_file(entry->d_name + spare_len, meterec->session, &layout, &track)) {
+				fprintf(meterec->fd_log, "Removing unused spare take file '%s'.\n", entry->d_name);
+				unlink(entry->d_name);
+			}
+			continue;
+		}
+
+		n = take_of_file(entry->d_name, meterec->session, &layout, &track);
+
+		if (!n || track > 1)
+			continue;
+
+		take = &meterec->takes[n];
+
+		/* one file per track wins over a take file of the same number */
+		if (take->take_file && (take->layout == TAKE_TRACKS || layout == TAKE_INTERLEAVED))
+			continue;
+
+		free(take->take_file);
+		take->take_file = strdup(entry->d_name);
+		take->layout = layout;
+
+		if (n > last)
+			last = n;
+	}
+
+	closedir(dp);
+
+	return last;
+}
+
+/******************************************************************************
+** METADATA CACHE
+*/
+
+static int file_stat(const char *file, long long *size, long long *mtime) {
+
+	struct stat st;
+
+	if (stat(file, &st))
+		return -1;
+
+	*size = (long long)st.st_size;
+	*mtime = (long long)st.st_mtime * 1000000000LL + st.st_mtim.tv_nsec;
+
+	return 0;
+}
+
+/* entries indexed by take, up to last */
+static struct take_cache_s *takes_cache_read(struct meterec_s *meterec, unsigned int last) {
+
+	struct take_cache_s *cache, entry;
+	char file[4096];
+	FILE *fd;
+
+	cache = (struct take_cache_s *) calloc(last + 1, sizeof(struct take_cache_s));
+
+	if ( (fd = fopen(meterec->takes_file, "r")) == NULL )
+		return cache;
+
+	while (fscanf(fd, "%u %lld %d %d %d %lld %lld %4095s\n", &entry.take, &entry.frames, &entry.channels,
+		&entry.samplerate, &entry.format, &entry.size, &entry.mtime, file) == 8) {
+
+		if (entry.take > last)
+			continue;
+
+		free(cache[entry.take].file);
+		cache[entry.take] = entry;
+		cache[entry.take].file = strdup(file);
+	}
+
+	fclose(fd);
+
+	return cache;
+}
+
+static void takes_cache_free(struct take_cache_s *cache, unsigned int last) {
+
+	unsigned int take;
+
+	for (take = 0; take <= last; take++)
+		free(cache[take].file);
+
+	free(cache);
+}
+
+/* takes with known information, written aside then renamed so a crash never leaves half a cache */
+int takes_cache_write(struct meterec_s *meterec) {
+
+	struct take_s *take;
+	long long size, mtime;
+	unsigned int n;
+	char *tmp;
+	FILE *fd;
+
+	tmp = (char *) malloc( strlen(meterec->takes_file) + strlen(".tmp") + 1 );
+	sprintf(tmp, "%s.tmp", meterec->takes_file);
+
+	if ( (fd = fopen(tmp, "w")) == NULL ) {
+		free(tmp);
+		return -1;
+	}
+
+	/* takes of the session and those found past it */
+	for (n = 1; n < MAX_TAKES - 2 && (n < meterec->n_takes + 1 || meterec->takes[n].info_sts); n++) {
+
+		take = &meterec->takes[n];
+
+		if (!take->info_sts || !take->info.frames || !take->take_file || strchr(take->take_file, ' '))
+			continue;
+
+		if (file_stat(take->take_file, &size, &mtime))
+			continue;
+
+		fprintf(fd, "%u %lld %d %d %d %lld %lld %s\n", n, (long long)take->info.frames, take->info.channels,
+			take->info.samplerate, take->info.format, size, mtime, take->take_file);
+	}
+
+	if (fclose(fd) || rename(tmp, meterec->takes_file)) {
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	free(tmp);
+
+	return 0;
+}
+
+/******************************************************************************
+** PROBING
+*/
+
+static void *probe_thread(void *d) {
+
+	struct probe_s *probe = (struct probe_s *)d;
+	struct meterec_s *meterec = probe->meterec;
+	unsigned int i, take;
+	SF_INFO info;
+	SNDFILE *fd;
+
+	while ((i = __atomic_fetch_add(&probe->next, 1, __ATOMIC_RELAXED)) < probe->n) {
+
+		take = probe->take[i];
+
+		/* fix takes left open by a crash before anybody reads them */
+		recover_take(meterec, take);
+
+		memset(&info, 0, sizeof(info));
+		fd = sf_open(meterec->takes[take].take_file, SFM_READ, &info);
+
+		if (fd) {
+			sf_close(fd);
+			take_set_info(meterec, take, &info);
+		}
+	}
+
+	return (void*)0;
+}
+
+static void takes_probe(struct meterec_s *meterec, unsigned int *take, unsigned int n) {
+
+	pthread_t thread[PROBE_THREADS];
+	struct probe_s probe;
+	unsigned int i, n_threads;
+
+	probe.meterec = meterec;
+	probe.take = take;
+	probe.n = n;
+	probe.next = 0;
+
+	n_threads = n < PROBE_THREADS ? n : PROBE_THREADS;
+
+	for (i = 0; i < n_threads; i++)
+		if (pthread_create(&thread[i], NULL, probe_thread, (void *)&probe))
+			break;
+
+	n_threads = i;
+
+	/* nobody to help, do it here */
+	if (!n_threads)
+		probe_thread((void *)&probe);
+
+	for (i = 0; i < n_threads; i++)
+		pthread_join(thread[i], NULL);
+}
+
+/******************************************************************************
+** STARTUP
+*/
+
+void find_existing_takes(struct meterec_s *meterec) {
+
+	struct take_cache_s *cache, *c;
+	struct take_s *take;
+	unsigned int n, last, n_probe = 0, n_cached = 0, *probe;
+	long long size, mtime;
+	SF_INFO info;
+
+	last = takes_scan(meterec);
+
+	/* takes of the session, then any take recorded past it, up to the first missing one */
+	for (n = meterec->n_takes + 1; n <= last && meterec->takes[n].take_file; n++) ;
+
+	for ( ; n <= last; n++) {
+		free(meterec->takes[n].take_file);
+		meterec->takes[n].take_file = NULL;
+		meterec->takes[n].layout = TAKE_INTERLEAVED;
+	}
+
+	for (last = meterec->n_takes; meterec->takes[last + 1].take_file; last++) ;
+
+	cache = takes_cache_read(meterec, last);
+	probe = (unsigned int *) malloc((last + 1) * sizeof(unsigned int));
+
+	for (n = 1; n <= last; n++) {
+
+		take = &meterec->takes[n];
+
+		if (!take->take_file) {
+			take->take_file = take_default_file(meterec, n);
+			continue;
+		}
+
+		fprintf(meterec->fd_log, "Found existing file '%s' for take %d\n", take->take_file, n);
+
+		c = &cache[n];
+
+		/* same file, not touched since it was last seen */
+		if (c->file && strcmp(c->file, take->take_file) == 0 &&
+			!file_stat(take->take_file, &size, &mtime) && size == c->size && mtime == c->mtime) {
+
+			memset(&info, 0, sizeof(info));
+			info.frames = c->frames;
+			info.channels = c->channels;
+			info.samplerate = c->samplerate;
+			info.format = c->format;
+
+			take_set_info(meterec, n, &info);
+			n_cached++;
+			continue;
+		}
+
+		probe[n_probe++] = n;
+	}
+
+	takes_probe(meterec, probe, n_probe);
+
+	fprintf(meterec->fd_log, "Take index: %d take(s) known from '%s', %d probed.\n", n_cached, meterec->takes_file, n_probe);
+
+	if (n_probe && takes_cache_write(meterec))
+		fprintf(meterec->fd_log, "Cannot write '%s'.\n", meterec->takes_file);
+
+	free(probe);
+	takes_cache_free(cache, last);
+}
@@ -28,6 +28,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <signal.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <sched.h>
+#include <aio.h>
 
 #include <sndfile.h>
 #include <jack/jack.h>
@@ -42,6 +46,15 @@
 #include "conf.h"
 #include "ports.h"
 #include "queue.h"
+#include "wavmap.h"
+#include "wavout.h"
+#include "dsp.h"
+#include "process.h"
+#include "backend.h"
+#include "log.h"
+#include "stats.h"
+#include "engine.h"
+#include "clock.h"
 
 void p(struct meterec_s *meterec) {
 
@@ -49,16 +62,681 @@ void p(struct meterec_s *meterec) {
 
 	event = meterec->event ;
 	while (event) {
-		printf("queue %d - type %d - old %d - new %d - buf %d\n", event->queue , event->type,event->old_playhead, event->new_playhead, event->buffer_pos);
+		printf("queue %d - type %d - old %lld - new %lld - buf %d\n", event->queue , event->type,event->old_playhead, event->new_playhead, event->buffer_pos);
 		event = event->next;
 	}
 	printf("================================================================================\n");
 }
 
+void r(struct meterec_s *meterec, struct event_ring_s *ring) {
+
+	unsigned int pos;
+	struct event_s *event;
+
+	for (pos = ring->read; pos != ring->write; pos++) {
+		event = &ring->slot[pos & (EVENT_RING_SIZE-1)];
+		printf("queue %d - type %d - old %lld - new %lld - buf %d\n", event->queue , event->type,event->old_playhead, event->new_playhead, event->buffer_pos);
+	}
+	printf("pending seek %d - loop %d - lock %d\n", meterec->event_pending[SEEK], meterec->event_pending[LOOP], meterec->event_pending[LOCK]);
+	printf("================================================================================\n");
+}
+
+void w(const char *file) {
+
+	/* 2 channels 16 bits wav holding 5 frames, then a chunk after data */
+	static const unsigned char wav[] = {
+		'R','I','F','F', 56,0,0,0, 'W','A','V','E',
+		'f','m','t',' ', 16,0,0,0, 1,0, 2,0, 0x44,0xAC,0,0, 0x10,0xB1,0x02,0, 4,0, 16,0,
+		'd','a','t','a', 20,0,0,0,
+		0x00,0x00, 0x00,0x80, 0x00,0x40, 0x00,0xC0, 0xFF,0x7F, 0x01,0x00, 0x00,0x20, 0x00,0xE0, 0x00,0x10, 0x00,0xF0 };
+	struct wavmap_s *map;
+	float buf[10];
+	FILE *fd;
+	int i, n;
+
+	fd = fopen(file, "w");
+	fwrite(wav, sizeof(wav), 1, fd);
+	fclose(fd);
+
+	map = wavmap_open(file, 4);
+	printf("wavmap %s channels %d width %d frames %d\n", map ? "mapped" : "failed", map ? map->channels : 0, map ? map->width : 0, map ? (int)map->frames : 0);
+
+	if (map) {
+		n = wavmap_read_float(map, buf, 6);
+		printf("read %d:", n);
+		for (i=0; i<n; i++)
+			printf(" %.5f", buf[i]);
+		printf("\n");
+
+		printf("seek 4 %d, seek 6 %d, seek end %d\n", (int)wavmap_seek(map, 4, SEEK_SET), (int)wavmap_seek(map, 6, SEEK_SET), (int)wavmap_seek(map, 0, SEEK_END));
+
+		wavmap_seek(map, 4, SEEK_SET);
+		n = wavmap_read_float(map, buf, 10);
+		printf("read at 4 %d: %.5f %.5f\n", n, buf[0], buf[1]);
+
+		wavmap_close(map);
+	}
+
+	/* take decoded in memory, as preload mode does */
+	map = wavmap_alloc(2, 5);
+	if (map) {
+		for (i=0; i<10; i++)
+			((float *)map->base)[i] = i / 10.0f;
+
+		wavmap_seek(map, 3, SEEK_SET);
+		n = wavmap_read_float(map, buf, 10);
+		printf("ram read at 3 %d: %.1f %.1f %.1f %.1f\n", n, buf[0], buf[1], buf[2], buf[3]);
+
+		wavmap_close(map);
+	}
+
+	unlink(file);
+}
+
+void l(void) {
+
+	/* loop played from RAM wraps at its end, end is crossfaded into what precedes its start */
+	float mem[12], out[10];
+	unsigned int i, pos;
+
+	for (i=0; i<12; i++)
+		mem[i] = i;
+
+	pos = dsp_loop_read(out, mem + 2, 10, 7, 10);
+	printf("loop read pos %d:", pos);
+	for (i=0; i<10; i++)
+		printf(" %.0f", out[i]);
+	printf("\n");
+
+	pos = dsp_loop_read(out, mem + 2, 10, pos, 3);
+	printf("loop read again pos %d: %.0f %.0f %.0f\n", pos, out[0], out[1], out[2]);
+
+	dsp_crossfade(mem + 10, mem, 2);
+	printf("crossfade %.3f %.3f\n", mem[10], mem[11]);
+
+	/* silence written across the end of a disk buffer */
+	for (i=0; i<10; i++)
+		out[i] = 1;
+	dsp_ring_zero(out, 8, 10, 4);
+	printf("ring zero:");
+	for (i=0; i<10; i++)
+		printf(" %.0f", out[i]);
+	printf("\n");
+
+	/* track drained across the end of a disk buffer into interleaved 'buffer zero' */
+	for (i=0; i<12; i++)
+		mem[i] = i + 1;
+	for (i=0; i<10; i++)
+		out[i] = 0;
+	dsp_ring_interleave(out + 1, 3, mem, 10, 12, 3);
+	printf("ring interleave:");
+	for (i=0; i<10; i++)
+		printf(" %.0f", out[i]);
+	printf("\n");
+}
+
+void b(const char *in_file, const char *out_file) {
+
+	/* run the process path from a file backend, ports pass input thru */
+	struct meterec_s *meterec;
+	struct backend_s backend;
+	struct wavout_s *out;
+	struct wavmap_s *map;
+	float buf[2000], back[3000];
+	int i, n, errors = 0;
+
+	for (i=0; i<2000; i++)
+		buf[i] = (i % 100) / 100.0f;
+
+	out = wavout_open(in_file, SF_FORMAT_W64 | SF_FORMAT_PCM_32, 2, 48000, WAVOUT_SYNC);
+	wavout_writef_float(out, buf, 1000);
+	wavout_close(out);
+
+	meterec = calloc(1, sizeof(struct meterec_s));
+	meterec->ports = calloc(3, sizeof(struct port_s));
+	meterec->n_ports = 3;
+	for (i=0; i<3; i++) {
+		meterec->ports[i].thru = 1;
+		meterec->ports[i].silent = 1;
+	}
+
+	/* playback of nothing but silence, playhead follows the frames fed */
+	meterec->playback_cmd = START;
+	meterec->dbuf_size = DBUF_MIN;
+	thread_wake_init(&meterec->reader_wake);
+
+	memset(&backend, 0, sizeof(backend));
+	backend.type = BACKEND_FILE;
+	backend.period = 64;
+	backend.sample_rate = 48000;
+	backend.in_file = in_file;
+	backend.out_file = out_file;
+
+	printf("backend start %d\n", backend_start(meterec, &backend));
+	backend_wait(&backend);
+	printf("backend frames %llu late %llu peak in %.2f %.2f %.2f\n", backend.done, backend.late,
+		meterec->ports[0].peak_in, meterec->ports[1].peak_in, meterec->ports[2].peak_in);
+	printf("backend playhead %llu\n", meterec->jack.playhead);
+
+	map = wavmap_open(out_file, 0);
+	if (map) {
+		n = wavmap_read_float(map, back, 3000) / 3;
+		for (i=0; i<n; i++)
+			if (fabsf(back[i*3] - buf[i*2]) > 1e-6 || fabsf(back[i*3+1] - buf[i*2+1]) > 1e-6 || back[i*3+2] != 0.0f)
+				errors++;
+		printf("backend captured %d frames, %d errors\n", n, errors);
+		wavmap_close(map);
+	}
+
+	free(meterec->ports);
+	free(meterec);
+	unlink(in_file);
+	unlink(out_file);
+}
+
+void h(const char *file) {
+
+	/* log2 histograms, load buckets against the period and the stats file */
+	struct meterec_s *meterec;
+	char line[200];
+	FILE *fd;
+	unsigned int i, lines = 0, xruns = 0;
+
+	meterec = calloc(1, sizeof(struct meterec_s));
+	stats_init(&meterec->stats);
+	meterec->jack.sample_rate = 48000;
+
+	for (i=0; i<1000; i++)
+		hist_add(&meterec->stats.cycle, i);
+	printf("hist n %llu p50 %llu p99 %llu p100 %llu max %llu\n", meterec->stats.cycle.n,
+		hist_percentile(&meterec->stats.cycle, 50), hist_percentile(&meterec->stats.cycle, 99),
+		hist_percentile(&meterec->stats.cycle, 100), meterec->stats.cycle.max);
+
+	stats_process(meterec, 480, 500);
+	stats_process(meterec, 480, 9999);
+	stats_process(meterec, 480, 20000);
+	stats_xrun(meterec, 1234.0f);
+	printf("load budget %llu bucket0 %llu bucket9 %llu over %llu xruns %d\n", meterec->stats.budget,
+		meterec->stats.load[0], meterec->stats.load[9], meterec->stats.load[LOAD_BUCKETS-1], meterec->stats.xruns);
+
+	printf("stats write %d\n", stats_write(meterec, file));
+
+	fd = fopen(file, "r");
+	while (fd && fgets(line, sizeof(line), fd)) {
+		sscanf(line, " \"xruns\": %u", &xruns);
+		lines++;
+	}
+	if (fd)
+		fclose(fd);
+	printf("stats file %d lines, %d xrun(s)\n", lines, xruns);
+
+	free(meterec);
+	unlink(file);
+}
+
+static void *g_thread(void *d) {
+
+	struct meterec_s *meterec = (struct meterec_s *)d;
+	char text[300];
+	int i;
+
+	log_thread(meterec, LOG_READER);
+
+	memset(text, 'x', sizeof(text) - 1);
+	text[sizeof(text) - 1] = '\0';
+	log_error(meterec, "long %s\n", text);
+
+	for (i=0; i<1000; i++)
+		log_info(meterec, "msg %d\n", i);
+
+	return NULL;
+}
+
+void g(const char *file) {
+
+	/* a burst from a thread with a ring, every message is written or counted lost */
+	struct meterec_s *meterec;
+	pthread_t thread;
+	FILE *fd;
+	char line[400];
+	unsigned int lines = 0, lost = 0, n, cut = 0, direct = 0;
+
+	meterec = calloc(1, sizeof(struct meterec_s));
+	meterec->fd_log = fopen(file, "w");
+
+	log_start(meterec);
+	log_info(meterec, "direct\n");
+	pthread_create(&thread, NULL, g_thread, meterec);
+	pthread_join(thread, NULL);
+	log_stop(meterec);
+	fclose(meterec->fd_log);
+
+	fd = fopen(file, "r");
+	while (fgets(line, sizeof(line), fd)) {
+		if (strncmp(line, "msg ", 4) == 0)
+			lines++;
+		else if (sscanf(line, "Logger thread: %u message(s) lost.", &n) == 1)
+			lost += n;
+		else if (strncmp(line, "long ", 5) == 0)
+			cut = (strlen(line) == LOG_MSG_LEN - 1 + 4 && strcmp(line + LOG_MSG_LEN - 1, "...\n") == 0);
+		else if (strcmp(line, "direct\n") == 0)
+			direct++;
+	}
+	fclose(fd);
+
+	printf("log %u messages written or lost, %u direct, long message %s\n", lines + lost, direct, cut ? "cut" : "not cut");
+
+	free(meterec);
+	unlink(file);
+}
+
+#define E_FRAMES 100000
+#define E_EVENTS 200000
+#define E_WAIT_USEC 1000000
+
+/* disk threads need it, meterec.c is not linked in */
+void exit_on_error(char * reason) {
+
+	printf("Error: %s\n", reason);
+	exit(1);
+}
+
+float e_take(unsigned long long frame, unsigned int track) {
+
+	return (float)((int)(frame * (track + 1) % 4096) - 2048) / 2048.0f;
+}
+
+float e_in(unsigned long long frame, unsigned int port) {
+
+	return (float)((int)(frame * (port + 3) % 2048) - 1024) / 1024.0f;
+}
+
+/* runs in the backend thread : keep the disk threads ahead of process like jack would expect */
+void e_period(struct backend_s *backend, unsigned long long usec) {
+
+	struct meterec_s *meterec = backend->meterec;
+	unsigned long long start;
+
+	start = now_usec();
+
+	while (meterec->dbuf_size - ((meterec->read_disk_buffer_process_pos - CURSOR_GET(meterec->read_disk_buffer_thread_pos)) & (meterec->dbuf_size - 1)) <= 2 * backend->period && now_usec() - start < E_WAIT_USEC)
+		usleep(100);
+
+	while (meterec->dbuf_size - ((meterec->write_disk_buffer_process_pos - CURSOR_GET(meterec->write_disk_buffer_thread_pos)) & (meterec->dbuf_size - 1)) <= 2 * backend->period && now_usec() - start < E_WAIT_USEC)
+		usleep(100);
+}
+
+void e(void) {
+
+	/* play back a take and record another thru the real process, reader and writer threads */
+	struct meterec_s *meterec;
+	struct backend_s backend;
+	struct wavout_s *out;
+	struct wavmap_s *map;
+	struct take_s *take;
+	pthread_t reader, writer;
+	float buf[2 * 1000];
+	unsigned int i, port, n, apart, play_errors = 0, rec_errors = 0;
+	unsigned long long frame, played = 0, recorded = 0;
+
+	meterec = calloc(1, sizeof(struct meterec_s));
+
+	apart = (char*)&meterec->write_disk_buffer_process_pos - (char*)&meterec->write_disk_buffer_thread_pos >= CACHE_LINE &&
+		(char*)&meterec->read_disk_buffer_thread_pos - (char*)&meterec->write_disk_buffer_process_pos >= CACHE_LINE &&
+		(char*)&meterec->read_disk_buffer_process_pos - (char*)&meterec->read_disk_buffer_thread_pos >= CACHE_LINE;
+	printf("cursors %s\n", apart ? "apart" : "sharing lines");
+
+	init_ports(meterec);
+	init_takes(meterec);
+	pre_option_init(meterec);
+
+	meterec->fd_log = fopen("test_engine.log", "w");
+	log_start(meterec);
+
+	free(meterec->session);
+	meterec->session = strdup("test_engine");
+	meterec->output_ext = strdup("w64");
+	meterec->output_fmt = SF_FORMAT_W64 | SF_FORMAT_PCM_32;
+	alloc_ports(meterec, 2);
+	meterec->n_ports = 2;
+	meterec->jack.sample_rate = 48000;
+
+	/* smallest disk buffers, so both rings wrap many times */
+	meterec->dbuf_ms_opt = 1;
+	disk_alloc_buffers(meterec, meterec->n_ports);
+
+	/* take 1 holds both ports, take 2 gets recorded */
+	take = &meterec->takes[1];
+	take->take_file = take_default_file(meterec, 1);
+	take->layout = TAKE_INTERLEAVED;
+	for (port = 0; port < 2; port++) {
+		take_set_track(meterec, 1, take->ntrack, port);
+		take->ntrack++;
+	}
+	meterec->n_takes = 1;
+
+	out = wavout_open(take->take_file, SF_FORMAT_W64 | SF_FORMAT_PCM_32, 2, 48000, WAVOUT_SYNC);
+	for (frame = 0; frame < E_FRAMES; frame += n) {
+		n = E_FRAMES - frame < 1000 ? E_FRAMES - frame : 1000;
+		for (i = 0; i < n; i++)
+			for (port = 0; port < 2; port++)
+				buf[i * 2 + port] = e_take(frame + i, port);
+		wavout_writef_float(out, buf, n);
+	}
+	wavout_close(out);
+
+	out = wavout_open("test_engine_in.w64", SF_FORMAT_W64 | SF_FORMAT_PCM_32, 2, 48000, WAVOUT_SYNC);
+	for (frame = 0; frame < E_FRAMES; frame += n) {
+		n = E_FRAMES - frame < 1000 ? E_FRAMES - frame : 1000;
+		for (i = 0; i < n; i++)
+			for (port = 0; port < 2; port++)
+				buf[i * 2 + port] = e_in(frame + i, port);
+		wavout_writef_float(out, buf, n);
+	}
+	wavout_close(out);
+
+	meterec->disk_cmd = START;
+	pthread_create(&reader, NULL, reader_thread, (void *)meterec);
+	while (__atomic_load_n(&meterec->disk_sts, __ATOMIC_ACQUIRE) != ONGOING)
+		usleep(100);
+
+	/* overdub keeps playback going on recorded ports */
+	for (port = 0; port < 2; port++)
+		meterec->ports[port].record = DUB;
+	compute_tracks_to_record(meterec);
+
+	meterec->record_cmd = START;
+	pthread_create(&writer, NULL, writer_thread, (void *)meterec);
+	while (__atomic_load_n(&meterec->record_sts, __ATOMIC_ACQUIRE) != ONGOING)
+		usleep(100);
+
+	meterec->playback_cmd = START;
+
+	memset(&backend, 0, sizeof(backend));
+	backend.type = BACKEND_FILE;
+	backend.period = 64;
+	backend.sample_rate = 48000;
+	backend.in_file = "test_engine_in.w64";
+	backend.out_file = "test_engine_out.w64";
+	backend.period_done = e_period;
+
+	backend_start(meterec, &backend);
+	backend_wait(&backend);
+
+	__atomic_store_n(&meterec->record_cmd, STOP, __ATOMIC_RELEASE);
+	thread_wake(&meterec->writer_wake);
+	pthread_join(writer, NULL);
+
+	__atomic_store_n(&meterec->disk_cmd, STOP, __ATOMIC_RELEASE);
+	thread_wake(&meterec->reader_wake);
+	pthread_join(reader, NULL);
+
+	/* out ports carry take 1 a frame late (reader starts a frame ahead of process), take 2 carries in ports */
+	map = wavmap_open("test_engine_out.w64", 0);
+	if (map) {
+		while ((n = wavmap_read_float(map, buf, 1000) / 2)) {
+			for (i = 0; i < n; i++)
+				for (port = 0; port < 2; port++)
+					if (fabsf(buf[i * 2 + port] - (played + i ? e_take(played + i - 1, port) : 0.0f)) > 1e-6)
+						play_errors++;
+			played += n;
+		}
+		wavmap_close(map);
+	}
+
+	map = wavmap_open(meterec->takes[2].take_file, 0);
+	if (map) {
+		while ((n = wavmap_read_float(map, buf, 1000) / 2)) {
+			for (i = 0; i < n; i++)
+				for (port = 0; port < 2; port++)
+					if (fabsf(buf[i * 2 + port] - e_in(recorded + i, port)) > 1e-6)
+						rec_errors++;
+			recorded += n;
+		}
+		wavmap_close(map);
+	}
+
+	printf("engine %llu frames played back, %u errors, %llu frames recorded, %u errors\n", played, play_errors, recorded, rec_errors);
+
+	for (i = 1; i <= MAX_TAKES - 1 && meterec->takes[i].take_file; i++)
+		unlink(meterec->takes[i].take_file);
+	unlink("test_engine_in.w64");
+	unlink("test_engine_out.w64");
+
+	free_ports(meterec);
+	free_takes(meterec);
+	log_stop(meterec);
+	fclose(meterec->fd_log);
+	unlink("test_engine.log");
+
+	free(meterec->session);
+	free(meterec->output_ext);
+	free(meterec);
+}
+
+struct q_s
+{
+	struct meterec_s *meterec;
+	unsigned int done;
+};
+
+void *q_thread(void *arg) {
+
+	/* producer side : post seeks in order, drop the pending ones now and then */
+	struct q_s *q = arg;
+	unsigned int i;
+
+	for (i = 0; i < E_EVENTS; i++) {
+		while (!event_ring_add(q->meterec, &q->meterec->jack_ring, JACK, SEEK, MAX_FRAME, i, i))
+			sched_yield();
+		if (i % 1000 == 999)
+			event_ring_discard(&q->meterec->jack_ring, SEEK);
+	}
+
+	__atomic_store_n(&q->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+void q(void) {
+
+	/* consumer side : events come out in the order they went in */
+	struct meterec_s *meterec;
+	struct event_s *event;
+	struct q_s arg;
+	pthread_t thread;
+	unsigned int bad = 0, got = 0;
+	long long last = -1;
+
+	meterec = calloc(1, sizeof(struct meterec_s));
+	event_ring_init(&meterec->jack_ring);
+
+	arg.meterec = meterec;
+	arg.done = 0;
+
+	pthread_create(&thread, NULL, q_thread, &arg);
+
+	for (;;) {
+		if (__atomic_load_n(&arg.done, __ATOMIC_ACQUIRE)) {
+			if (!(event = event_ring_peek(meterec, &meterec->jack_ring)))
+				break;
+		}
+		else if (!(event = event_ring_peek(meterec, &meterec->jack_ring))) {
+			sched_yield();
+			continue;
+		}
+		if ((long long)event->new_playhead <= last || event->buffer_pos != event->new_playhead)
+			bad++;
+		last = event->new_playhead;
+		got++;
+		event_ring_pop(meterec, &meterec->jack_ring);
+	}
+
+	pthread_join(thread, NULL);
+
+	printf("event rings %u events across threads, %s, %u out of order, %d pending\n", E_EVENTS,
+		got ? "delivered" : "none delivered", bad, meterec->event_pending[SEEK]);
+
+	free(meterec);
+}
+
+unsigned long long t_run(struct meterec_s *meterec, unsigned long long frames) {
+
+	struct backend_s backend;
+
+	memset(&backend, 0, sizeof(backend));
+	backend.type = BACKEND_NULL;
+	backend.period = 256;
+	backend.sample_rate = 192000;
+	backend.frames = frames;
+
+	backend_start(meterec, &backend);
+	backend_wait(&backend);
+
+	return meterec->jack.playhead;
+}
+
+void t(void) {
+
+	/* positions past 2^32 frames, over 6 hours at 192kHz */
+	struct meterec_s *meterec;
+	struct time_s time;
+	char time_str[40];
+	unsigned long long base, low, high, got;
+	float ring[8192], wring[8192], loop[1000];
+
+	base = 192000ULL * 44739 + 192 * 243;
+	time_init_frm(&time, 192000, base);
+	time_sprint(&time, time_str);
+	time_init_hms(&time, 192000, time.h, time.m, time.s, time.ms);
+	printf("time %s back to frame %s\n", time_str, time.frm == base ? "ok" : "wrong");
+
+	meterec = calloc(1, sizeof(struct meterec_s));
+	meterec->ports = calloc(1, sizeof(struct port_s));
+	meterec->loop_cache.data = calloc(1, sizeof(float *));
+	meterec->n_ports = 1;
+	meterec->dbuf_size = 8192;
+	meterec->ports[0].read_disk_buffer = ring;
+	meterec->ports[0].write_disk_buffer = wring;
+	meterec->playback_cmd = START;
+	event_ring_init(&meterec->jack_ring);
+	event_ring_init(&meterec->disk_ring);
+	thread_wake_init(&meterec->reader_wake);
+	thread_wake_init(&meterec->writer_wake);
+
+	/* play across 2^32 */
+	base = (1ULL << 32) - 1000;
+	meterec->jack.playhead = base;
+	got = t_run(meterec, 10240);
+	printf("play from 2^32-1000: %s\n", got == base + 10240 ? "ok" : "wrong");
+
+	/* seek handed back by the reader thread */
+	base = (3ULL << 32) + 5;
+	event_ring_add(meterec, &meterec->jack_ring, JACK, SEEK, MAX_FRAME, base, 0);
+	got = t_run(meterec, 10240);
+	printf("seek to 3*2^32+5: %s\n", got == base + 10240 ? "ok" : "wrong");
+
+	/* loop point in the disk buffer */
+	low = 5ULL << 32;
+	high = low + 3000;
+	meterec->jack.playhead = low;
+	event_ring_add(meterec, &meterec->jack_ring, JACK, LOOP, low, high, 0);
+	got = t_run(meterec, 10240);
+	printf("disk loop at 5*2^32: %s\n", got == low + 10240 - 3000 ? "ok" : "wrong");
+
+	/* loop played from RAM */
+	low = (6ULL << 32) + 7;
+	high = low + 1000;
+	memset(loop, 0, sizeof(loop));
+	meterec->loop.low = meterec->loop_cache.low = low;
+	meterec->loop.high = meterec->loop_cache.high = high;
+	meterec->loop.enable = 1;
+	meterec->loop_cache.data[0] = loop;
+	meterec->loop_cache.ready = 1;
+	meterec->jack.playhead = low + 10;
+	got = t_run(meterec, 10240);
+	printf("RAM loop at 6*2^32+7: %s\n", got == low + (10 + 10240) % 1000 ? "ok" : "wrong");
+
+	free(meterec->loop_cache.data);
+	free(meterec->ports);
+	free(meterec);
+}
+
+void o(const char *file) {
+
+	/* write a take thru wavout then read it back mapped */
+	struct wavout_s *out;
+	struct wavmap_s *map;
+	float buf[3000], back[3000];
+	int i, j, n, errors = 0;
+	unsigned long long frames = 0;
+	unsigned char zero[8] = { 0 };
+	FILE *fd;
+
+	for (i=0; i<3000; i++)
+		buf[i] = (i % 200) / 100.0f - 1.0f;
+
+	out = wavout_open(file, SF_FORMAT_W64 | SF_FORMAT_PCM_24, 3, 48000, WAVOUT_ASYNC);
+	if (!out) {
+		printf("wavout failed\n");
+		return;
+	}
+
+	/* more than WAVOUT_BUF_SIZE bytes so buffers are flushed and samples straddle them */
+	for (i=0; i<40; i++)
+		wavout_writef_float(out, buf, 1000);
+
+	printf("wavout close %d\n", wavout_close(out));
+
+	map = wavmap_open(file, 0);
+	printf("wavout frames %d\n", map ? (int)map->frames : 0);
+
+	if (map) {
+		for (i=0; i<40; i++) {
+			n = wavmap_read_float(map, back, 3000);
+			for (j=0; j<3000; j++)
+				if (n != 3000 || fabsf(buf[j] - back[j]) > 1.0f / 0x800000)
+					errors++;
+		}
+		printf("wavout read back errors %d\n", errors);
+		wavmap_close(map);
+	}
+
+	/* crash before any checkpoint: sizes are 0 and last frame is partial */
+	printf("recover clean %d", wavout_recover(file, &frames));
+	printf(" frames %llu\n", frames);
+
+	fd = fopen(file, "r+");
+	fseek(fd, WAVOUT_ALIGN - 8, SEEK_SET);
+	fwrite(zero, 8, 1, fd);
+	fseek(fd, 0, SEEK_END);
+	fwrite(zero, 5, 1, fd);
+	fclose(fd);
+
+	printf("recover crashed %d", wavout_recover(file, &frames));
+	printf(" frames %llu\n", frames);
+
+	/* crash after a checkpoint: header has less frames than the file */
+	fd = fopen(file, "a");
+	fwrite(buf, 9 * 100, 1, fd);
+	fclose(fd);
+
+	printf("recover checkpoint %d", wavout_recover(file, &frames));
+	printf(" frames %llu\n", frames);
+
+	map = wavmap_open(file, 0);
+	printf("recovered frames %d\n", map ? (int)map->frames : 0);
+	wavmap_close(map);
+
+	unlink(file);
+}
+
 int main(int argc, char *argv[])
 {
 	int opt;
+	unsigned int i;
 	struct event_s *event;
+	int posts;
 	struct meterec_s *meterec;
 
 	while ((opt = getopt(argc, argv, "hv")) != -1) {
@@ -78,6 +756,13 @@ int main(int argc, char *argv[])
 
 	meterec->event = NULL;
 
+	event_ring_init(&meterec->jack_ring);
+	event_ring_init(&meterec->disk_ring);
+
+	for (i=0; i<MAX_EVENT_TYPES; i++)
+		meterec->event_pending[i] = 0;
+
+	thread_wake_init(&meterec->reader_wake);
 
 	add_event(meterec,1,1,1,1,1);
 	p(meterec);
@@ -127,6 +812,59 @@ int main(int argc, char *argv[])
 	find_rm_events(meterec, 3, 0);
 	p(meterec);
 
+	/* event rings */
+	event_ring_add(meterec, &meterec->jack_ring, JACK, LOOP, 1, 2, 1);
+	event_ring_add(meterec, &meterec->jack_ring, JACK, SEEK, 1, 2, 2);
+	event_ring_add(meterec, &meterec->jack_ring, JACK, LOOP, 1, 2, 3);
+	r(meterec, &meterec->jack_ring);
+
+	event = event_ring_find_first(&meterec->jack_ring, SEEK);
+	printf("first seek buf %d\n", event ? event->buffer_pos : 0);
+
+	event_ring_discard(&meterec->jack_ring, LOOP);
+	event = event_ring_peek(meterec, &meterec->jack_ring);
+	printf("peek after loop discard buf %d\n", event ? event->buffer_pos : 0);
+	event_ring_pop(meterec, &meterec->jack_ring);
+	event = event_ring_peek(meterec, &meterec->jack_ring);
+	printf("peek after pop %s\n", event ? "event" : "empty");
+	r(meterec, &meterec->jack_ring);
+
+	for (i=0; event_ring_add(meterec, &meterec->disk_ring, DISK, SEEK, 1, i, 1); i++) ;
+	printf("ring full after %d events\n", i);
+	r(meterec, &meterec->disk_ring);
+
+	event_ring_drain(meterec, &meterec->disk_ring);
+	r(meterec, &meterec->disk_ring);
+
+	event = find_last_event(meterec, DISK, SEEK);
+	printf("last drained seek new %lld\n", event ? event->new_playhead : 0ULL);
+
+	find_rm_events(meterec, DISK, 0);
+	p(meterec);
+	r(meterec, &meterec->disk_ring);
+
+	/* disk thread wake up */
+	thread_wait(&meterec->reader_wake, 1000);
+	thread_wake(&meterec->reader_wake);
+	thread_wake(&meterec->reader_wake);
+	sem_getvalue(&meterec->reader_wake.sem, &posts);
+	printf("posts pending %d\n", posts);
+	printf("wait after wake %d\n", thread_wait(&meterec->reader_wake, 1000));
+	printf("wait without wake %d\n", thread_wait(&meterec->reader_wake, 1000));
+
+	dsp_init(DSP_AUTO);
+	l();
+
+	/* memory mapped take */
+	w("test_wavmap.wav");
+	o("test_wavout.w64");
+	b("test_backend_in.w64", "test_backend_out.w64");
+	g("test_log.log");
+	h("test_stats.json");
+	e();
+	q();
+	t();
+
 	free(meterec);
 
 	return 0;
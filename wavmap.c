@@ -0,0 +1,352 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <sndfile.h>
+
+#include "wavmap.h"
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+static const unsigned char w64_riff[16] = { 'r','i','f','f', 0x2E,0x91,0xCF,0x11, 0xA5,0xD6,0x28,0xDB, 0x04,0xC1,0x00,0x00 };
+static const unsigned char w64_wave[16] = { 'w','a','v','e', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1,0x00,0xC0, 0x4F,0x8E,0xDB,0x8A };
+static const unsigned char w64_fmt [16] = { 'f','m','t',' ', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1,0x00,0xC0, 0x4F,0x8E,0xDB,0x8A };
+static const unsigned char w64_data[16] = { 'd','a','t','a', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1,0x00,0xC0, 0x4F,0x8E,0xDB,0x8A };
+
+/* little endian header fields, also used by wavout */
+unsigned int wav_le16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+unsigned int wav_le32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+unsigned long long wav_le64(const unsigned char *p) {
+	return (uint64_t)wav_le32(p) | ((uint64_t)wav_le32(p + 4) << 32);
+}
+
+/* check 'fmt ' chunk describes a layout we know how to convert */
+static int wavmap_fmt(struct wavmap_s *map, const unsigned char *fmt, uint64_t size) {
+
+	unsigned int tag, bits, align;
+
+	if (size < 16)
+		return 0;
+
+	tag = wav_le16(fmt);
+	map->channels = wav_le16(fmt + 2);
+	align = wav_le16(fmt + 12);
+	bits = wav_le16(fmt + 14);
+
+	/* extensible format carries the real format tag in its sub format GUID */
+	if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 26)
+		tag = wav_le16(fmt + 24);
+
+	map->width = bits / 8;
+	map->is_float = (tag == WAVE_FORMAT_IEEE_FLOAT);
+
+	if (!map->channels || bits % 8 || align != map->width * map->channels)
+		return 0;
+
+	if (tag == WAVE_FORMAT_PCM)
+		return (map->width == 2 || map->width == 3 || map->width == 4);
+
+	if (tag == WAVE_FORMAT_IEEE_FLOAT)
+		return (map->width == 4);
+
+	return 0;
+}
+
+/* walk chunks of a WAV (RIFF, 4 bytes ids) or W64 (GUID ids) file */
+static int wavmap_parse(struct wavmap_s *map) {
+
+	const unsigned char *p, *end, *fmt = NULL;
+	uint64_t size, fmt_size = 0, data_size = 0;
+	int w64;
+
+	p = map->base;
+	end = map->base + map->len;
+
+	if (map->len >= 12 && !memcmp(p, "RIFF", 4) && !memcmp(p + 8, "WAVE", 4)) {
+		w64 = 0;
+		p += 12;
+	}
+	else if (map->len >= 40 && !memcmp(p, w64_riff, 16) && !memcmp(p + 24, w64_wave, 16)) {
+		w64 = 1;
+		p += 40;
+	}
+	else
+		return 0;
+
+	while (p + (w64 ? 24 : 8) <= end) {
+
+		if (w64) {
+			/* W64 chunk size includes its 24 bytes header, chunks are 8 bytes aligned */
+			size = wav_le64(p + 16);
+			if (size < 24)
+				return 0;
+			size -= 24;
+
+			if (!memcmp(p, w64_fmt, 16)) {
+				fmt = p + 24;
+				fmt_size = size;
+			}
+			else if (!memcmp(p, w64_data, 16)) {
+				map->data = p + 24;
+				data_size = size;
+			}
+
+			p += 24 + ((size + 7) & ~(uint64_t)7);
+		}
+		else {
+			/* WAV chunks are 2 bytes aligned */
+			size = wav_le32(p + 4);
+
+			if (!memcmp(p, "fmt ", 4)) {
+				fmt = p + 8;
+				fmt_size = size;
+			}
+			else if (!memcmp(p, "data", 4)) {
+				map->data = p + 8;
+				data_size = size;
+			}
+
+			p += 8 + ((size + 1) & ~(uint64_t)1);
+		}
+
+		if (fmt && map->data)
+			break;
+	}
+
+	if (!fmt || !map->data || fmt + fmt_size > end)
+		return 0;
+
+	if (!wavmap_fmt(map, fmt, fmt_size))
+		return 0;
+
+	/* a file cut short (i.e. recording interrupted) holds less than its header says */
+	if (map->data + data_size > end)
+		data_size = end - map->data;
+
+	map->frames = data_size / (map->width * map->channels);
+
+	return 1;
+}
+
+static void wavmap_prefetch(struct wavmap_s *map) {
+
+	const unsigned char *start, *stop;
+	size_t page;
+	sf_count_t last;
+
+	if (map->ram)
+		return;
+
+	last = map->pos + map->ahead;
+	if (last > map->frames)
+		last = map->frames;
+
+	/* only ask for more once half of the window has been consumed */
+	if (map->advised >= map->pos + map->ahead / 2 || map->advised >= last)
+		return;
+
+	if (map->advised < map->pos)
+		map->advised = map->pos;
+
+	page = sysconf(_SC_PAGESIZE);
+
+	start = map->data + map->advised * map->width * map->channels;
+	stop = map->data + last * map->width * map->channels;
+
+	start = map->base + ((start - map->base) & ~(page - 1));
+
+	madvise((void *)start, stop - start, MADV_WILLNEED);
+
+	map->advised = last;
+}
+
+struct wavmap_s *wavmap_open(const char *file, sf_count_t ahead) {
+
+	struct wavmap_s *map;
+	struct stat st;
+	int fd;
+
+	/* samples are converted in place, only little endian hosts read them as is */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+	return NULL;
+#endif
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size == 0 || (uint64_t)st.st_size > (size_t)-1) {
+		close(fd);
+		return NULL;
+	}
+
+	map = calloc(1, sizeof(struct wavmap_s));
+
+	map->len = st.st_size;
+	map->base = mmap(NULL, map->len, PROT_READ, MAP_SHARED, fd, 0);
+
+	/* the mapping keeps the file referenced */
+	close(fd);
+
+	if (map->base == MAP_FAILED) {
+		free(map);
+		return NULL;
+	}
+
+	if (!wavmap_parse(map)) {
+		munmap(map->base, map->len);
+		free(map);
+		return NULL;
+	}
+
+	madvise(map->base, map->len, MADV_SEQUENTIAL);
+
+	map->ahead = ahead;
+	map->pos = 0;
+	map->advised = 0;
+
+	wavmap_prefetch(map);
+
+	return map;
+}
+
+struct wavmap_s *wavmap_alloc(unsigned int channels, sf_count_t frames) {
+
+	struct wavmap_s *map;
+
+	if ((uint64_t)frames * channels * sizeof(float) > (size_t)-1)
+		return NULL;
+
+	map = calloc(1, sizeof(struct wavmap_s));
+
+	map->len = frames * channels * sizeof(float);
+	map->base = malloc(map->len ? map->len : 1);
+
+	if (!map->base) {
+		free(map);
+		return NULL;
+	}
+
+	map->data = map->base;
+	map->channels = channels;
+	map->width = sizeof(float);
+	map->is_float = 1;
+	map->frames = frames;
+	map->ram = 1;
+
+	/* nothing to prefetch */
+	map->ahead = 0;
+
+	return map;
+}
+
+void wavmap_close(struct wavmap_s *map) {
+
+	if (!map)
+		return;
+
+	if (map->ram)
+		free(map->base);
+	else
+		munmap(map->base, map->len);
+
+	free(map);
+}
+
+sf_count_t wavmap_seek(struct wavmap_s *map, sf_count_t frames, int whence) {
+
+	if (whence == SEEK_CUR)
+		frames += map->pos;
+	else if (whence == SEEK_END)
+		frames += map->frames;
+
+	if (frames < 0 || frames > map->frames)
+		return -1;
+
+	/* seeking is just moving the read position, restart prefetch from there */
+	map->pos = frames;
+	map->advised = frames;
+
+	wavmap_prefetch(map);
+
+	return map->pos;
+}
+
+/* same semantic as sf_read_float(): items are samples, a multiple of channels */
+sf_count_t wavmap_read_float(struct wavmap_s *map, float *buf, sf_count_t items) {
+
+	const unsigned char *p;
+	sf_count_t frames, i, n;
+	int32_t v;
+
+	frames = items / map->channels;
+
+	if (frames > map->frames - map->pos)
+		frames = map->frames - map->pos;
+
+	n = frames * map->channels;
+	p = map->data + map->pos * map->width * map->channels;
+
+	switch (map->width) {
+
+		case 2:
+			for (i = 0; i < n; i++, p += 2)
+				buf[i] = (int16_t)wav_le16(p) * (1.0f / 0x8000);
+			break;
+
+		case 3:
+			for (i = 0; i < n; i++, p += 3) {
+				v = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24));
+				buf[i] = (v >> 8) * (1.0f / 0x800000);
+			}
+			break;
+
+		case 4:
+			if (map->is_float)
+				memcpy(buf, p, n * sizeof(float));
+			else
+				for (i = 0; i < n; i++, p += 4)
+					buf[i] = (int32_t)wav_le32(p) * (1.0f / 0x80000000u);
+			break;
+	}
+
+	map->pos += frames;
+
+	wavmap_prefetch(map);
+
+	return n;
+}
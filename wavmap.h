@@ -0,0 +1,59 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+note :
+- a wavmap gives direct access to the samples of an uncompressed WAV or W64 file
+  (16, 24, 32 bits PCM or 32 bits float) by mapping the whole file in memory.
+- seeking only moves the read position, pages ahead of it are prefetched with
+  madvise() so the reader does not wait for the disk on a refill.
+- files in any other format are left to libsndfile.
+- a wavmap can also hold a take decoded in memory as 32 bits float, ram is then
+  set and base is allocated instead of mapped.
+*/
+struct wavmap_s
+{
+	unsigned char *base;        /* start of the mapping */
+	size_t len;                 /* length of the mapping */
+	const unsigned char *data;  /* first sample */
+
+	unsigned int channels;
+	unsigned int width;         /* bytes per sample */
+	unsigned int is_float;
+	sf_count_t frames;
+
+	sf_count_t pos;             /* read position in frames */
+	sf_count_t advised;         /* prefetch requested up to this frame */
+	sf_count_t ahead;           /* frames to prefetch ahead of pos */
+
+	unsigned int ram;           /* decoded in memory, not mapped */
+};
+
+struct wavmap_s * wavmap_open       (const char *file, sf_count_t ahead);
+struct wavmap_s * wavmap_alloc      (unsigned int channels, sf_count_t frames);
+void              wavmap_close      (struct wavmap_s *map);
+sf_count_t        wavmap_seek       (struct wavmap_s *map, sf_count_t frames, int whence);
+sf_count_t        wavmap_read_float (struct wavmap_s *map, float *buf, sf_count_t items);
+
+unsigned int       wav_le16 (const unsigned char *p);
+unsigned int       wav_le32 (const unsigned char *p);
+unsigned long long wav_le64 (const unsigned char *p);
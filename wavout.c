@@ -0,0 +1,585 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/* O_DIRECT */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <aio.h>
+#include <sys/stat.h>
+
+#include <sndfile.h>
+
+#include "wavmap.h"
+#include "wavout.h"
+#include "clock.h"
+
+static const unsigned char w64_riff[16] = { 'r','i','f','f', 0x2E,0x91,0xCF,0x11, 0xA5,0xD6,0x28,0xDB, 0x04,0xC1,0x00,0x00 };
+static const unsigned char w64_wave[16] = { 'w','a','v','e', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1,0x00,0xC0, 0x4F,0x8E,0xDB,0x8A };
+static const unsigned char w64_fmt [16] = { 'f','m','t',' ', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1,0x00,0xC0, 0x4F,0x8E,0xDB,0x8A };
+static const unsigned char w64_junk[16] = { 'j','u','n','k', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1,0x00,0xC0, 0x4F,0x8E,0xDB,0x8A };
+static const unsigned char w64_data[16] = { 'd','a','t','a', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1,0x00,0xC0, 0x4F,0x8E,0xDB,0x8A };
+
+static void put16(unsigned char *p, unsigned int v) {
+	p[0] = v; p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+	put32(p, (uint32_t)v);
+	put32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* build the WAVOUT_ALIGN bytes header for the current number of frames */
+static void wavout_header(struct wavout_s *out, unsigned char *h, uint64_t data) {
+
+	unsigned char *fmt;
+
+	memset(h, 0, WAVOUT_ALIGN);
+
+	if (out->w64) {
+		memcpy(h, w64_riff, 16);
+		put64(h + 16, WAVOUT_ALIGN + data);
+		memcpy(h + 24, w64_wave, 16);
+
+		memcpy(h + 40, w64_fmt, 16);
+		put64(h + 56, 24 + 16);
+		fmt = h + 64;
+
+		memcpy(h + 80, w64_junk, 16);
+		put64(h + 96, WAVOUT_ALIGN - 24 - 80);
+
+		memcpy(h + WAVOUT_ALIGN - 24, w64_data, 16);
+		put64(h + WAVOUT_ALIGN - 8, 24 + data);
+	}
+	else {
+		/* plain RIFF sizes are 32 bits, they saturate past 4GB */
+		if (data > 0xFFFFFFFFull - WAVOUT_ALIGN)
+			data = 0xFFFFFFFFull - WAVOUT_ALIGN;
+
+		memcpy(h, "RIFF", 4);
+		put32(h + 4, WAVOUT_ALIGN - 8 + data);
+		memcpy(h + 8, "WAVE", 4);
+
+		memcpy(h + 12, "fmt ", 4);
+		put32(h + 16, 16);
+		fmt = h + 20;
+
+		memcpy(h + 36, "JUNK", 4);
+		put32(h + 40, WAVOUT_ALIGN - 8 - 44);
+
+		memcpy(h + WAVOUT_ALIGN - 8, "data", 4);
+		put32(h + WAVOUT_ALIGN - 4, data);
+	}
+
+	put16(fmt, 1); /* PCM */
+	put16(fmt + 2, out->channels);
+	put32(fmt + 4, out->samplerate);
+	put32(fmt + 8, out->samplerate * out->width * out->channels);
+	put16(fmt + 12, out->width * out->channels);
+	put16(fmt + 14, out->width * 8);
+}
+
+int wavout_supported(int format) {
+
+	int type, subtype;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+	return 0;
+#endif
+
+	type = format & SF_FORMAT_TYPEMASK;
+	subtype = format & SF_FORMAT_SUBMASK;
+
+	if (type != SF_FORMAT_WAV && type != SF_FORMAT_W64)
+		return 0;
+
+	return (subtype == SF_FORMAT_PCM_16 || subtype == SF_FORMAT_PCM_24 || subtype == SF_FORMAT_PCM_32);
+}
+
+/* wait for a buffer previously handed to the kernel */
+static int wavout_wait(struct wavout_s *out, unsigned int i) {
+
+	const struct aiocb *list[1];
+	int err;
+
+	if (out->cb[i].aio_buf == NULL)
+		return 0;
+
+	list[0] = &out->cb[i];
+
+	while ((err = aio_error(&out->cb[i])) == EINPROGRESS)
+		aio_suspend(list, 1, NULL);
+
+	if (err || aio_return(&out->cb[i]) != (ssize_t)out->cb[i].aio_nbytes)
+		out->error = err ? err : EIO;
+
+	out->cb[i].aio_buf = NULL;
+
+	return out->error;
+}
+
+/* reserve disk space ahead of what is written, file size is left as is */
+static void wavout_prealloc(struct wavout_s *out, off_t end) {
+
+#ifdef FALLOC_FL_KEEP_SIZE
+	off_t len;
+
+	if (end <= out->allocated)
+		return;
+
+	len = end - out->allocated;
+	if (len < out->extent)
+		len = out->extent;
+
+	/* not all file systems support it, that is not an error */
+	if (fallocate(out->fd, FALLOC_FL_KEEP_SIZE, out->allocated, len) == 0)
+		out->allocated += len;
+	else
+		out->allocated = (off_t)1 << 62;
+#endif
+}
+
+/* write sizes of what was handed to the kernel so far, sync it in background */
+static void wavout_checkpoint(struct wavout_s *out) {
+
+	uint64_t data;
+
+	out->next_checkpoint = out->frames + out->checkpoint;
+
+	/* first buffer holds the placeholder header, wait until it is surely on disk */
+	if (out->pos < WAVOUT_BUFS * WAVOUT_BUF_SIZE)
+		return;
+
+	data = out->pos - WAVOUT_ALIGN;
+	data -= data % (out->width * out->channels);
+
+	wavout_header(out, out->hdr, data);
+
+	if (pwrite(out->fd, out->hdr, WAVOUT_ALIGN, 0) != WAVOUT_ALIGN)
+		return;
+
+	if (out->sync_cb.aio_fildes >= 0 && aio_error(&out->sync_cb) == EINPROGRESS)
+		return;
+
+	memset(&out->sync_cb, 0, sizeof(struct aiocb));
+	out->sync_cb.aio_fildes = out->fd;
+
+	if (aio_fsync(O_DSYNC, &out->sync_cb))
+		out->sync_cb.aio_fildes = -1;
+}
+
+void wavout_setup(struct wavout_s *out, unsigned long long expected, unsigned long long checkpoint) {
+
+	/* take length known in advance, reserve all of it at once */
+	if (expected)
+		wavout_prealloc(out, WAVOUT_ALIGN + (off_t)expected * out->width * out->channels);
+
+	out->checkpoint = checkpoint;
+	out->next_checkpoint = checkpoint;
+}
+
+/* current buffer is full, write it and move to the next one */
+static void wavout_flush(struct wavout_s *out) {
+
+	unsigned long long start;
+	unsigned int next;
+
+	memset(&out->cb[out->cur], 0, sizeof(struct aiocb));
+	out->cb[out->cur].aio_fildes = out->fd;
+	out->cb[out->cur].aio_buf = out->buf[out->cur];
+	out->cb[out->cur].aio_nbytes = WAVOUT_BUF_SIZE;
+	out->cb[out->cur].aio_offset = out->pos;
+
+	if (out->mode == WAVOUT_SYNC || aio_write(&out->cb[out->cur])) {
+		if (pwrite(out->fd, out->buf[out->cur], WAVOUT_BUF_SIZE, out->pos) != WAVOUT_BUF_SIZE)
+			out->error = errno ? errno : EIO;
+		out->cb[out->cur].aio_buf = NULL;
+	}
+
+	out->pos += WAVOUT_BUF_SIZE;
+	out->fill = 0;
+
+	if (out->pos + WAVOUT_BUF_SIZE > out->allocated)
+		wavout_prealloc(out, out->pos + WAVOUT_BUF_SIZE);
+
+	next = (out->cur + 1) % WAVOUT_BUFS;
+
+	/* all buffers in flight, the disk is late */
+	if (out->cb[next].aio_buf && aio_error(&out->cb[next]) == EINPROGRESS) {
+		start = now_usec();
+		wavout_wait(out, next);
+		start = now_usec() - start;
+		out->stalls++;
+		if (start > out->stall_max)
+			out->stall_max = start;
+	}
+	else
+		wavout_wait(out, next);
+
+	out->cur = next;
+}
+
+struct wavout_s *wavout_open(const char *file, int format, unsigned int channels, unsigned int samplerate, unsigned int mode) {
+
+	struct wavout_s *out;
+	unsigned int i;
+	int flags;
+
+	if (!wavout_supported(format) || !channels)
+		return NULL;
+
+	out = calloc(1, sizeof(struct wavout_s));
+
+	out->mode = mode;
+	out->w64 = ((format & SF_FORMAT_TYPEMASK) == SF_FORMAT_W64);
+	out->channels = channels;
+	out->samplerate = samplerate;
+
+	switch (format & SF_FORMAT_SUBMASK) {
+		case SF_FORMAT_PCM_16: out->width = 2; break;
+		case SF_FORMAT_PCM_24: out->width = 3; break;
+		default:               out->width = 4; break;
+	}
+
+	flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+	out->fd = -1;
+#ifdef O_DIRECT
+	/* some file systems (tmpfs...) do not support O_DIRECT */
+	if (mode == WAVOUT_ASYNC) {
+		out->fd = open(file, flags | O_DIRECT, 0644);
+		out->direct = (out->fd >= 0);
+	}
+#endif
+	if (out->fd < 0)
+		out->fd = open(file, flags, 0644);
+
+	if (out->fd < 0) {
+		free(out);
+		return NULL;
+	}
+
+	for (i = 0; i < WAVOUT_BUFS; i++)
+		if (posix_memalign((void **)&out->buf[i], WAVOUT_ALIGN, WAVOUT_BUF_SIZE)) {
+			while (i--)
+				free(out->buf[i]);
+			close(out->fd);
+			free(out);
+			return NULL;
+		}
+
+	if (posix_memalign((void **)&out->hdr, WAVOUT_ALIGN, WAVOUT_ALIGN)) {
+		for (i = 0; i < WAVOUT_BUFS; i++)
+			free(out->buf[i]);
+		close(out->fd);
+		free(out);
+		return NULL;
+	}
+
+	out->sync_cb.aio_fildes = -1;
+
+	out->extent = (off_t)WAVOUT_EXTENT_SEC * samplerate * out->width * channels;
+	out->extent -= out->extent % WAVOUT_BUF_SIZE;
+	if (out->extent < WAVOUT_BUF_SIZE)
+		out->extent = WAVOUT_BUF_SIZE;
+
+	out->checkpoint = (unsigned long long)WAVOUT_CHECKPOINT_SEC * samplerate;
+	out->next_checkpoint = out->checkpoint;
+
+	wavout_prealloc(out, WAVOUT_BUF_SIZE);
+
+	/* reserve header, samples start at WAVOUT_ALIGN */
+	wavout_header(out, out->buf[0], 0);
+	out->fill = WAVOUT_ALIGN;
+	out->pos = 0;
+
+	return out;
+}
+
+/* float to little endian PCM, clipped */
+static void wavout_sample(float s, unsigned int width, unsigned char *p) {
+
+	int32_t v;
+
+	switch (width) {
+		case 2:
+			v = (int32_t)lrintf(s * 32768.0f);
+			if (v > 0x7FFF) v = 0x7FFF;
+			if (v < -0x8000) v = -0x8000;
+			put16(p, (uint32_t)v);
+			break;
+		case 3:
+			v = (int32_t)lrintf(s * 8388608.0f);
+			if (v > 0x7FFFFF) v = 0x7FFFFF;
+			if (v < -0x800000) v = -0x800000;
+			p[0] = v; p[1] = v >> 8; p[2] = v >> 16;
+			break;
+		default:
+			if (s >= 1.0f)
+				v = 0x7FFFFFFF;
+			else if (s <= -1.0f)
+				v = (int32_t)0x80000000;
+			else
+				v = (int32_t)lrint(s * 2147483648.0);
+			put32(p, (uint32_t)v);
+			break;
+	}
+}
+
+unsigned int wavout_writef_float(struct wavout_s *out, const float *buf, unsigned int frames) {
+
+	unsigned int i, b, n;
+	unsigned char tmp[4];
+
+	n = frames * out->channels;
+
+	for (i = 0; i < n; i++) {
+
+		if (out->fill + out->width <= WAVOUT_BUF_SIZE) {
+			wavout_sample(buf[i], out->width, out->buf[out->cur] + out->fill);
+			out->fill += out->width;
+		}
+		else {
+			/* sample straddles two buffers */
+			wavout_sample(buf[i], out->width, tmp);
+			for (b = 0; b < out->width; b++) {
+				out->buf[out->cur][out->fill++] = tmp[b];
+				if (out->fill == WAVOUT_BUF_SIZE)
+					wavout_flush(out);
+			}
+			continue;
+		}
+
+		if (out->fill == WAVOUT_BUF_SIZE)
+			wavout_flush(out);
+	}
+
+	out->frames += frames;
+
+	if (out->checkpoint && out->frames >= out->next_checkpoint)
+		wavout_checkpoint(out);
+
+	return out->error ? 0 : frames;
+}
+
+int wavout_close(struct wavout_s *out) {
+
+	unsigned int i;
+	int error;
+
+	if (!out)
+		return 0;
+
+	for (i = 0; i < WAVOUT_BUFS; i++)
+		wavout_wait(out, i);
+
+	if (out->sync_cb.aio_fildes >= 0) {
+		const struct aiocb *list[1] = { &out->sync_cb };
+		while (aio_error(&out->sync_cb) == EINPROGRESS)
+			aio_suspend(list, 1, NULL);
+		aio_return(&out->sync_cb);
+	}
+
+	/* tail and header are not aligned, write them thru the page cache */
+#ifdef O_DIRECT
+	if (out->direct)
+		fcntl(out->fd, F_SETFL, fcntl(out->fd, F_GETFL) & ~O_DIRECT);
+#endif
+
+	if (out->fill && pwrite(out->fd, out->buf[out->cur], out->fill, out->pos) != (ssize_t)out->fill)
+		out->error = EIO;
+
+	/* header may still be in the current buffer if less than one buffer was written */
+	wavout_header(out, out->buf[out->cur], out->frames * out->width * out->channels);
+	if (pwrite(out->fd, out->buf[out->cur], WAVOUT_ALIGN, 0) != WAVOUT_ALIGN)
+		out->error = EIO;
+
+	if (ftruncate(out->fd, out->pos + out->fill))
+		out->error = EIO;
+
+#if defined(FALLOC_FL_KEEP_SIZE) && defined(FALLOC_FL_PUNCH_HOLE)
+	/* give back space preallocated past the end of the take */
+	if (out->allocated > out->pos + out->fill && out->allocated < (off_t)1 << 62)
+		fallocate(out->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, out->pos + out->fill, out->allocated - out->pos - out->fill);
+#endif
+
+	fdatasync(out->fd);
+	close(out->fd);
+
+	for (i = 0; i < WAVOUT_BUFS; i++)
+		free(out->buf[i]);
+	free(out->hdr);
+
+	error = out->error;
+	free(out);
+
+	return error;
+}
+
+/* what follows recorded samples looks like a chunk, header is consistent */
+static int wavout_chunk_follows(const unsigned char *p, unsigned int w64) {
+
+	unsigned int i;
+
+	if (w64)
+		return !memcmp(p + 4, w64_data + 4, 12) || !memcmp(p, w64_riff, 16);
+
+	for (i = 0; i < 4; i++)
+		if (p[i] < 0x20 || p[i] > 0x7E)
+			return 0;
+
+	return 1;
+}
+
+/*
+** Repair a take that was not closed properly (crash, power loss): set header
+** sizes to the samples actually found in the file and drop a partial frame.
+** Returns 1 if the file was repaired, 0 if it was fine, -1 if it is not a
+** WAV/W64 file we can handle.
+*/
+int wavout_recover(const char *file, unsigned long long *frames) {
+
+	unsigned char h[0x10000], next[16];
+	uint64_t size, data_size = 0, avail, riff;
+	off_t data_hdr = 0, data = 0, end;
+	unsigned int w64, align = 0, off, hdr_len, i;
+	struct stat st;
+	ssize_t len;
+	int fd, ret = 0;
+
+	fd = open(file, O_RDWR);
+	if (fd < 0)
+		return -1;
+
+	len = pread(fd, h, sizeof(h), 0);
+
+	if (fstat(fd, &st) || len < 12) {
+		close(fd);
+		return -1;
+	}
+
+	if (!memcmp(h, "RIFF", 4) && !memcmp(h + 8, "WAVE", 4)) {
+		w64 = 0;
+		off = 12;
+		hdr_len = 8;
+	}
+	else if (len >= 40 && !memcmp(h, w64_riff, 16) && !memcmp(h + 24, w64_wave, 16)) {
+		w64 = 1;
+		off = 40;
+		hdr_len = 24;
+	}
+	else {
+		close(fd);
+		return -1;
+	}
+
+	/* find block alignment in 'fmt ' and where samples start */
+	while (off + hdr_len <= len) {
+
+		if (w64) {
+			/* a data chunk never patched may have a null size */
+			size = wav_le64(h + off + 16);
+			size = size < 24 ? 0 : size - 24;
+		}
+		else
+			size = wav_le32(h + off + 4);
+
+		if (!memcmp(h + off, w64 ? w64_fmt : (const unsigned char *)"fmt ", w64 ? 16 : 4) && off + hdr_len + 14 <= len)
+			align = wav_le16(h + off + hdr_len + 12);
+
+		if (!memcmp(h + off, w64 ? w64_data : (const unsigned char *)"data", w64 ? 16 : 4)) {
+			data_hdr = off;
+			data = off + hdr_len;
+			data_size = size;
+			break;
+		}
+
+		if (w64 && !size)
+			break;
+
+		off += hdr_len + (w64 ? ((size + 7) & ~(uint64_t)7) : ((size + 1) & ~(uint64_t)1));
+	}
+
+	if (!align || !data || data > len || data > st.st_size) {
+		close(fd);
+		return -1;
+	}
+
+	avail = st.st_size - data;
+	avail -= avail % align;
+
+	if (data_size && data + data_size <= (uint64_t)st.st_size) {
+
+		/* header agrees with file unless samples were written after a checkpoint */
+		end = data + ((data_size + (w64 ? 7 : 1)) & ~(uint64_t)(w64 ? 7 : 1));
+
+		if (end + 16 > st.st_size || pread(fd, next, 16, end) != 16 || wavout_chunk_follows(next, w64) || data_size == avail) {
+			if (frames)
+				*frames = data_size / align;
+			close(fd);
+			return 0;
+		}
+	}
+
+	/* plain RIFF sizes are 32 bits */
+	if (!w64 && avail > 0xFFFFFFFFull - data)
+		avail = (0xFFFFFFFFull - data) - (0xFFFFFFFFull - data) % align;
+
+	if (w64) {
+		riff = data + avail;
+		for (i = 0; i < 8; i++) {
+			h[16 + i] = riff >> (8 * i);
+			h[data_hdr + 16 + i] = (24 + avail) >> (8 * i);
+		}
+	}
+	else {
+		riff = data - 8 + avail;
+		for (i = 0; i < 4; i++) {
+			h[4 + i] = riff >> (8 * i);
+			h[data_hdr + 4 + i] = avail >> (8 * i);
+		}
+	}
+
+	if (pwrite(fd, h, data, 0) != data || ftruncate(fd, data + avail))
+		ret = -1;
+	else
+		ret = 1;
+
+	fsync(fd);
+	close(fd);
+
+	if (frames)
+		*frames = avail / align;
+
+	return ret;
+}
@@ -0,0 +1,90 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/* number of buffers in flight per take file */
+#define WAVOUT_BUFS 4
+
+/* size of each buffer, multiple of WAVOUT_ALIGN */
+#define WAVOUT_BUF_SIZE 0x40000
+
+/* O_DIRECT alignment, also where samples start in the file */
+#define WAVOUT_ALIGN 0x1000
+
+/* preallocation extent when take length is not known, in seconds */
+#define WAVOUT_EXTENT_SEC 60
+
+/* default header checkpoint interval, in seconds */
+#define WAVOUT_CHECKPOINT_SEC 10
+
+/* wavout modes */
+#define WAVOUT_ASYNC 0 /* O_DIRECT when available, buffers written in background */
+#define WAVOUT_SYNC 1  /* buffered, each buffer written before going on */
+
+/*
+note :
+- a wavout writes an uncompressed WAV or W64 take without going thru libsndfile.
+- samples are converted in aligned buffers that are handed to the kernel with
+  aio_write() while the next ones are filled, so a slow disk delays the writer
+  thread only once all buffers are in flight.
+- the header reserves WAVOUT_ALIGN bytes (padded with a junk chunk) so samples
+  stay aligned for O_DIRECT, sizes are written at close.
+- file space is preallocated in large extents (without changing the file size)
+  so a long take is not fragmented write after write.
+- the header is rewritten every checkpoint frames and synced in the background,
+  so a crash only loses what was written since; wavout_recover() fixes sizes
+  of a take that was not closed.
+*/
+struct wavout_s
+{
+	int fd;
+	int direct;
+	unsigned int mode;
+
+	unsigned int w64;
+	unsigned int channels;
+	unsigned int width;         /* bytes per sample */
+	unsigned int samplerate;
+
+	unsigned char *buf[WAVOUT_BUFS];
+	struct aiocb cb[WAVOUT_BUFS];
+	unsigned int cur;           /* buffer beeing filled */
+	size_t fill;                /* bytes in current buffer */
+	off_t pos;                  /* file offset of current buffer */
+
+	unsigned long long frames;
+	off_t allocated;            /* bytes preallocated */
+	off_t extent;               /* bytes preallocated at once */
+	unsigned long long checkpoint;      /* frames between header checkpoints, 0 for none */
+	unsigned long long next_checkpoint; /* frames */
+	unsigned char *hdr;         /* aligned header block for checkpoints */
+	struct aiocb sync_cb;
+	unsigned int stalls;        /* times the writer waited for a buffer */
+	unsigned long long stall_max; /* usec */
+	int error;
+};
+
+struct wavout_s * wavout_open        (const char *file, int format, unsigned int channels, unsigned int samplerate, unsigned int mode);
+int               wavout_supported   (int format);
+void              wavout_setup       (struct wavout_s *out, unsigned long long expected, unsigned long long checkpoint);
+unsigned int      wavout_writef_float(struct wavout_s *out, const float *buf, unsigned int frames);
+int               wavout_close       (struct wavout_s *out);
+int               wavout_recover     (const char *file, unsigned long long *frames);
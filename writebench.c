@@ -0,0 +1,281 @@
+/*
+
+  meterec
+  Console based multi track digital peak meter and recorder for JACK
+  Copyright (C) 2009-2020 Fabrice Lebas
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+** Stress benchmark of the take writer: a fake jack process fills a disk
+** buffer with 64 tracks at 96kHz in real time while a writer thread drains
+** it to a W64 take, and a competing process keeps the same disk busy with
+** large synced writes. Reports disk buffer overflows and writer stalls.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <aio.h>
+#include <sys/wait.h>
+
+#include <sndfile.h>
+
+#include "wavout.h"
+#include "clock.h"
+
+#define PERIOD 256
+#define CHUNK 4096
+#define HOG_CHUNK 0x800000
+#define HOG_FILE "writebench_hog.tmp"
+#define TAKE_FILE "writebench_take.w64"
+
+struct bench_s
+{
+	unsigned int tracks;
+	unsigned int rate;
+	unsigned int seconds;
+	unsigned int size;        /* disk buffer size in frames, power of two */
+	unsigned int mode;
+
+	float *ring;              /* interleaved disk buffer */
+	volatile unsigned int process_pos;
+	volatile unsigned int thread_pos;
+	volatile unsigned int done;
+
+	unsigned int overflows;
+	unsigned int max_fill;
+	unsigned long long max_chunk; /* usec */
+};
+
+/* fake jack process: one period of samples every PERIOD/rate seconds */
+static void *process(void *d) {
+
+	struct bench_s *b = d;
+	struct timespec next;
+	unsigned long long periods, p;
+	unsigned int i, t, pos, fill;
+
+	periods = (unsigned long long)b->seconds * b->rate / PERIOD;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (p = 0; p < periods; p++) {
+
+		fill = (b->process_pos - b->thread_pos) & (b->size - 1);
+		if (fill > b->max_fill)
+			b->max_fill = fill;
+
+		/* same rule as jack process: do not overwrite what the writer did not drain */
+		if (fill + PERIOD >= b->size) {
+			b->overflows++;
+		}
+		else {
+			pos = b->process_pos;
+			for (i = 0; i < PERIOD; i++) {
+				for (t = 0; t < b->tracks; t++)
+					b->ring[pos * b->tracks + t] = ((p * PERIOD + i + t) % 200) / 100.0f - 1.0f;
+				pos = (pos + 1) & (b->size - 1);
+			}
+			__atomic_store_n(&b->process_pos, pos, __ATOMIC_RELEASE);
+		}
+
+		next.tv_nsec += (long)PERIOD * 1000000000 / b->rate;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	b->done = 1;
+
+	return NULL;
+}
+
+/* writer thread: drain CHUNK frames at a time */
+static void *writer(void *d) {
+
+	struct bench_s *b = d;
+	struct wavout_s *out;
+	float *chunk;
+	unsigned int n, i, pos;
+	unsigned long long start;
+
+	out = wavout_open(TAKE_FILE, SF_FORMAT_W64 | SF_FORMAT_PCM_24, b->tracks, b->rate, b->mode);
+	if (!out) {
+		fprintf(stderr, "Cannot open '%s'\n", TAKE_FILE);
+		exit(1);
+	}
+
+	chunk = malloc(CHUNK * b->tracks * sizeof(float));
+
+	while (!b->done || b->thread_pos != b->process_pos) {
+
+		n = (__atomic_load_n(&b->process_pos, __ATOMIC_ACQUIRE) - b->thread_pos) & (b->size - 1);
+
+		if (n < CHUNK && !b->done) {
+			usleep(1000);
+			continue;
+		}
+
+		if (n > CHUNK)
+			n = CHUNK;
+
+		pos = b->thread_pos;
+		for (i = 0; i < n; i++) {
+			memcpy(chunk + i * b->tracks, b->ring + pos * b->tracks, b->tracks * sizeof(float));
+			pos = (pos + 1) & (b->size - 1);
+		}
+
+		start = now_usec();
+		wavout_writef_float(out, chunk, n);
+		start = now_usec() - start;
+		if (start > b->max_chunk)
+			b->max_chunk = start;
+
+		__atomic_store_n(&b->thread_pos, pos, __ATOMIC_RELEASE);
+	}
+
+	printf("writer   %s, %d stalls (max %lluusec), slowest chunk %lluusec\n",
+		b->mode == WAVOUT_SYNC ? "sync buffered" : out->direct ? "async direct" : "async buffered",
+		out->stalls, out->stall_max, b->max_chunk);
+
+	if (wavout_close(out))
+		printf("ERROR: write failed\n");
+
+	free(chunk);
+
+	return NULL;
+}
+
+/* competing process: large synced writes to the same file system */
+static void hog(void) {
+
+	char *buf;
+	int fd;
+	off_t pos = 0;
+
+	buf = malloc(HOG_CHUNK);
+	memset(buf, 0x55, HOG_CHUNK);
+
+	fd = open(HOG_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		exit(1);
+
+	while (1) {
+		if (pwrite(fd, buf, HOG_CHUNK, pos) != HOG_CHUNK)
+			pos = 0;
+		else
+			pos += HOG_CHUNK;
+
+		/* keep the hog file from filling the disk */
+		if (pos >= 0x40000000)
+			pos = 0;
+
+		fsync(fd);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, no_hog = 0;
+	unsigned int ms = 2000;
+	pid_t pid = 0;
+	pthread_t tp, tw;
+	struct bench_s b;
+
+	memset(&b, 0, sizeof(b));
+	b.tracks = 64;
+	b.rate = 96000;
+	b.seconds = 20;
+	b.mode = WAVOUT_ASYNC;
+
+	while ((opt = getopt(argc, argv, "t:r:d:b:snh")) != -1) {
+		switch (opt) {
+			case 't':
+				b.tracks = atoi(optarg);
+				break;
+			case 'r':
+				b.rate = atoi(optarg);
+				break;
+			case 'd':
+				b.seconds = atoi(optarg);
+				break;
+			case 'b':
+				ms = atoi(optarg);
+				break;
+			case 's':
+				b.mode = WAVOUT_SYNC;
+				break;
+			case 'n':
+				no_hog = 1;
+				break;
+			case 'h':
+			default:
+				fprintf(stderr, "%s [-t tracks] [-r rate] [-d seconds] [-b buffer-ms] [-s] [-n]\n", argv[0]);
+				fprintf(stderr, "       -s      synchronous buffered writes instead of asynchronous direct writes\n");
+				fprintf(stderr, "       -n      no competing disk writer\n");
+				exit(1);
+		}
+	}
+
+	if (!b.tracks || !b.rate || !b.seconds) {
+		fprintf(stderr, "Invalid tracks, rate or duration.\n");
+		exit(1);
+	}
+
+	for (b.size = PERIOD * 2; b.size < (unsigned long long)ms * b.rate / 1000; b.size <<= 1) ;
+
+	b.ring = calloc((size_t)b.size * b.tracks, sizeof(float));
+
+	if (!no_hog) {
+		pid = fork();
+		if (pid == 0)
+			hog();
+	}
+
+	printf("record   %d tracks at %dHz for %ds, disk buffer %d frames\n", b.tracks, b.rate, b.seconds, b.size);
+
+	pthread_create(&tw, NULL, writer, &b);
+	pthread_create(&tp, NULL, process, &b);
+
+	pthread_join(tp, NULL);
+	pthread_join(tw, NULL);
+
+	if (pid > 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		unlink(HOG_FILE);
+	}
+
+	unlink(TAKE_FILE);
+
+	printf("process  %d overflow(s), disk buffer max fill %.1f%%\n", b.overflows, 100.0f * b.max_fill / b.size);
+
+	free(b.ring);
+
+	return b.overflows ? 2 : 0;
+}